@@ -38,12 +38,40 @@
 #include "cmdline.h"
 #include "serial_jjm.h"
 #include "convenient_wrapper_functions.h" 
+#include "bvt_daemon.h" 
+#include "bvt_stable.h" 
+#include "bvt_sweep.h" 
+#include "bvt_autotune.h" 
 
 bool verboseFlag = false; 
 struct sp_port *port; 
 
+/* Whether anything is asked of the device directly, rather than of the daemon */ 
+static bool action_given(const struct gengetopt_args_info *ai){ 
+    return ai->heater_on_given || ai->heater_off_given || ai->get_heater_state_given 
+        || ai->set_heater_power_limit_given || ai->get_heater_power_limit_given 
+        || ai->get_heater_power_given || ai->set_heater_power_given || ai->check_heater_given 
+        || ai->get_gas_flow_rate_given || ai->set_gas_flow_rate_given 
+        || ai->read_temperature_given || ai->set_temperature_setpoint_given 
+        || ai->get_temperature_setpoint_given 
+        || ai->get_ln2_heater_state_given || ai->set_ln2_heater_state_given 
+        || ai->get_ln2_heater_power_given || ai->set_ln2_heater_power_given 
+        || ai->check_ln2_heater_given 
+        || ai->enable_PID_control_given || ai->manual_mode_given || ai->get_mode_given 
+        || ai->set_proportional_band_given || ai->get_proportional_band_given 
+        || ai->set_integral_time_given || ai->get_integral_time_given 
+        || ai->set_differential_time_given || ai->get_differential_time_given 
+        || ai->get_high_cutback_given || ai->set_high_cutback_given 
+        || ai->get_low_cutback_given || ai->set_low_cutback_given 
+        || ai->get_adaptive_tune_level_given || ai->set_adaptive_tune_level_given 
+        || ai->lock_keypad_given || ai->get_eurotherm_status_given || ai->status_all_given 
+        || ai->check_sensor_break_given || ai->wait_stable_given || ai->sweep_given 
+        || ai->step_to_given || ai->autotune_given; 
+}
+
 int main(int argc, char **argv){ 
     struct gengetopt_args_info ai; 
+    int exitCode = 0; 
     /* ----- Parse arguments ---- */ 
 
     if (cmdline_parser(argc, argv, &ai) != 0){
@@ -55,6 +83,12 @@ int main(int argc, char **argv){
         return 0; /* quit */ 
     }
 
+    if (ai.daemon_given && action_given(&ai)) { 
+        fprintf(stderr,"FATAL: --daemon cannot be combined with commands for the device; "
+                "send them to the daemon with --listen instead\n"); 
+        return 1; 
+    }
+
     /* --- Open device ---*/  
 
     port = open_and_init_port(ai.device_arg, port); 
@@ -65,25 +99,26 @@ int main(int argc, char **argv){
         printf("Port %s opened successfully\n", ai.device_arg); 
     }
 
-    /* --- Send relevant commands, reply with data --- */
-    //Read temperature 
-    if(ai.read_temperature_given) { 
-        if(verboseFlag){printf("Reading temperature!\n");}; 
-        double temp =  eurotherm902s_get_temperature(port); 
-        printf("***TEMP: %f\n", temp); 
+    /* --- Daemon mode: stay resident and sample the device --- */ 
+    if (ai.daemon_given) { 
+        int result = run_daemon(&ai, port); 
+        sp_close(port); 
+        return result; 
     }
 
-    //Check for temperature sensor breaks
-    if(ai.check_sensor_break_given || ai.status_all_given ){
-        if(verboseFlag){printf("Checking sensor!\n"); } 
-        bool result = eurotherm902s_check_sensor_break(port); 
-        if (result == SET) { 
-            fprintf(stderr,"Warning: PT100/Thermocouple sensor break on device.\n"); 
-            fprintf(stderr,"***SBC : FAIL\n"); 
-        } else{
-            printf("***SBC : OK\n"); 
-        }
+    /* --- Send relevant commands, reply with data --- */
+    /* Requests are carried out by class rather than in the order they
+     * happen to be listed: safety actions go out on the very first
+     * transaction, then control writes, and only then the reads (which
+     * therefore also report the state after any changes). A heater-off
+     * must never wait behind a dozen status queries. */
 
+    /* --- Safety actions --- */
+    // Disable heater 
+    if(ai.heater_off_given) { 
+        if(verboseFlag){printf("Disabling heater!\n"); }
+        bvt3000_set_heater_state(UNSET, port); 
+        checkHeater(port); 
     }
 
     //Check heater 
@@ -102,30 +137,17 @@ int main(int argc, char **argv){
         }
     }
 
-    //Get heater state 
-    if(ai.get_heater_state_given|| ai.status_all_given) {
-        checkHeater(port); 
-    } 
-
+    /* --- Control writes --- */
     // Enable heater 
     if(ai.heater_on_given) { 
-        if(verboseFlag){printf("Enabling heater!\n"); }
-        bvt3000_set_heater_state(SET, port); 
-        checkHeater(port); 
-    }
-
-    // Disable heater 
-    if(ai.heater_off_given) { 
-        if(verboseFlag){printf("Disabling heater!\n"); }
-        bvt3000_set_heater_state(UNSET, port); 
-        checkHeater(port); 
-    }
-    
-    // Get heater power limit 
-    if(ai.get_heater_power_limit_given) { 
-        if(verboseFlag){printf("Getting heater power limit!\n"); }
-        double result = eurotherm902s_get_heater_power_limit(port); 
-        printf("***HPWL: %lf\n", result); 
+        if(ai.heater_off_given) { 
+            fprintf(stderr,"FATAL: Both heater on and heater off requested\n"); 
+            exitCode = 1; 
+        } else { 
+            if(verboseFlag){printf("Enabling heater!\n"); }
+            bvt3000_set_heater_state(SET, port); 
+            checkHeater(port); 
+        }
     }
 
     // Set heater power limit 
@@ -145,14 +167,6 @@ int main(int argc, char **argv){
         }
     }
 
-    //Get heater power 
-    if ( ai.get_heater_power_given) { 
-        if(verboseFlag) { printf("Getting heater power as a percentage!\n"); } 
-        double result = eurotherm902s_get_heater_power(port); 
-        printf("***HPWR: %lf\n",result); 
-    }
-
-
     //Enable automatic PID control 
     if(ai.enable_PID_control_given) {
         if(verboseFlag) { printf("Enabling PID control!\n"); } 
@@ -173,6 +187,204 @@ int main(int argc, char **argv){
         }
     }
 
+    //Set gas flow rate 
+    if(ai.set_gas_flow_rate_given){
+        if(verboseFlag) { printf("Requested change to gas flow rate to %f l/hr!\n", 
+                ai.set_gas_flow_rate_arg); }
+
+        if (verboseFlag) {printf("Checking heater status...\n");}
+        bool result = bvt3000_get_heater_state(port); 
+
+        if (result == SET) {
+            if (verboseFlag) {printf("Setting flow rate...\n");}
+            set_flow_rate((double) ai.set_gas_flow_rate_arg, port); 
+            if (verboseFlag) {printf("Checking flow rate...\n");}
+            unsigned int gfr = bvt3000_get_flow_rate(port); 
+            if (verboseFlag) {printf("Actual flow rate %u...\n", gfr);}
+        } else if (result == UNSET) {
+            fprintf(stderr,"FATAL: Cannot change gas flow rate with heater off\n"); 
+        }
+
+    }
+
+    //Set temperature setpoint 
+    
+    if(ai.set_temperature_setpoint_given) { 
+        if(verboseFlag)  {printf("Setting temperature setpoint to %f!\n", ai.set_temperature_setpoint_arg); } 
+        double temp = (double) ai.set_temperature_setpoint_arg; 
+        eurotherm902s_set_current_setpoint(temp, port); 
+    }
+
+    //Step the setpoint through the inactive one, at a given time 
+    if(ai.step_to_given) { 
+        struct timespec at; 
+        bool atGiven = false; 
+        char *end = NULL; 
+
+        if(ai.step_at_given) { 
+            double seconds = strtod(ai.step_at_arg, &end); 
+            if (ai.step_at_arg[0] == '+') { 
+                clock_gettime(CLOCK_REALTIME, &at); 
+                seconds += at.tv_sec + at.tv_nsec * 1e-9; 
+            }
+            at.tv_sec = (time_t) seconds; 
+            at.tv_nsec = (long) ((seconds - at.tv_sec) * 1e9); 
+            atGiven = true; 
+        }
+        if (atGiven && (end == ai.step_at_arg || *end != '\0')) { 
+            fprintf(stderr,"FATAL: Cannot make sense of step time %s\n", ai.step_at_arg); 
+            exitCode = 1; 
+        } else { 
+            if(verboseFlag){printf("Stepping setpoint to %f!\n", ai.step_to_arg); }
+            if (step_setpoint((double) ai.step_to_arg, atGiven ? &at : NULL, port) != 0) { 
+                exitCode = 1; 
+            }
+        }
+    }
+
+    //Lock or unlock keypad 
+    if(ai.lock_keypad_given) {
+        if(verboseFlag) { printf("Keyboard lock/unlock state change requested!\n"); }
+        if (ai.lock_keypad_arg == 1) {
+            if(verboseFlag){printf("Unlocking requested....\n"); }
+            eurotherm902s_lock_keyboard((bool) ai.lock_keypad_arg, port); 
+        } else {
+            if(verboseFlag){printf("Locking requested....\n"); }
+            eurotherm902s_lock_keyboard((bool) ai.lock_keypad_arg, port); 
+        }
+    }
+
+    //Set PID -- P
+    if(ai.set_proportional_band_given) { 
+            float setValue = ai.set_proportional_band_arg; 
+            if (verboseFlag) {printf("Setting proportional band to %f...\n", setValue);}
+            eurotherm902s_set_proportional_band(setValue, port); 
+    }
+
+    //Set PID -- I 
+    if(ai.set_integral_time_given) { 
+            float setValue = ai.set_integral_time_arg; 
+            if (verboseFlag) {printf("Setting integral time to %f...\n", setValue);}
+            eurotherm902s_set_integral_time(setValue, port); 
+    }
+
+    //Get PID -- D 
+    if(ai.set_differential_time_given) { 
+            float setValue = ai.set_differential_time_arg; 
+            if (verboseFlag) {printf("Setting derivative time to %f...\n", setValue);}
+            eurotherm902s_set_derivative_time(setValue, port); 
+    }
+
+    //Set heater state 
+    if(ai.set_ln2_heater_state_given) { 
+        if(verboseFlag) {printf("Changing state of ln2 LN2 heater to %u!\n", (bool)ai.set_ln2_heater_state_arg); } 
+        bvt3000_set_ln2_heater_state((bool)ai.set_ln2_heater_state_arg, port); 
+    }
+
+    //Set LN2  heater power 
+    if(ai.set_ln2_heater_power_given) { 
+        float gvnPwr = ai.set_ln2_heater_power_arg; 
+        if( (gvnPwr < 0 ) || (gvnPwr > 100)) { 
+            fprintf(stderr,"FATAL: Supplied heater power %f out of range [0, 100]\n", gvnPwr); 
+        } else { 
+            if(verboseFlag) { printf("Setting LN2 heater power to %f!\n", gvnPwr); } 
+            bvt3000_set_ln2_heater_power(gvnPwr, port); 
+        }
+    }
+
+    //Set high cutback value 
+    if(ai.set_high_cutback_given){
+        if(verboseFlag) {printf("Setting high cutback to %lf!\n", ai.set_high_cutback_arg); }
+        eurotherm902s_set_cutback_high((double) ai.set_high_cutback_arg, port); 
+    }
+
+    //Set low cutback value 
+    if(ai.set_low_cutback_given){
+        if(verboseFlag) {printf("Setting low cutback to %lf!\n", ai.set_low_cutback_arg); }
+        eurotherm902s_set_cutback_low((double) ai.set_low_cutback_arg, port); 
+    }
+
+    //Set adaptive tune value in K
+    if(ai.set_adaptive_tune_level_given){
+        if(verboseFlag) {printf("Setting adaptive tune to %lf!\n", ai.set_adaptive_tune_level_arg); }
+        eurotherm902s_set_adaptive_tune_trigger((double) ai.set_adaptive_tune_level_arg, port); 
+    }
+
+    /* --- Wait for the temperature to settle, or run a sweep --- */
+    /* After the writes (so that a new setpoint is waited for) and before
+     * the reads (which then report the settled state) */
+    if(ai.sweep_given) { 
+        int result = run_sweep(&ai, port); 
+        if (result != 0) { 
+            exitCode = result; 
+        }
+    } else if(ai.wait_stable_given) { 
+        if(verboseFlag){printf("Waiting for the temperature to stay within %f K for %f s!\n", 
+                ai.wait_stable_arg, ai.window_arg); }
+        if ((ai.wait_stable_arg <= 0.0) || (ai.window_arg <= 0.0) || (ai.poll_interval_arg <= 0.0)) { 
+            fprintf(stderr,"FATAL: Tolerance, window and poll interval must be positive\n"); 
+            exitCode = 1; 
+        } else { 
+            struct bvt_stable *stable = stable_create(ai.wait_stable_arg, ai.window_arg, ai.poll_interval_arg); 
+            if (stable == NULL) { 
+                fprintf(stderr,"FATAL: Out of memory\n"); 
+                exitCode = 1; 
+            } else if (stable_wait(stable, ai.poll_interval_arg, ai.wait_timeout_arg, port)) { 
+                printf("***STBL: %lf %lf %lf\n", stable->mean, stable->deviation, stable->slope * 60.0); 
+            } else { 
+                fprintf(stderr,"***STBL: TIMEOUT\n"); 
+                exitCode = 2; 
+            }
+            stable_destroy(stable); 
+        }
+    }
+
+    /* --- Autotune, once settled --- */
+    if(ai.autotune_given && exitCode == 0) { 
+        if(verboseFlag){printf("Autotuning the PID loop!\n"); }
+        exitCode = run_autotune(&ai, port); 
+    }
+
+    /* --- Reads --- */
+    //Read temperature 
+    if(ai.read_temperature_given) { 
+        if(verboseFlag){printf("Reading temperature!\n");}; 
+        double temp =  eurotherm902s_get_temperature(port); 
+        printf("***TEMP: %f\n", temp); 
+    }
+
+    //Check for temperature sensor breaks
+    if(ai.check_sensor_break_given || ai.status_all_given ){
+        if(verboseFlag){printf("Checking sensor!\n"); } 
+        bool result = eurotherm902s_check_sensor_break(port); 
+        if (result == SET) { 
+            fprintf(stderr,"Warning: PT100/Thermocouple sensor break on device.\n"); 
+            fprintf(stderr,"***SBC : FAIL\n"); 
+        } else{
+            printf("***SBC : OK\n"); 
+        }
+
+    }
+
+    //Get heater state 
+    if(ai.get_heater_state_given|| ai.status_all_given) {
+        checkHeater(port); 
+    } 
+
+    // Get heater power limit 
+    if(ai.get_heater_power_limit_given) { 
+        if(verboseFlag){printf("Getting heater power limit!\n"); }
+        double result = eurotherm902s_get_heater_power_limit(port); 
+        printf("***HPWL: %lf\n", result); 
+    }
+
+    //Get heater power 
+    if ( ai.get_heater_power_given) { 
+        if(verboseFlag) { printf("Getting heater power as a percentage!\n"); } 
+        double result = eurotherm902s_get_heater_power(port); 
+        printf("***HPWR: %lf\n",result); 
+    }
+
     //Ask the device about its current mode 
     if(ai.get_mode_given|| ai.status_all_given) { 
         if(verboseFlag) { printf("Getting current PID mode!\n"); } 
@@ -194,44 +406,15 @@ int main(int argc, char **argv){
         printf("***GASR: %lf\n", result); 
     } 
 
-    //Set gas flow rate 
-    if(ai.set_gas_flow_rate_given){
-        if(verboseFlag) { printf("Requested change to gas flow rate to %f l/hr!\n", 
-                ai.set_gas_flow_rate_arg); }
-
-        if (verboseFlag) {printf("Checking heater status...\n");}
-        bool result = bvt3000_get_heater_state(port); 
-
-        if (result == SET) {
-            if (verboseFlag) {printf("Setting flow rate...\n");}
-            set_flow_rate((double) ai.set_gas_flow_rate_arg, port); 
-            if (verboseFlag) {printf("Checking flow rate...\n");}
-            unsigned int gfr = bvt3000_get_flow_rate(port); 
-            if (verboseFlag) {printf("Actual flow rate %u...\n", gfr);}
-        } else if (result == UNSET) {
-            fprintf(stderr,"FATAL: Cannot change gas flow rate with heater off\n"); 
-        }
-
-    }
-
     //Get temperature setpoint 
 
     if(ai.get_temperature_setpoint_given) { 
         if(verboseFlag) { printf("Getting temperature setpoint!\n"); } 
 
-        double tpsp =  eurotherm902s_get_setpoint( SP1, port );
+        double tpsp =  eurotherm902s_get_current_setpoint( port );
         printf("***TSP : %lf\n", tpsp); 
     }
 
-
-    //Set temperature setpoint 
-    
-    if(ai.set_temperature_setpoint_given) { 
-        if(verboseFlag)  {printf("Setting temperature setpoint SP1 to %f!\n", ai.set_temperature_setpoint_arg); } 
-        double temp = (double) ai.set_temperature_setpoint_arg; 
-        eurotherm902s_set_setpoint(SP1, temp, port); 
-    }
-
     //Get Eurotherm temperature box status 
     if(ai.get_eurotherm_status_given|| ai.status_all_given) { 
         if(verboseFlag) { printf("Getting Eurotherm status!\n"); } 
@@ -244,20 +427,6 @@ int main(int argc, char **argv){
         }
     }
 
-
-    //Lock or unlock keypad 
-    if(ai.lock_keypad_given) {
-        if(verboseFlag) { printf("Keyboard lock/unlock state change requested!\n"); }
-        if (ai.lock_keypad_arg == 1) {
-            if(verboseFlag){printf("Unlocking requested....\n"); }
-            eurotherm902s_lock_keyboard((bool) ai.lock_keypad_arg, port); 
-        } else {
-            if(verboseFlag){printf("Locking requested....\n"); }
-            eurotherm902s_lock_keyboard((bool) ai.lock_keypad_arg, port); 
-        }
-    }
-
-
     //Get PID -- P
     if(ai.get_proportional_band_given) { 
             if (verboseFlag) {printf("Getting proportional band...\n");}
@@ -265,7 +434,6 @@ int main(int argc, char **argv){
             printf("***PPID: %lf\n", result); 
     }
 
-
     //Get PID -- I 
     if(ai.get_integral_time_given) { 
             if (verboseFlag) {printf("Getting integral time...\n");}
@@ -280,29 +448,6 @@ int main(int argc, char **argv){
             printf("***DPID: %lf\n", result); 
     }
 
-
-    //Set PID -- P
-    if(ai.set_proportional_band_given) { 
-            float setValue = ai.set_proportional_band_arg; 
-            if (verboseFlag) {printf("Setting proportional band to %f...\n", setValue);}
-            eurotherm902s_set_proportional_band(setValue, port); 
-    }
-
-
-    //Set PID -- I 
-    if(ai.set_integral_time_given) { 
-            float setValue = ai.set_integral_time_arg; 
-            if (verboseFlag) {printf("Setting integral time to %f...\n", setValue);}
-            eurotherm902s_set_integral_time(setValue, port); 
-    }
-
-    //Get PID -- D 
-    if(ai.set_differential_time_given) { 
-            float setValue = ai.set_differential_time_arg; 
-            if (verboseFlag) {printf("Setting derivative time to %f...\n", setValue);}
-            eurotherm902s_set_derivative_time(setValue, port); 
-    }
-
     //LN2 methods  -- get Ln2 heater state 
     if(ai.get_ln2_heater_state_given) { 
         if(verboseFlag) {printf("Getting LN2 heater state!\n");}
@@ -314,29 +459,12 @@ int main(int argc, char **argv){
         }
     }
 
-    //Set heater state 
-    if(ai.set_ln2_heater_state_given) { 
-        if(verboseFlag) {printf("Changing state of ln2 LN2 heater to %u!\n", (bool)ai.set_ln2_heater_state_arg); } 
-        bvt3000_set_ln2_heater_state((bool)ai.set_ln2_heater_state_arg, port); 
-    }
-
     //Get LN2 heater power
     if(ai.get_ln2_heater_power_given) { 
         if(verboseFlag) {printf("Getting LN2 heater power!\n");}
         double result = bvt3000_get_ln2_heater_power(port); 
         printf("***N2HP: %lf\n", result); 
     }
-    
-    //Set LN2  heater power 
-    if(ai.set_ln2_heater_power_given) { 
-        float gvnPwr = ai.set_ln2_heater_power_arg; 
-        if( (gvnPwr < 0 ) || (gvnPwr > 100)) { 
-            fprintf(stderr,"FATAL: Supplied heater power %f out of range [0, 100]\n", gvnPwr); 
-        } else { 
-            if(verboseFlag) { printf("Setting LN2 heater power to %f!\n", gvnPwr); } 
-            bvt3000_set_ln2_heater_power(gvnPwr, port); 
-        }
-    }
 
     //Check LN2 tank
     if(ai.check_ln2_heater_given) { 
@@ -357,13 +485,7 @@ int main(int argc, char **argv){
         double result = eurotherm902s_get_cutback_high(port); 
         printf("***HCUT: %lf\n", result); 
     }
-    
-    //Set high cutback value 
-    if(ai.set_high_cutback_given){
-        if(verboseFlag) {printf("Setting high cutback to %lf!\n", ai.set_high_cutback_arg); }
-        eurotherm902s_set_cutback_high((double) ai.set_high_cutback_arg, port); 
-    }
-    
+
     //Get low cutback value 
     if(ai.get_low_cutback_given){
         if(verboseFlag) {printf("Getting low cutback!\n"); }
@@ -371,12 +493,6 @@ int main(int argc, char **argv){
         printf("***LCUT: %lf\n", result); 
     }
 
-    //Set low cutback value 
-    if(ai.set_low_cutback_given){
-        if(verboseFlag) {printf("Setting low cutback to %lf!\n", ai.set_low_cutback_arg); }
-        eurotherm902s_set_cutback_low((double) ai.set_low_cutback_arg, port); 
-    }
-
     //Get adaptive tune value in K
     if(ai.get_adaptive_tune_level_given){
         if(verboseFlag) { printf("Getting adaptive tune!\n"); } 
@@ -384,12 +500,6 @@ int main(int argc, char **argv){
         printf("***ADTR: %lf\n", result); 
     }
 
-    //Set adaptive tune value in K
-    if(ai.set_adaptive_tune_level_given){
-        if(verboseFlag) {printf("Setting adaptive tune to %lf!\n", ai.set_adaptive_tune_level_arg); }
-        eurotherm902s_set_adaptive_tune_trigger((double) ai.set_adaptive_tune_level_arg, port); 
-    }
-
 
     /*------------------------------------------------------------------------*/
     /* --- Close device --- */	
@@ -400,6 +510,6 @@ int main(int argc, char **argv){
     } else if (anyErrors != SP_OK) { 
         fprintf(stderr,"Error closing port %s, return code %d\n", ai.device_arg, anyErrors); 
     }
-    return 0; 
+    return exitCode; 
 }
 
@@ -0,0 +1,960 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+
+#include "bvt_archive.h"
+extern bool verboseFlag;
+
+struct bvt_archive {
+    int fd;
+    uint32_t capacity;              /* samples per chunk */
+    double sync_interval;
+    double last_sync;
+
+    struct archive_index *index;    /* chunks completed */
+    uint32_t chunks, index_size;
+
+    uint64_t end;                   /* where the next chunk goes */
+    bool open;                      /* a chunk is being filled at 'end' */
+    struct archive_chunk chunk;
+    unsigned char *data;
+    unsigned char *packed;          /* compressed chunk being sealed */
+    size_t packed_size;
+
+    int events_fd;                  /* the event index */
+    bool events_dirty;              /* written since the last sync */
+    bool have_last;
+    struct bvt_state last;          /* previous sample, for transitions */
+
+    /* Samples on their way from the daemon to the writer thread */
+
+    struct bvt_state *queue;
+    uint64_t head;                  /* written by the daemon only */
+    uint64_t tail;                  /* written by the writer only */
+    uint64_t dropped;
+    sem_t ready;                    /* one post per sample, and one to quit */
+    bool quit;
+    pthread_t writer;
+};
+
+static double monotonic_now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Offset of a column within a chunk's data */
+
+static size_t column_offset( uint32_t capacity, int col )
+{
+    if (col < ARCHIVE_DOUBLE_COLUMNS) {
+        return (size_t) capacity * 8 * col;
+    }
+    return (size_t) capacity * ( 8 * ARCHIVE_DOUBLE_COLUMNS + 2 * ( col - ARCHIVE_DOUBLE_COLUMNS ) );
+}
+
+/*------------------------------------------------------------------*
+ * Bit streams of the compressed chunks, see bvt_archive.h
+ *------------------------------------------------------------------*/
+
+struct bits {
+    unsigned char *p;
+    size_t len;                     /* bytes available */
+    size_t pos;                     /* bits used */
+};
+
+static void put_bits( struct bits * b, uint64_t v, int n )
+{
+    while (n > 0) {
+        int room = 8 - ( b->pos & 7 );
+        int take = n < room ? n : room;
+        unsigned int part = ( v >> ( n - take ) ) & ( ( 1u << take ) - 1 );
+
+        b->p[ b->pos >> 3 ] |= part << ( room - take );
+        b->pos += take;
+        n -= take;
+    }
+}
+
+static uint64_t get_bits( struct bits * b, int n, bool * bad )
+{
+    uint64_t v = 0;
+
+    if (b->pos + n > 8 * b->len) {
+        *bad = true;
+        return 0;
+    }
+    while (n > 0) {
+        int left = 8 - ( b->pos & 7 );
+        int take = n < left ? n : left;
+
+        v = ( v << take ) | ( ( b->p[ b->pos >> 3 ] >> ( left - take ) ) & ( ( 1u << take ) - 1 ) );
+        b->pos += take;
+        n -= take;
+    }
+    return v;
+}
+
+static const int diff_width[ 4 ] = { 7, 12, 20, 64 };
+
+static void put_diff( struct bits * b, uint64_t d )
+{
+    uint64_t z = ( d << 1 ) ^ (uint64_t) ( (int64_t) d >> 63 );
+    int k;
+
+    if (z == 0) {
+        put_bits( b, 0, 1 );
+        return;
+    }
+    for (k = 0; k < 3 && z >> diff_width[ k ]; k++) {
+    }
+    put_bits( b, k < 3 ? ( 4u << k ) - 2 : 0xf, k < 3 ? k + 2 : 4 );
+    put_bits( b, z, diff_width[ k ] );
+}
+
+static uint64_t get_diff( struct bits * b, bool * bad )
+{
+    uint64_t z;
+    int k = 0;
+
+    while (k < 4 && get_bits( b, 1, bad )) {
+        k++;
+    }
+    if (k == 0) {
+        return 0;
+    }
+    z = get_bits( b, diff_width[ k - 1 ], bad );
+    return ( z >> 1 ) ^ -( z & 1 );
+}
+
+/* Smallest number of decimals all values are an exact multiple of, or -1 */
+
+static int column_decimals( const double * v, uint32_t n )
+{
+    for (int k = 0; k < STREAM_XOR - STREAM_DECIMAL; k++) {
+        double scale = pow( 10.0, k );
+        uint32_t i;
+
+        for (i = 0; i < n; i++) {
+            double q = v[ i ] * scale;
+
+            if (! ( fabs( q ) < 1e15 ) || llround( q ) / scale != v[ i ]) {
+                break;
+            }
+        }
+        if (i == n) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+static void pack_column( struct bits * b, uint32_t method, const void * column, uint32_t n )
+{
+    const double *v = column;
+    const uint16_t *w = column;
+    uint64_t prev = 0, delta = 0;
+    int lead = -1, trail = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t x;
+
+        if (method == STREAM_WORDS) {
+            if (i && w[ i ] == w[ i - 1 ]) {
+                put_bits( b, 0, 1 );
+            } else {
+                put_bits( b, i ? 1 : 0, i ? 1 : 0 );
+                put_bits( b, w[ i ], 16 );
+            }
+            continue;
+        }
+        if (method == STREAM_XOR) {
+            memcpy( &x, &v[ i ], 8 );
+        } else if (method == STREAM_TIME) {
+            x = llround( v[ i ] * 1e6 );
+        } else {
+            x = llround( v[ i ] * pow( 10.0, method - STREAM_DECIMAL ) );
+        }
+
+        if (i == 0) {
+            put_bits( b, x, 64 );
+        } else if (method == STREAM_TIME) {
+            put_diff( b, x - prev - delta );
+            delta = x - prev;
+        } else if (method != STREAM_XOR) {
+            put_diff( b, x - prev );
+        } else if (( x ^ prev ) == 0) {
+            put_bits( b, 0, 1 );
+        } else {
+            uint64_t d = x ^ prev;
+            int lz = __builtin_clzll( d ), tz = __builtin_ctzll( d );
+
+            if (lz > 31) {
+                lz = 31;
+            }
+            if (lead >= 0 && lz >= lead && tz >= trail) {
+                put_bits( b, 2, 2 );
+                put_bits( b, d >> trail, 64 - lead - trail );
+            } else {
+                put_bits( b, 3, 2 );
+                put_bits( b, lz, 5 );
+                put_bits( b, 64 - lz - tz - 1, 6 );
+                put_bits( b, d >> tz, 64 - lz - tz );
+                lead = lz;
+                trail = tz;
+            }
+        }
+        prev = x;
+    }
+}
+
+static bool unpack_column( struct bits * b, uint32_t method, void * column, uint32_t n )
+{
+    double *v = column;
+    uint16_t *w = column;
+    uint64_t x = 0, delta = 0;
+    int lead = 0, trail = 0;
+    bool bad = false;
+
+    for (uint32_t i = 0; i < n && ! bad; i++) {
+        if (method == STREAM_WORDS) {
+            w[ i ] = ( i == 0 || get_bits( b, 1, &bad ) ) ? get_bits( b, 16, &bad ) : w[ i - 1 ];
+            continue;
+        }
+        if (i == 0) {
+            x = get_bits( b, 64, &bad );
+        } else if (method == STREAM_TIME) {
+            delta += get_diff( b, &bad );
+            x += delta;
+        } else if (method != STREAM_XOR) {
+            x += get_diff( b, &bad );
+        } else if (get_bits( b, 1, &bad )) {
+            if (get_bits( b, 1, &bad )) {
+                lead = get_bits( b, 5, &bad );
+                trail = 64 - lead - (int) get_bits( b, 6, &bad ) - 1;
+                if (trail < 0) {
+                    return false;
+                }
+            }
+            x ^= get_bits( b, 64 - lead - trail, &bad ) << trail;
+        }
+
+        if (method == STREAM_XOR) {
+            memcpy( &v[ i ], &x, 8 );
+        } else if (method == STREAM_TIME) {
+            v[ i ] = (int64_t) x / 1e6;
+        } else {
+            v[ i ] = (int64_t) x / pow( 10.0, method - STREAM_DECIMAL );
+        }
+    }
+    return ! bad;
+}
+
+/*------------------------------------------------------------------*
+ * Compresses the chunk being filled into a->packed. Returns the size,
+ * or 0 if it would not come out smaller than the plain chunk.
+ *------------------------------------------------------------------*/
+
+static size_t archive_pack( struct bvt_archive * a )
+{
+    size_t pos = 0;
+
+    memset( a->packed, 0, a->packed_size );
+    for (int col = 0; col < ARCHIVE_COLUMNS; col++) {
+        const unsigned char *column = a->data + column_offset( a->capacity, col );
+        struct archive_stream s;
+        struct bits b = { a->packed + pos + sizeof s, a->packed_size - pos - sizeof s, 0 };
+        int k;
+
+        if (col == COL_TIME) {
+            s.method = STREAM_TIME;
+        } else if (col >= ARCHIVE_DOUBLE_COLUMNS) {
+            s.method = STREAM_WORDS;
+        } else {
+            k = column_decimals( (const double *) column, a->chunk.count );
+            s.method = k < 0 ? STREAM_XOR : STREAM_DECIMAL + k;
+        }
+        pack_column( &b, s.method, column, a->chunk.count );
+        s.bytes = ( b.pos + 7 ) / 8;
+        memcpy( a->packed + pos, &s, sizeof s );
+        pos += sizeof s + s.bytes;
+    }
+    return pos < a->chunk.bytes ? pos : 0;
+}
+
+/*------------------------------------------------------------------*
+ * Reads column 'col' of a chunk into 'out' (count doubles, or uint16
+ * for the status words), whatever its encoding
+ *------------------------------------------------------------------*/
+
+bool archive_column( const struct archive_chunk * c, const unsigned char * data,
+                     uint32_t chunk_samples, int col, void * out )
+{
+    size_t width = col < ARCHIVE_DOUBLE_COLUMNS ? 8 : 2;
+    size_t pos = 0;
+    struct archive_stream s;
+
+    if (col < 0 || col >= ARCHIVE_COLUMNS || c->count > chunk_samples) {
+        return false;
+    }
+    if (c->encoding == ARCHIVE_PLAIN) {
+        if (c->bytes < (size_t) chunk_samples * ARCHIVE_ROW_BYTES) {
+            return false;
+        }
+        memcpy( out, data + column_offset( chunk_samples, col ), c->count * width );
+        return true;
+    }
+    if (c->encoding != ARCHIVE_COMPRESSED) {
+        return false;
+    }
+    for (int i = 0; ; i++) {
+        if (pos + sizeof s > c->bytes) {
+            return false;
+        }
+        memcpy( &s, data + pos, sizeof s );
+        if (s.bytes > c->bytes - pos - sizeof s) {
+            return false;
+        }
+        if (i == col) {
+            struct bits b = { (unsigned char *) data + pos + sizeof s, s.bytes, 0 };
+
+            if (( col < ARCHIVE_DOUBLE_COLUMNS ) == ( s.method == STREAM_WORDS ) || s.method > STREAM_WORDS) {
+                return false;
+            }
+            return unpack_column( &b, s.method, out, c->count );
+        }
+        pos += sizeof s + s.bytes;
+    }
+}
+
+static const char * const column_names[ ARCHIVE_COLUMNS ] = {
+    "time", "temperature", "setpoint", "heater-power", "ln2-heater-power", "flow-rate",
+    "is", "sw", "xs"
+};
+
+int archive_column_by_name( const char * name )
+{
+    for (int col = 0; col < ARCHIVE_COLUMNS; col++) {
+        if (! strcmp( name, column_names[ col ] )) {
+            return col;
+        }
+    }
+    return -1;
+}
+
+static bool index_append( struct bvt_archive * a, uint64_t offset, const struct archive_chunk * c )
+{
+    if (a->chunks == a->index_size) {
+        uint32_t size = a->index_size ? 2 * a->index_size : 64;
+        struct archive_index *index = realloc( a->index, size * sizeof *index );
+
+        if (index == NULL) {
+            return false;
+        }
+        a->index = index;
+        a->index_size = size;
+    }
+    a->index[ a->chunks ].t_first = c->t_first;
+    a->index[ a->chunks ].t_last = c->t_last;
+    a->index[ a->chunks ].offset = offset;
+    a->index[ a->chunks ].count = c->count;
+    a->index[ a->chunks ].reserved = 0;
+    a->chunks++;
+    return true;
+}
+
+/*------------------------------------------------------------------*
+ * Picks up an existing archive so that a restarted daemon continues
+ * it: the index and footer of a cleanly closed file are read back and
+ * cut off, otherwise the chunks are walked and whatever follows the
+ * last complete one is cut off. New samples go into a fresh chunk.
+ *------------------------------------------------------------------*/
+
+static bool archive_resume( struct bvt_archive * a, uint64_t size )
+{
+    struct archive_header head;
+    struct archive_footer foot;
+    struct archive_chunk c;
+    uint64_t pos;
+
+    if (   pread( a->fd, &head, sizeof head, 0 ) != sizeof head
+        || memcmp( head.magic, ARCHIVE_MAGIC, 4 )
+        || head.version != ARCHIVE_VERSION
+        || head.columns != ARCHIVE_COLUMNS ) {
+        fprintf(stderr,"FATAL: not an archive this program can append to\n");
+        return false;
+    }
+    a->capacity = head.chunk_samples;
+
+    if (   size >= sizeof head + sizeof foot
+        && pread( a->fd, &foot, sizeof foot, size - sizeof foot ) == sizeof foot
+        && ! memcmp( foot.magic, ARCHIVE_INDEX_MAGIC, 4 )
+        && foot.index_offset + (uint64_t) foot.chunks * sizeof *a->index + sizeof foot == size ) {
+        a->index = malloc( ( foot.chunks + 64 ) * sizeof *a->index );
+        if (a->index == NULL) {
+            return false;
+        }
+        a->index_size = foot.chunks + 64;
+        a->chunks = foot.chunks;
+        if (pread( a->fd, a->index, foot.chunks * sizeof *a->index, foot.index_offset )
+            != (ssize_t) ( foot.chunks * sizeof *a->index )) {
+            return false;
+        }
+        pos = foot.index_offset;
+    } else {
+        for (pos = sizeof head; pos + sizeof c <= size; pos += sizeof c + c.bytes) {
+            if (   pread( a->fd, &c, sizeof c, pos ) != sizeof c
+                || memcmp( c.magic, ARCHIVE_CHUNK_MAGIC, 4 )
+                || pos + sizeof c + c.bytes > size ) {
+                break;
+            }
+            if (c.count && ! index_append( a, pos, &c )) {
+                return false;
+            }
+        }
+        if (verboseFlag) {
+            printf("Archive was not closed cleanly, recovered %u chunks\n", a->chunks);
+        }
+    }
+    if (ftruncate( a->fd, pos ) < 0) {
+        perror( "ftruncate" );
+        return false;
+    }
+    a->end = pos;
+    return true;
+}
+
+static void archive_write( struct bvt_archive * a, const struct bvt_state * st );
+
+/*------------------------------------------------------------------*
+ * The writer thread: everything that touches the disk (writes, syncs,
+ * compressing full chunks) happens here, so that a slow SD card can
+ * never hold up the daemon's serial transactions.
+ *------------------------------------------------------------------*/
+
+static void * archive_writer( void * arg )
+{
+    struct bvt_archive *a = arg;
+
+    for ( ; ; ) {
+        uint64_t tail = a->tail;
+
+        while (sem_wait( &a->ready ) < 0 && errno == EINTR) {
+        }
+        if (tail == __atomic_load_n( &a->head, __ATOMIC_ACQUIRE )) {
+            if (__atomic_load_n( &a->quit, __ATOMIC_ACQUIRE )) {
+                break;
+            }
+            continue;
+        }
+        archive_write( a, &a->queue[ tail % ARCHIVE_QUEUE ] );
+        __atomic_store_n( &a->tail, tail + 1, __ATOMIC_RELEASE );
+    }
+    return NULL;
+}
+
+/* Signals are for the daemon's own thread, so the writer blocks them */
+
+static bool archive_start( struct bvt_archive * a )
+{
+    sigset_t all, old;
+    int err;
+
+    if (sem_init( &a->ready, 0, 0 ) < 0) {
+        perror( "sem_init" );
+        return false;
+    }
+    sigfillset( &all );
+    pthread_sigmask( SIG_SETMASK, &all, &old );
+    err = pthread_create( &a->writer, NULL, archive_writer, a );
+    pthread_sigmask( SIG_SETMASK, &old, NULL );
+    if (err) {
+        fprintf(stderr,"FATAL: cannot start the archive writer: %s\n", strerror( err ));
+        sem_destroy( &a->ready );
+        return false;
+    }
+    return true;
+}
+
+/*------------------------------------------------------------------*
+ * Opens the event index next to the archive, cutting off a record
+ * torn by a crash
+ *------------------------------------------------------------------*/
+
+static bool events_open( struct bvt_archive * a, const char * path )
+{
+    struct archive_events_header head = { ARCHIVE_EVENTS_MAGIC, ARCHIVE_VERSION };
+    char name[ 4096 ];
+    struct stat sb;
+
+    snprintf( name, sizeof name, "%s%s", path, ARCHIVE_EVENTS_SUFFIX );
+    a->events_fd = open( name, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+    if (a->events_fd < 0 || fstat( a->events_fd, &sb ) < 0) {
+        fprintf(stderr,"FATAL: cannot open event index %s: %s\n", name, strerror( errno ));
+        return false;
+    }
+    if ((size_t) sb.st_size < sizeof head) {
+        if (ftruncate( a->events_fd, 0 ) < 0 || write( a->events_fd, &head, sizeof head ) != sizeof head) {
+            perror( name );
+            return false;
+        }
+        return true;
+    }
+    if (   pread( a->events_fd, &head, sizeof head, 0 ) != sizeof head
+        || memcmp( head.magic, ARCHIVE_EVENTS_MAGIC, 4 )
+        || head.version != ARCHIVE_VERSION ) {
+        fprintf(stderr,"FATAL: %s is not an event index\n", name);
+        return false;
+    }
+    if (ftruncate( a->events_fd, sb.st_size - ( sb.st_size - sizeof head ) % sizeof( struct archive_event ) ) < 0) {
+        perror( name );
+        return false;
+    }
+    return true;
+}
+
+/* Records the status bits that changed since the previous sample */
+
+static void events_note( struct bvt_archive * a, const struct bvt_state * st )
+{
+    for (int e = 0; a->have_last && e < BVT_STATUS_EVENTS; e++) {
+        struct archive_event ev = { st->wall_time, e, bvt_status_event_state( e, st ), 0 };
+
+        if (ev.state == bvt_status_event_state( e, &a->last )) {
+            continue;
+        }
+        if (write( a->events_fd, &ev, sizeof ev ) != sizeof ev) {
+            fprintf(stderr,"WARNING: event index write failed: %s\n", strerror( errno ));
+        }
+        a->events_dirty = true;
+    }
+    a->last = *st;
+    a->have_last = true;
+}
+
+struct bvt_archive * archive_open( const char * path, double sync_interval )
+{
+    struct bvt_archive *a = calloc( 1, sizeof *a );
+    struct stat sb;
+
+    if (a == NULL) {
+        return NULL;
+    }
+    a->events_fd = -1;
+    a->sync_interval = sync_interval;
+    a->last_sync = monotonic_now( );
+    a->fd = open( path, O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+    if (a->fd < 0 || fstat( a->fd, &sb ) < 0) {
+        fprintf(stderr,"FATAL: cannot open archive %s: %s\n", path, strerror( errno ));
+        goto fail;
+    }
+
+    if (sb.st_size == 0) {
+        struct archive_header head = { ARCHIVE_MAGIC, ARCHIVE_VERSION, ARCHIVE_CHUNK_SAMPLES,
+                                       ARCHIVE_COLUMNS, 0.0 };
+        struct timespec now;
+
+        clock_gettime( CLOCK_REALTIME, &now );
+        head.created = now.tv_sec + now.tv_nsec * 1e-9;
+        if (pwrite( a->fd, &head, sizeof head, 0 ) != sizeof head) {
+            perror( "pwrite" );
+            goto fail;
+        }
+        a->capacity = head.chunk_samples;
+        a->end = sizeof head;
+    } else if (! archive_resume( a, sb.st_size )) {
+        goto fail;
+    }
+    if (! events_open( a, path )) {
+        goto fail;
+    }
+
+    /* Worst case of the bit streams is 77 bits per double, 17 per word */
+
+    a->packed_size = ARCHIVE_COLUMNS * ( sizeof( struct archive_stream ) + 8 )
+                     + (size_t) a->capacity * ( 10 * ARCHIVE_DOUBLE_COLUMNS
+                                                + 3 * ( ARCHIVE_COLUMNS - ARCHIVE_DOUBLE_COLUMNS ) );
+    a->data = calloc( a->capacity, ARCHIVE_ROW_BYTES );
+    a->packed = malloc( a->packed_size );
+    a->queue = malloc( ARCHIVE_QUEUE * sizeof *a->queue );
+    if (a->data == NULL || a->packed == NULL || a->queue == NULL) {
+        free( a->data );
+        free( a->packed );
+        free( a->queue );
+        goto fail;
+    }
+    if (! archive_start( a )) {
+        free( a->data );
+        free( a->packed );
+        free( a->queue );
+        goto fail;
+    }
+    return a;
+
+fail:
+    if (a->fd >= 0) {
+        close( a->fd );
+    }
+    if (a->events_fd >= 0) {
+        close( a->events_fd );
+    }
+    free( a->index );
+    free( a );
+    return NULL;
+}
+
+/*------------------------------------------------------------------*
+ * Writes out the chunk being filled. Its data go out first and are
+ * synced, then its header; the header reaches the disk with the next
+ * sync, so one sync per batch is enough and a crash never leaves a
+ * header counting samples that are not on disk.
+ *------------------------------------------------------------------*/
+
+static void archive_sync( struct bvt_archive * a )
+{
+    size_t bytes = (size_t) a->capacity * ARCHIVE_ROW_BYTES;
+
+    if (   pwrite( a->fd, a->data, bytes, a->end + sizeof a->chunk ) != (ssize_t) bytes
+        || fdatasync( a->fd ) < 0
+        || pwrite( a->fd, &a->chunk, sizeof a->chunk, a->end ) != sizeof a->chunk ) {
+        fprintf(stderr,"WARNING: archive write failed: %s\n", strerror( errno ));
+    }
+    a->last_sync = monotonic_now( );
+}
+
+/*------------------------------------------------------------------*
+ * Completes the chunk being filled, compressed if that helps. The chunk
+ * is marked empty while its data are being replaced, so a crash in the
+ * middle of this loses the chunk rather than leaving it garbled.
+ *------------------------------------------------------------------*/
+
+static void archive_seal( struct bvt_archive * a )
+{
+    size_t bytes = archive_pack( a );
+
+    if (bytes) {
+        struct archive_chunk empty = a->chunk;
+
+        empty.count = 0;
+        a->chunk.encoding = ARCHIVE_COMPRESSED;
+        a->chunk.bytes = bytes;
+        if (   pwrite( a->fd, &empty, sizeof empty, a->end ) != sizeof empty
+            || fdatasync( a->fd ) < 0
+            || pwrite( a->fd, a->packed, bytes, a->end + sizeof a->chunk ) != (ssize_t) bytes
+            || fdatasync( a->fd ) < 0
+            || pwrite( a->fd, &a->chunk, sizeof a->chunk, a->end ) != sizeof a->chunk
+            || fdatasync( a->fd ) < 0 ) {
+            fprintf(stderr,"WARNING: archive write failed: %s\n", strerror( errno ));
+        }
+        a->last_sync = monotonic_now( );
+    } else {
+        archive_sync( a );
+    }
+    if (! index_append( a, a->end, &a->chunk )) {
+        fprintf(stderr,"WARNING: out of memory for the archive index\n");
+    }
+    a->end += sizeof a->chunk + a->chunk.bytes;
+    a->open = false;
+}
+
+static void archive_write( struct bvt_archive * a, const struct bvt_state * st )
+{
+    double values[ ARCHIVE_DOUBLE_COLUMNS ] = {
+        st->wall_time, st->temperature, st->working_setpoint,
+        st->heater_power, st->ln2_heater_power, st->flow_rate
+    };
+    uint16_t words[ ARCHIVE_COLUMNS - ARCHIVE_DOUBLE_COLUMNS ] = { st->is, st->sw, st->xs };
+    uint32_t n;
+
+    if (! a->open) {
+        memset( &a->chunk, 0, sizeof a->chunk );
+        memcpy( a->chunk.magic, ARCHIVE_CHUNK_MAGIC, 4 );
+        a->chunk.encoding = ARCHIVE_PLAIN;
+        a->chunk.bytes = a->capacity * ARCHIVE_ROW_BYTES;
+        a->chunk.t_first = st->wall_time;
+        a->open = true;
+    }
+
+    n = a->chunk.count;
+    for (int col = 0; col < ARCHIVE_COLUMNS; col++) {
+        unsigned char *p = a->data + column_offset( a->capacity, col );
+
+        if (col < ARCHIVE_DOUBLE_COLUMNS) {
+            memcpy( p + 8 * n, &values[ col ], 8 );
+        } else {
+            memcpy( p + 2 * n, &words[ col - ARCHIVE_DOUBLE_COLUMNS ], 2 );
+        }
+    }
+    a->chunk.count++;
+    a->chunk.t_last = st->wall_time;
+    events_note( a, st );
+
+    if (a->chunk.count == a->capacity) {
+        archive_seal( a );
+    } else if (monotonic_now( ) - a->last_sync >= a->sync_interval) {
+        archive_sync( a );
+    } else {
+        return;
+    }
+    if (a->events_dirty) {
+        fdatasync( a->events_fd );
+        a->events_dirty = false;
+    }
+}
+
+/*------------------------------------------------------------------*
+ * Hands a sample to the writer thread. This never blocks: should the
+ * writer have fallen ARCHIVE_QUEUE samples behind, the sample is not
+ * archived (and counted) rather than delaying the next acquisition.
+ *------------------------------------------------------------------*/
+
+void archive_add( struct bvt_archive * a, const struct bvt_state * st )
+{
+    uint64_t head = a->head;
+
+    if (head - __atomic_load_n( &a->tail, __ATOMIC_ACQUIRE ) == ARCHIVE_QUEUE) {
+        if (a->dropped++ == 0) {
+            fprintf(stderr,"WARNING: archive writer is falling behind, dropping samples\n");
+        }
+        return;
+    }
+    a->queue[ head % ARCHIVE_QUEUE ] = *st;
+    __atomic_store_n( &a->head, head + 1, __ATOMIC_RELEASE );
+    sem_post( &a->ready );
+}
+
+/*------------------------------------------------------------------*
+ * Lets the writer finish what is queued, then completes the archive
+ * with its index and footer
+ *------------------------------------------------------------------*/
+
+void archive_close( struct bvt_archive * a )
+{
+    struct archive_footer foot;
+    size_t bytes;
+
+    if (a == NULL) {
+        return;
+    }
+    __atomic_store_n( &a->quit, true, __ATOMIC_RELEASE );
+    sem_post( &a->ready );
+    pthread_join( a->writer, NULL );
+    sem_destroy( &a->ready );
+    if (a->dropped) {
+        fprintf(stderr,"WARNING: %llu samples could not be archived in time\n",
+                (unsigned long long) a->dropped);
+    }
+
+    if (a->open && a->chunk.count) {
+        archive_seal( a );
+    }
+
+    bytes = a->chunks * sizeof *a->index;
+    memset( &foot, 0, sizeof foot );
+    foot.index_offset = a->end;
+    foot.chunks = a->chunks;
+    memcpy( foot.magic, ARCHIVE_INDEX_MAGIC, 4 );
+    if (   pwrite( a->fd, a->index, bytes, a->end ) != (ssize_t) bytes
+        || pwrite( a->fd, &foot, sizeof foot, a->end + bytes ) != sizeof foot
+        || ftruncate( a->fd, a->end + bytes + sizeof foot ) < 0
+        || fsync( a->fd ) < 0 ) {
+        fprintf(stderr,"WARNING: could not write the archive index: %s\n", strerror( errno ));
+    }
+    if (verboseFlag) {
+        printf("Archive closed with %u chunks\n", a->chunks);
+    }
+    close( a->fd );
+    fsync( a->events_fd );
+    close( a->events_fd );
+    free( a->index );
+    free( a->data );
+    free( a->packed );
+    free( a->queue );
+    free( a );
+}
+
+/* Maps the event index of an archive, if it has one */
+
+static void events_map( struct archive_map * m, const char * path )
+{
+    struct archive_events_header head;
+    char name[ 4096 ];
+    struct stat sb;
+    void *base;
+    int fd;
+
+    snprintf( name, sizeof name, "%s%s", path, ARCHIVE_EVENTS_SUFFIX );
+    fd = open( name, O_RDONLY | O_CLOEXEC );
+    if (fd < 0) {
+        return;
+    }
+    if (fstat( fd, &sb ) < 0 || (size_t) sb.st_size <= sizeof head) {
+        close( fd );
+        return;
+    }
+    base = mmap( NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (base == MAP_FAILED) {
+        return;
+    }
+    memcpy( &head, base, sizeof head );
+    if (memcmp( head.magic, ARCHIVE_EVENTS_MAGIC, 4 ) || head.version != ARCHIVE_VERSION) {
+        munmap( base, sb.st_size );
+        return;
+    }
+    m->events_base = base;
+    m->events_size = sb.st_size;
+    m->event = (const struct archive_event *) ( m->events_base + sizeof head );
+    m->events = ( sb.st_size - sizeof head ) / sizeof( struct archive_event );
+}
+
+/*------------------------------------------------------------------*
+ * Maps an archive for reading. The index is taken from the footer if
+ * there is one, otherwise (the archive is still being written, or its
+ * writer crashed) rebuilt from the chunk headers.
+ *------------------------------------------------------------------*/
+
+bool archive_map( const char * path, struct archive_map * m )
+{
+    struct archive_header head;
+    struct archive_footer foot;
+    struct archive_chunk c;
+    struct stat sb;
+    uint64_t pos;
+    uint32_t size = 0;
+    int fd;
+
+    memset( m, 0, sizeof *m );
+    fd = open( path, O_RDONLY | O_CLOEXEC );
+    if (fd < 0 || fstat( fd, &sb ) < 0 || (size_t) sb.st_size < sizeof head) {
+        fprintf(stderr,"FATAL: cannot read archive %s\n", path);
+        if (fd >= 0) {
+            close( fd );
+        }
+        return false;
+    }
+    m->size = sb.st_size;
+    m->base = mmap( NULL, m->size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (m->base == MAP_FAILED) {
+        perror( "mmap" );
+        m->base = NULL;
+        return false;
+    }
+
+    memcpy( &head, m->base, sizeof head );
+    if (   memcmp( head.magic, ARCHIVE_MAGIC, 4 )
+        || head.version != ARCHIVE_VERSION
+        || head.columns != ARCHIVE_COLUMNS ) {
+        fprintf(stderr,"FATAL: %s is not an archive\n", path);
+        archive_unmap( m );
+        return false;
+    }
+    m->chunk_samples = head.chunk_samples;
+
+    if (m->size >= sizeof head + sizeof foot) {
+        memcpy( &foot, m->base + m->size - sizeof foot, sizeof foot );
+    }
+    if (   m->size >= sizeof head + sizeof foot
+        && ! memcmp( foot.magic, ARCHIVE_INDEX_MAGIC, 4 )
+        && foot.index_offset + (uint64_t) foot.chunks * sizeof *m->index + sizeof foot == m->size ) {
+        m->index = malloc( ( foot.chunks ? foot.chunks : 1 ) * sizeof *m->index );
+        if (m->index == NULL) {
+            archive_unmap( m );
+            return false;
+        }
+        memcpy( m->index, m->base + foot.index_offset, foot.chunks * sizeof *m->index );
+        m->chunks = foot.chunks;
+        events_map( m, path );
+        return true;
+    }
+
+    for (pos = sizeof head; pos + sizeof c <= m->size; pos += sizeof c + c.bytes) {
+        memcpy( &c, m->base + pos, sizeof c );
+        if (memcmp( c.magic, ARCHIVE_CHUNK_MAGIC, 4 ) || pos + sizeof c + c.bytes > m->size) {
+            break;
+        }
+        if (c.count == 0) {
+            continue;
+        }
+        if (m->chunks == size) {
+            struct archive_index *index;
+
+            size = size ? 2 * size : 64;
+            index = realloc( m->index, size * sizeof *index );
+            if (index == NULL) {
+                archive_unmap( m );
+                return false;
+            }
+            m->index = index;
+        }
+        m->index[ m->chunks ].t_first = c.t_first;
+        m->index[ m->chunks ].t_last = c.t_last;
+        m->index[ m->chunks ].offset = pos;
+        m->index[ m->chunks ].count = c.count;
+        m->index[ m->chunks ].reserved = 0;
+        m->chunks++;
+    }
+    events_map( m, path );
+    return true;
+}
+
+void archive_unmap( struct archive_map * m )
+{
+    if (m->base) {
+        munmap( (void *) m->base, m->size );
+    }
+    if (m->events_base) {
+        munmap( (void *) m->events_base, m->events_size );
+    }
+    free( m->index );
+    memset( m, 0, sizeof *m );
+}
+
+/* First chunk ending at or after time t (m->chunks if none), by bisection */
+
+uint32_t archive_find( const struct archive_map * m, double t )
+{
+    uint32_t lo = 0, hi = m->chunks;
+
+    while (lo < hi) {
+        uint32_t mid = lo + ( hi - lo ) / 2;
+
+        if (m->index[ mid ].t_last < t) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* First event at or after time t (m->events if none) */
+
+uint32_t archive_find_event( const struct archive_map * m, double t )
+{
+    uint32_t lo = 0, hi = m->events;
+
+    while (lo < hi) {
+        uint32_t mid = lo + ( hi - lo ) / 2;
+
+        if (m->event[ mid ].time < t) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
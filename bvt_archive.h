@@ -0,0 +1,164 @@
+/* Append-only columnar archive of the daemon's samples.
+ *
+ * The file holds a header, then a sequence of chunks, and, once the
+ * archive has been closed cleanly, a sparse time index and a footer:
+ *
+ *   struct archive_header
+ *   chunk:  struct archive_chunk, then the columns one after another
+ *   ...
+ *   struct archive_index   one per chunk
+ *   struct archive_footer  at the very end of the file
+ *
+ * A chunk has room for chunk_samples samples, stored column by column
+ * (time, temperature, setpoint, heater power, LN2 heater power, flow
+ * rate as doubles, then the IS, SW and XS status words as uint16), each
+ * column taking chunk_samples entries of which the first 'count' are
+ * valid. The chunk being filled is rewritten in place as samples come
+ * in, data first and count last, so after a crash it is still valid up
+ * to the last sync. A file without footer (the daemon did not exit
+ * cleanly) is read by walking the chunk headers instead of the index.
+ *
+ * Once full (or when the archive is closed) a chunk is rewritten in
+ * compressed form, encoding 1, unless that would not make it smaller.
+ * Its data are then one stream per column, each a struct archive_stream
+ * followed by a bit stream, bits most significant first:
+ *
+ *   STREAM_TIME       wall time in whole microseconds: the first as 64
+ *                     bits, then the difference of successive intervals
+ *   STREAM_DECIMAL+k  values that are exact multiples of 10^-k, as the
+ *                     integer count of 10^-k: the first as 64 bits, then
+ *                     the difference to the previous one
+ *   STREAM_XOR        other doubles: the first as 64 bits, then XOR with
+ *                     the previous one (Gorilla): '0' for the same value,
+ *                     '10' and the meaningful bits if they fit the
+ *                     previous window, else '11', 5 bits of leading
+ *                     zeros, 6 bits of length - 1 and the meaningful bits
+ *   STREAM_WORDS      status words: '0' if unchanged, else '1' and 16 bits
+ *
+ * Differences are zigzag coded and written as '0' for zero, '10' and 7
+ * bits, '110' and 12 bits, '1110' and 20 bits, or '1111' and 64 bits.
+ * The device reports PV, setpoint and powers to one decimal, so these
+ * usually take one bit per sample while they are steady.
+ *
+ * Next to the archive, in <archive>.events, the writer keeps an index of
+ * the transitions of the status bits named in bvt_shm.h (heater on/off,
+ * manual mode, setpoint 2, alarms, LN2 refill/empty, sensor break ...):
+ * a struct archive_events_header followed by one struct archive_event per
+ * transition, in time order, so that finding them needs no decoding of
+ * the samples. Transitions while the daemon was not running are not seen.
+ *
+ * All numbers are in host (little-endian) byte order.
+ */
+#pragma once
+#if ! defined BVT_ARCHIVE_HEADER
+#define BVT_ARCHIVE_HEADER
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bvt_shm.h"
+
+#define ARCHIVE_MAGIC        "BVTA"
+#define ARCHIVE_CHUNK_MAGIC  "CHNK"
+#define ARCHIVE_INDEX_MAGIC  "BVTI"
+#define ARCHIVE_VERSION      1
+#define ARCHIVE_CHUNK_SAMPLES 1024
+#define ARCHIVE_EVENTS_SUFFIX ".events"
+#define ARCHIVE_EVENTS_MAGIC "BVTE"
+#define ARCHIVE_QUEUE        4096   /* samples the writer thread may lag behind */
+
+enum archive_column {
+    COL_TIME,
+    COL_TEMPERATURE,
+    COL_SETPOINT,
+    COL_HEATER_POWER,
+    COL_LN2_HEATER_POWER,
+    COL_FLOW_RATE,
+    COL_IS,
+    COL_SW,
+    COL_XS,
+    ARCHIVE_COLUMNS
+};
+
+#define ARCHIVE_DOUBLE_COLUMNS  6       /* COL_TIME ... COL_FLOW_RATE */
+#define ARCHIVE_ROW_BYTES ( ARCHIVE_DOUBLE_COLUMNS * 8 + ( ARCHIVE_COLUMNS - ARCHIVE_DOUBLE_COLUMNS ) * 2 )
+
+struct archive_header {
+    char magic[ 4 ];
+    uint32_t version;
+    uint32_t chunk_samples;
+    uint32_t columns;
+    double created;                 /* wall time the file was started */
+};
+
+#define ARCHIVE_PLAIN       0
+#define ARCHIVE_COMPRESSED  1
+
+struct archive_chunk {
+    char magic[ 4 ];
+    uint32_t count;                 /* valid samples */
+    uint32_t encoding;              /* ARCHIVE_PLAIN or ARCHIVE_COMPRESSED */
+    uint32_t bytes;                 /* size of the data following */
+    double t_first, t_last;
+};
+
+enum { STREAM_TIME, STREAM_DECIMAL, STREAM_XOR = STREAM_DECIMAL + 4, STREAM_WORDS };
+
+struct archive_stream {
+    uint32_t method;                /* STREAM_* */
+    uint32_t bytes;                 /* of the bit stream following */
+};
+
+struct archive_index {
+    double t_first, t_last;
+    uint64_t offset;                /* of the chunk header */
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct archive_footer {
+    uint64_t index_offset;
+    uint32_t chunks;
+    char magic[ 4 ];
+};
+
+struct archive_events_header {
+    char magic[ 4 ];
+    uint32_t version;
+};
+
+struct archive_event {
+    double time;                    /* of the first sample in the new state */
+    uint16_t event;                 /* into bvt_status_events[ ] */
+    uint16_t state;                 /* 1: bit now set, 0: now clear */
+    uint32_t reserved;
+};
+
+/* An archive mapped for reading, see archive_map() */
+
+struct archive_map {
+    const unsigned char *base;
+    size_t size;
+    uint32_t chunk_samples;
+    struct archive_index *index;    /* of the chunks holding samples */
+    uint32_t chunks;
+
+    const unsigned char *events_base;   /* the event index, if there is one */
+    size_t events_size;
+    const struct archive_event *event;
+    uint32_t events;
+};
+
+struct bvt_archive;
+
+struct bvt_archive * archive_open( const char * path, double sync_interval );
+void archive_add( struct bvt_archive * a, const struct bvt_state * st );
+void archive_close( struct bvt_archive * a );
+bool archive_column( const struct archive_chunk * c, const unsigned char * data,
+                     uint32_t chunk_samples, int col, void * out );
+int archive_column_by_name( const char * name );
+bool archive_map( const char * path, struct archive_map * m );
+void archive_unmap( struct archive_map * m );
+uint32_t archive_find( const struct archive_map * m, double t );
+uint32_t archive_find_event( const struct archive_map * m, double t );
+
+#endif
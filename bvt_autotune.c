@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "bvt_autotune.h"
+extern bool verboseFlag;
+
+/*------------------------------------------------------------------*
+ * Tuning rules, as factors on Ku for the gain and on Tu for TI and TD
+ *------------------------------------------------------------------*/
+
+static const struct {
+    const char *name;
+    double kc, ti, td;
+} rules[ ] = {
+    { "classic",        0.60, 0.50, 0.125 },
+    { "some-overshoot", 0.33, 0.50, 0.33  },
+    { "no-overshoot",   0.20, 0.50, 0.33  },
+};
+
+#define RULES  ( sizeof rules / sizeof rules[ 0 ] )
+
+int autotune_rule( const char *name )
+{
+    for (unsigned int i = 0; i < RULES; i++) {
+        if (! strcmp( name, rules[ i ].name )) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* The terms are clamped to what the device accepts */
+
+void autotune_apply_rule( int rule, double ku, double tu, struct autotune_result *r )
+{
+    r->ku = ku;
+    r->tu = tu;
+    r->xp = fmin( fmax( 100.0 / ( rules[ rule ].kc * ku ), 0.1 ), MAX_PROPORTIONAL_BAND );
+    r->ti = fmin( rules[ rule ].ti * tu, MAX_INTEGRAL_TIME );
+    r->td = fmin( rules[ rule ].td * tu, MAX_DERIVATIVE_TIME );
+}
+
+static volatile sig_atomic_t autotune_quit = 0;
+
+static void autotune_signal( int sig )
+{
+    (void) sig;
+    autotune_quit = 1;
+}
+
+static double monotonic( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Heater power writes go out as posted writes, which unlike
+   eurotherm902s_set_heater_power() cost no status word read each */
+
+static void autotune_power( double power, struct sp_port * port_choice )
+{
+    eurotherm902s_post_heater_power( power );
+    bvt3000_flush_posted_writes( port_choice );
+}
+
+/*------------------------------------------------------------------*
+ * Runs the relay experiment given on the command line and writes the
+ * result. Returns 0 on success, 1 on bad arguments, 2 if the experiment
+ * had to be abandoned.
+ *------------------------------------------------------------------*/
+
+int run_autotune( struct gengetopt_args_info *ai, struct sp_port * port_choice )
+{
+    struct sigaction sa, old_int, old_term;
+    struct timespec next;
+    struct autotune_result r;
+    int rule = autotune_rule( ai->autotune_rule_arg );
+    double interval = ai->poll_interval_arg;
+    double h = ai->autotune_hysteresis_arg;
+    double sp, bias, limit, high, low, d;
+    double cycle_start = NAN, last_switch, pv_max = -INFINITY, pv_min = INFINITY;
+    double sum_tu = 0.0, sum_a = 0.0, a;
+    int mode, cycles = -1, result = 2;
+    bool heating;
+
+    if (rule < 0) {
+        fprintf(stderr,"FATAL: Unknown tuning rule %s\n", ai->autotune_rule_arg);
+        return 1;
+    }
+    if (ai->autotune_step_arg <= 0.0 || h < 0.0 || ai->autotune_cycles_arg < 1 || interval <= 0.0) {
+        fprintf(stderr,"FATAL: Autotune needs a positive step, cycles and poll interval\n");
+        return 1;
+    }
+    if (bvt3000_get_heater_state( port_choice ) != SET) {
+        fprintf(stderr,"FATAL: Heater is off, not autotuning\n");
+        return 1;
+    }
+
+    /* The power needed at the setpoint is taken to be the power the
+       controller puts out now, so start with the loop settled */
+
+    sp = eurotherm902s_get_working_setpoint( port_choice );
+    mode = eurotherm902s_get_mode( port_choice );
+    bias = eurotherm902s_get_heater_power( port_choice );
+    limit = eurotherm902s_get_heater_power_limit( port_choice );
+    high = fmin( bias + ai->autotune_step_arg, limit );
+    low = fmax( bias - ai->autotune_step_arg, 0.0 );
+    d = ( high - low ) / 2.0;
+    if (d <= 0.0) {
+        fprintf(stderr,"FATAL: No room to move the heater power around %f%%\n", bias);
+        return 1;
+    }
+    if (verboseFlag) {
+        printf("Autotuning at %.1f K, heater power %.1f%% / %.1f%%, hysteresis %.2f K\n",
+                sp, low, high, h);
+    }
+
+    memset( &sa, 0, sizeof sa );
+    sa.sa_handler = autotune_signal;
+    sigaction( SIGINT, &sa, &old_int );
+    sigaction( SIGTERM, &sa, &old_term );
+
+    if (mode != MANUAL_MODE) {
+        eurotherm902s_set_mode( MANUAL_MODE, port_choice );
+    }
+    heating = eurotherm902s_get_temperature( port_choice ) < sp;
+    autotune_power( heating ? high : low, port_choice );
+    last_switch = monotonic( );
+    clock_gettime( CLOCK_MONOTONIC, &next );
+
+    while ( ! autotune_quit ) {
+        double now, pv;
+
+        next.tv_nsec += (long) ( interval * 1e9 ) % 1000000000L;
+        next.tv_sec += (time_t) interval + next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+        if (clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL ) == EINTR) {
+            continue;
+        }
+
+        bvt3000_coalesce_invalidate( );
+        now = monotonic( );
+        pv = eurotherm902s_get_temperature( port_choice );
+        pv_max = fmax( pv_max, pv );
+        pv_min = fmin( pv_min, pv );
+
+        if (fabs( pv - sp ) > AUTOTUNE_MAX_EXCURSION) {
+            fprintf(stderr,"FATAL: Temperature %.1f K ran away from the setpoint, autotune abandoned\n", pv);
+            break;
+        }
+        if (now - last_switch > AUTOTUNE_MAX_HALF_CYCLE) {
+            fprintf(stderr,"FATAL: No oscillation after %.0f s, autotune abandoned\n", now - last_switch);
+            break;
+        }
+
+        if (heating && pv > sp + h) {
+            heating = false;
+            autotune_power( low, port_choice );
+            last_switch = now;
+        } else if (! heating && pv < sp - h) {
+
+            /* A cycle runs from one switch to heating to the next; the
+               first one is still settling into the limit cycle */
+
+            heating = true;
+            autotune_power( high, port_choice );
+            last_switch = now;
+            if (! isnan( cycle_start ) && ++cycles > 0) {
+                sum_tu += now - cycle_start;
+                sum_a += ( pv_max - pv_min ) / 2.0;
+                if (verboseFlag) {
+                    printf("Cycle %d: period %.1f s, amplitude %.2f K\n",
+                            cycles, now - cycle_start, ( pv_max - pv_min ) / 2.0);
+                }
+            }
+            cycle_start = now;
+            pv_max = -INFINITY;
+            pv_min = INFINITY;
+            if (cycles == ai->autotune_cycles_arg) {
+                result = 0;
+                break;
+            }
+        }
+    }
+
+    /* Leave the controller as it was */
+
+    if (mode == MANUAL_MODE) {
+        autotune_power( bias, port_choice );
+    } else {
+        eurotherm902s_set_mode( mode, port_choice );
+    }
+    sigaction( SIGINT, &old_int, NULL );
+    sigaction( SIGTERM, &old_term, NULL );
+
+    if (result != 0) {
+        if (autotune_quit) {
+            fprintf(stderr,"FATAL: Autotune interrupted\n");
+        }
+        return result;
+    }
+
+    a = sum_a / cycles;
+    if (a <= h) {
+        fprintf(stderr,"FATAL: Oscillation of %.2f K no larger than the hysteresis, try a larger step\n", a);
+        return 2;
+    }
+    autotune_apply_rule( rule, 4.0 * d / ( M_PI * sqrt( a * a - h * h ) ), sum_tu / cycles, &r );
+    printf("***TUNE: %lf %lf %lf %lf %lf\n", r.ku, r.tu, r.xp, r.ti, r.td);
+
+    eurotherm902s_set_proportional_band( r.xp, port_choice );
+    eurotherm902s_set_integral_time( r.ti, port_choice );
+    eurotherm902s_set_derivative_time( r.td, port_choice );
+    return 0;
+}
@@ -0,0 +1,39 @@
+/* Relay-feedback PID autotuning (Astrom and Hagglund).
+ *
+ * The controller is put into manual mode and the heater power is
+ * switched between the power needed at the setpoint plus and minus a
+ * step, whenever the temperature leaves a small band around the
+ * setpoint. The loop then settles into a limit cycle whose period Tu
+ * and amplitude a give the ultimate gain Ku = 4 d / (pi a) of the loop
+ * (d being the relay amplitude, corrected for the hysteresis), from
+ * which a tuning rule gives the PID terms. The proportional band is
+ * written as 100 / Kc, i.e. in K for a gain in %/K.
+ *
+ * This takes a few oscillation periods, minutes rather than the hour or
+ * more of the built-in self-tune, and every cycle is reported. The
+ * original mode (and heater power, if it was manual) is restored at the
+ * end, also when interrupted or when the temperature runs away.
+ */
+#pragma once
+#if ! defined BVT_AUTOTUNE_HEADER
+#define BVT_AUTOTUNE_HEADER
+
+#include "serial_jjm.h"
+#include "cmdline.h"
+
+#define AUTOTUNE_MAX_EXCURSION   25.0    /* K off the setpoint before giving up */
+#define AUTOTUNE_MAX_HALF_CYCLE  3600.0  /* s without a relay switch before giving up */
+
+struct autotune_result {
+    double ku;                      /* ultimate gain, %/K */
+    double tu;                      /* ultimate period, s */
+    double xp;                      /* proportional band, K */
+    double ti;                      /* integral time, s */
+    double td;                      /* derivative time, s */
+};
+
+int autotune_rule( const char *name );
+void autotune_apply_rule( int rule, double ku, double tu, struct autotune_result *r );
+int run_autotune( struct gengetopt_args_info *ai, struct sp_port * port_choice );
+
+#endif
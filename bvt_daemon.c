@@ -0,0 +1,409 @@
+#include <signal.h>
+#include <errno.h>
+#include <math.h>
+#include "bvt_daemon.h" 
+#include "convenient_wrapper_functions.h" 
+extern bool verboseFlag; 
+
+/*------------------------------------------------------------------*
+ * The daemon keeps the port open and samples the device on a fixed
+ * schedule, publishing every decoded sample to shared memory (both as
+ * the latest snapshot and into the sample ring). With --listen it also
+ * serves client requests over TCP, see bvt_server.h, and with
+ * --metrics-port a Prometheus endpoint, see bvt_metrics.h, and with
+ * --archive it appends every sample to a file, see bvt_archive.h. It also
+ * runs setpoint profiles, see bvt_profile.h, gain schedules, see
+ * bvt_schedule.h, with --mpc drives the heater power itself, see
+ * bvt_mpc.h, and with --ln2-control the LN2 evaporator, see bvt_ln2.h.
+ * It runs until SIGINT / SIGTERM, and leaves the device exactly as it
+ * found it.
+ *------------------------------------------------------------------*/
+
+static volatile sig_atomic_t daemon_quit = 0; 
+
+static void daemon_signal( int sig ) { 
+    (void) sig; 
+    daemon_quit = 1; 
+}
+
+static double timespec_seconds( const struct timespec *ts ) { 
+    return ts->tv_sec + ts->tv_nsec * 1e-9; 
+}
+
+static void timespec_add( struct timespec *ts, double seconds ) { 
+    long ns = ts->tv_nsec + (long) ( ( seconds - (long) seconds ) * 1e9 ); 
+    ts->tv_sec += (long) seconds + ns / 1000000000L; 
+    ts->tv_nsec = ns % 1000000000L; 
+}
+
+/*------------------------------------------------------------------*
+ * Reads one full sample of the device state. The sample is taken in
+ * steps of one serial transaction each, so that client requests can be
+ * slotted in between them. A step returns false if its read got no
+ * usable reply, in which case the value it stored means nothing.
+ *------------------------------------------------------------------*/
+
+enum { ACQ_PV, ACQ_SP, ACQ_OP, ACQ_AF, ACQ_IS, ACQ_SW, ACQ_XS, 
+       ACQ_SP1, ACQ_SP2, ACQ_N2P, ACQUIRE_STEPS }; 
+
+static bool daemon_acquire_step( struct bvt_state *st, int step, struct sp_port* port_choice ) 
+{ 
+    struct timespec ts; 
+
+    switch ( step ) { 
+        case ACQ_PV : 
+            clock_gettime( CLOCK_REALTIME, &ts ); 
+            st->wall_time = timespec_seconds( &ts ); 
+            clock_gettime( CLOCK_MONOTONIC, &ts ); 
+            st->mono_time = timespec_seconds( &ts ); 
+            st->temperature = eurotherm902s_get_temperature( port_choice ); 
+            break; 
+        case ACQ_SP : 
+            st->working_setpoint = eurotherm902s_get_working_setpoint( port_choice ); 
+            break; 
+        case ACQ_OP : 
+            st->heater_power = eurotherm902s_get_heater_power( port_choice ); 
+            break; 
+        case ACQ_AF : 
+            st->flow_index = bvt3000_get_flow_rate( port_choice ); 
+            st->flow_rate = st->flow_index <= 15 ? translate_flow_rate( st->flow_index ) : -1.0; 
+            break; 
+        case ACQ_IS : 
+            st->is = bvt3000_get_interface_status( port_choice ); 
+            break; 
+        case ACQ_SW : 
+            st->sw = eurotherm902s_get_sw( port_choice ); 
+            break; 
+        case ACQ_XS : 
+            st->xs = eurotherm902s_get_xs( port_choice ); 
+            break; 
+        case ACQ_SP1 : 
+            st->setpoint1 = eurotherm902s_get_setpoint( SP1, port_choice ); 
+            break; 
+        case ACQ_SP2 : 
+            st->setpoint2 = eurotherm902s_get_setpoint( SP2, port_choice ); 
+            break; 
+        case ACQ_N2P : 
+            st->ln2_heater_power = bvt3000_get_ln2_heater_power( port_choice ); 
+            break; 
+    }
+    return bvt3000_last_query_ok( ); 
+}
+
+bool daemon_acquire( struct bvt_state *st, struct sp_port* port_choice ) 
+{ 
+    bool ok = true; 
+
+    for (int step = 0; step < ACQUIRE_STEPS; step++) { 
+        ok = daemon_acquire_step( st, step, port_choice ) && ok; 
+    }
+    return ok; 
+}
+
+int run_daemon( struct gengetopt_args_info *ai, struct sp_port* port_choice ) 
+{ 
+    struct sigaction sa; 
+    struct bvt_shm *shm = NULL; 
+    struct bvt_ring *ring = NULL; 
+    char ring_name[ 256 ]; 
+    struct bvt_state st, published; 
+    struct timespec next, now; 
+    double interval = ai->poll_interval_arg; 
+    uint64_t seq = 0; 
+    int step = ACQUIRE_STEPS;       /* next acquisition step, or idle */ 
+    bool sample_ok = true;          /* every read of the sample so far got a reply */ 
+    unsigned long dropped = 0; 
+    struct bvt_server *srv = NULL; 
+    struct bvt_metrics *metrics = NULL; 
+    struct bvt_history *history = NULL; 
+    struct bvt_archive *archive = NULL; 
+    struct bvt_profile *profile = NULL; 
+    struct bvt_schedule *schedule = NULL; 
+    struct bvt_mpc *mpc = NULL; 
+    struct bvt_ln2 *ln2 = NULL; 
+    double deadline; 
+    struct pollfd fds[ 1 + SERVER_MAX_CLIENTS + 1 + METRICS_MAX_CLIENTS ]; 
+    int nfds, mfds, timeout; 
+    int result = 1; 
+
+    if (interval <= 0.0) { 
+        fprintf(stderr,"FATAL: poll interval must be positive\n"); 
+        return 1; 
+    }
+    if (ai->listen_given && ( ai->listen_arg <= 0 || ai->listen_arg > 65535 )) { 
+        fprintf(stderr,"FATAL: invalid TCP port %d\n", ai->listen_arg); 
+        return 1; 
+    }
+    if (ai->metrics_port_given && ( ai->metrics_port_arg <= 0 || ai->metrics_port_arg > 65535 )) { 
+        fprintf(stderr,"FATAL: invalid metrics port %d\n", ai->metrics_port_arg); 
+        return 1; 
+    }
+    if (ai->archive_given && ai->archive_sync_arg < 0.0) { 
+        fprintf(stderr,"FATAL: archive sync interval must not be negative\n"); 
+        return 1; 
+    }
+    if (ai->ring_size_arg <= 0) { 
+        fprintf(stderr,"FATAL: ring size must be positive\n"); 
+        return 1; 
+    }
+    if (ai->mpc_given && ai->schedule_given) { 
+        fprintf(stderr,"FATAL: --mpc and --schedule cannot be used together\n"); 
+        return 1; 
+    }
+
+    memset( &sa, 0, sizeof sa ); 
+    sa.sa_handler = daemon_signal; 
+    sigaction( SIGINT, &sa, NULL ); 
+    sigaction( SIGTERM, &sa, NULL ); 
+
+    /* Everything set up from here on is released at cleanup, in reverse
+       order, whether the daemon ran or failed to start */
+
+    snprintf( ring_name, sizeof ring_name, "%s%s", ai->shm_name_arg, BVT_RING_SUFFIX ); 
+    shm = bvt_shm_create( ai->shm_name_arg ); 
+    if (shm == NULL) { 
+        fprintf(stderr,"FATAL: unable to create shared memory segment %s\n", ai->shm_name_arg); 
+        goto cleanup; 
+    }
+    ring = bvt_ring_create( ring_name, ai->ring_size_arg ); 
+    if (ring == NULL) { 
+        fprintf(stderr,"FATAL: unable to create sample ring %s\n", ring_name); 
+        goto cleanup; 
+    }
+    if (verboseFlag) { 
+        printf("Daemon sampling every %f s, state in shared memory %s, samples in %s\n", 
+                interval, ai->shm_name_arg, ring_name); 
+    }
+
+    /* Reads for clients share replies at most half a sample old */
+
+    if (interval * 500.0 < COALESCE_WINDOW) { 
+        bvt3000_set_coalesce_window( (unsigned int) ( interval * 500.0 ) ); 
+    }
+
+    history = history_create( interval ); 
+    profile = calloc( 1, sizeof *profile ); 
+    if (history == NULL || profile == NULL) { 
+        fprintf(stderr,"FATAL: unable to allocate the sample history\n"); 
+        goto cleanup; 
+    }
+    if (ai->profile_given && ! ( profile_load( profile, ai->profile_arg ) && profile_start( profile ) )) { 
+        goto cleanup; 
+    }
+
+    if (ai->schedule_given) { 
+        schedule = calloc( 1, sizeof *schedule ); 
+        if (schedule == NULL || ! schedule_load( schedule, ai->schedule_arg )) { 
+            goto cleanup; 
+        }
+    }
+    if (ai->mpc_given) { 
+        mpc = mpc_create( ai->mpc_arg, ai->mpc_response_arg, ai->mpc_power_limit_arg, 
+                          ai->mpc_flow_given ? ai->mpc_flow_arg : -1.0, interval ); 
+        if (mpc == NULL) { 
+            goto cleanup; 
+        }
+    }
+    if (ai->ln2_control_flag) { 
+        ln2 = ln2_create( ai->ln2_heater_target_arg, ai->ln2_integral_time_arg, ai->ln2_power_limit_arg ); 
+        if (ln2 == NULL) { 
+            goto cleanup; 
+        }
+    }
+
+    if (ai->archive_given) { 
+        archive = archive_open( ai->archive_arg, ai->archive_sync_arg ); 
+        if (archive == NULL) { 
+            goto cleanup; 
+        }
+    }
+
+    if (ai->listen_given) { 
+        srv = server_open( ai->listen_address_arg, ai->listen_arg ); 
+        if (srv) { 
+            server_set_history( srv, history ); 
+            server_set_profile( srv, profile ); 
+            server_set_schedule( srv, schedule ); 
+            server_set_mpc( srv, mpc ); 
+            server_set_ln2( srv, ln2 ); 
+        }
+    }
+    if (ai->metrics_port_given) { 
+        metrics = metrics_open( ai->listen_address_arg, ai->metrics_port_arg ); 
+    }
+    if (( ai->listen_given && srv == NULL ) || ( ai->metrics_port_given && metrics == NULL )) { 
+        goto cleanup; 
+    }
+
+    /* Take the heater over only once nothing else can fail */
+
+    if (mpc) { 
+        mpc_start( mpc, port_choice ); 
+    }
+
+    memset( &st, 0, sizeof st ); 
+    published = st; 
+    clock_gettime( CLOCK_MONOTONIC, &next ); 
+
+    while ( ! daemon_quit ) { 
+        int cls = srv ? server_pending( srv ) : REQUEST_CLASSES; 
+
+        clock_gettime( CLOCK_MONOTONIC, &now ); 
+        if (step == ACQUIRE_STEPS && timespec_seconds( &now ) >= timespec_seconds( &next )) { 
+            /* Every sample reads the device afresh, whatever clients
+               read just before */
+            bvt3000_coalesce_invalidate( ); 
+            step = 0; 
+            sample_ok = true; 
+        }
+
+        /* One serial transaction per pass: safety actions and writes
+           first, then a due profile step, heater power, gain schedule or
+           evaporator power change, reads for clients, the sample in
+           progress and background requests */
+
+        if (cls <= CLASS_CONTROL) { 
+            server_run_next( srv, port_choice ); 
+        } else if (profile_due( profile, timespec_seconds( &now ) )) { 
+            profile_step( profile, timespec_seconds( &now ), port_choice ); 
+        } else if (mpc && mpc_due( mpc )) { 
+            mpc_step( mpc, port_choice ); 
+        } else if (schedule && schedule_due( schedule )) { 
+            schedule_step( schedule, port_choice ); 
+        } else if (ln2 && ln2_due( ln2 )) { 
+            ln2_step( ln2, port_choice ); 
+        } else if (cls < CLASS_BACKGROUND || ( step == ACQUIRE_STEPS && cls < REQUEST_CLASSES )) { 
+            server_run_next( srv, port_choice ); 
+        } else if (step < ACQUIRE_STEPS) { 
+            sample_ok = daemon_acquire_step( &st, step++, port_choice ) && sample_ok; 
+            if (step == ACQUIRE_STEPS) { 
+                if (! sample_ok) { 
+
+                    /* A read that timed out or came back garbled would
+                       publish zeros as if measured: leave the last good
+                       sample up */
+
+                    fprintf(stderr,"WARNING: Sample dropped, the device did not answer every read "
+                            "(%lu dropped so far)\n", ++dropped); 
+                    if (mpc) { 
+                        mpc_miss( mpc ); 
+                    }
+                    if (ln2) { 
+                        ln2_miss( ln2 ); 
+                    }
+                } else { 
+                    st.seq = ++seq; 
+                    bvt_shm_publish( shm, &st ); 
+                    bvt_ring_publish( ring, &st ); 
+                    published = st; 
+                    history_add( history, &st ); 
+                    if (schedule) { 
+                        schedule_update( schedule, &st ); 
+                    }
+                    if (mpc) { 
+                        mpc_update( mpc, &st, profile ); 
+                    }
+                    if (ln2) { 
+                        ln2_update( ln2, &st ); 
+                    }
+                    if (archive) { 
+                        archive_add( archive, &st ); 
+                    }
+                    if (srv) { 
+                        server_publish( srv, &st ); 
+                    }
+
+                    if (verboseFlag) { 
+                        printf("Sample %llu: PV %f SP %f OP %f\n", (unsigned long long) st.seq, 
+                                st.temperature, st.working_setpoint, st.heater_power); 
+                    }
+                }
+
+                /* Absolute deadlines, so the sampling rate does not drift by
+                   the time spent talking to the device. If we fell behind (a
+                   slow link, a stalled port), skip ahead rather than burst. */
+
+                timespec_add( &next, interval ); 
+                clock_gettime( CLOCK_MONOTONIC, &now ); 
+                if (timespec_seconds( &next ) < timespec_seconds( &now )) { 
+                    next = now; 
+                }
+            }
+        }
+
+        /* Whichever comes first of the next sample and profile step */
+
+        deadline = timespec_seconds( &next ); 
+        if (profile_deadline( profile ) < deadline) { 
+            deadline = profile_deadline( profile ); 
+        }
+
+        if (srv == NULL && metrics == NULL) { 
+            if (step == ACQUIRE_STEPS) { 
+                struct timespec wake = { (time_t) deadline, (long) ( ( deadline - (time_t) deadline ) * 1e9 ) }; 
+
+                while ( ! daemon_quit 
+                        && clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL ) == EINTR ) { 
+                }
+            }
+            continue; 
+        }
+
+        /* Look at the network without waiting if there is work left,
+           otherwise sleep until a client talks to us or the next sample
+           is due. Metrics scrapes are answered right here, from the last
+           published sample. */
+
+        timeout = 0; 
+        if (step == ACQUIRE_STEPS && ( srv == NULL || server_pending( srv ) == REQUEST_CLASSES )) { 
+            clock_gettime( CLOCK_MONOTONIC, &now ); 
+            timeout = (int) ceil( ( deadline - timespec_seconds( &now ) ) * 1000.0 ); 
+            if (timeout < 0) { 
+                timeout = 0; 
+            }
+        }
+        if (metrics && timeout > METRICS_TIMEOUT * 1000.0) { 
+            timeout = METRICS_TIMEOUT * 1000.0; 
+        }
+        nfds = srv ? server_pollfds( srv, fds, 1 + SERVER_MAX_CLIENTS ) : 0; 
+        mfds = metrics ? metrics_pollfds( metrics, fds + nfds, 1 + METRICS_MAX_CLIENTS ) : 0; 
+        if (poll( fds, nfds + mfds, timeout ) > 0) { 
+            if (srv) { 
+                server_service( srv, fds, nfds ); 
+            }
+            if (metrics) { 
+                metrics_service( metrics, fds + nfds, mfds, &published ); 
+            }
+        }
+        if (metrics) { 
+            metrics_expire( metrics ); 
+        }
+    }
+
+    if (verboseFlag) { 
+        printf("Daemon stopping after %llu samples\n", (unsigned long long) seq); 
+    }
+    if (ln2) { 
+        ln2_restore( ln2, port_choice ); 
+    }
+    if (mpc) { 
+        mpc_stop( mpc, port_choice ); 
+    }
+    if (schedule) { 
+        schedule_restore( schedule, port_choice ); 
+    }
+    result = 0; 
+
+cleanup: 
+    server_close( srv ); 
+    metrics_close( metrics ); 
+    archive_close( archive ); 
+    free( ln2 ); 
+    free( mpc ); 
+    free( schedule ); 
+    free( profile ); 
+    history_destroy( history ); 
+    bvt_ring_destroy( ring, ring_name ); 
+    bvt_shm_destroy( shm, ai->shm_name_arg ); 
+    return result; 
+}
@@ -0,0 +1,10 @@
+#include <stdio.h>
+#include "serial_jjm.h"
+#include "cmdline.h"
+#include "bvt_shm.h"
+#include "bvt_server.h"
+#include "bvt_metrics.h"
+#include "bvt_archive.h"
+
+int run_daemon( struct gengetopt_args_info *ai, struct sp_port* port_choice );
+bool daemon_acquire( struct bvt_state *st, struct sp_port* port_choice );
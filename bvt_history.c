@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bvt_history.h"
+
+static const char * const channel_names[ HIST_CHANNELS ] = {
+    "temperature", "setpoint", "heater-power", "ln2-heater-power", "flow-rate"
+};
+
+int history_channel( const char *name )
+{
+    for (int i = 0; i < HIST_CHANNELS; i++) {
+        if (! strcmp( name, channel_names[ i ] )) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*------------------------------------------------------------------*
+ * Allocates all tiers up front, so that the daemon never allocates
+ * while running. The full-rate tier is sized for the sampling interval.
+ *------------------------------------------------------------------*/
+
+struct bvt_history * history_create( double interval )
+{
+    static const double span[ HISTORY_TIERS ] =
+        { HISTORY_RAW_SPAN, HISTORY_MEDIUM_SPAN, HISTORY_LONG_SPAN };
+    static const double width[ HISTORY_TIERS ] =
+        { 0.0, HISTORY_MEDIUM_WIDTH, HISTORY_LONG_WIDTH };
+    struct bvt_history *h = calloc( 1, sizeof *h );
+
+    if (h == NULL) {
+        return NULL;
+    }
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        struct history_tier *tier = &h->tier[ t ];
+
+        tier->width = width[ t ];
+        tier->size = ceil( span[ t ] / ( width[ t ] > 0.0 ? width[ t ] : interval ) );
+        tier->bucket = calloc( tier->size, sizeof *tier->bucket );
+        if (tier->bucket == NULL) {
+            history_destroy( h );
+            return NULL;
+        }
+    }
+    return h;
+}
+
+void history_destroy( struct bvt_history *h )
+{
+    if (h == NULL) {
+        return;
+    }
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        free( h->tier[ t ].bucket );
+    }
+    free( h );
+}
+
+/*------------------------------------------------------------------*
+ * Adds a sample to every tier
+ *------------------------------------------------------------------*/
+
+static void bucket_add( struct history_bucket *b, const double *v )
+{
+    for (int c = 0; c < HIST_CHANNELS; c++) {
+        if (b->count == 0 || v[ c ] < b->min[ c ]) {
+            b->min[ c ] = v[ c ];
+        }
+        if (b->count == 0 || v[ c ] > b->max[ c ]) {
+            b->max[ c ] = v[ c ];
+        }
+        b->sum[ c ] = ( b->count ? b->sum[ c ] : 0.0 ) + v[ c ];
+    }
+    b->count++;
+}
+
+static void tier_commit( struct history_tier *tier )
+{
+    tier->bucket[ tier->head % tier->size ] = tier->open;
+    tier->head++;
+    tier->open.count = 0;
+}
+
+void history_add( struct bvt_history *h, const struct bvt_state *st )
+{
+    double v[ HIST_CHANNELS ];
+
+    v[ HIST_TEMPERATURE ] = st->temperature;
+    v[ HIST_SETPOINT ] = st->working_setpoint;
+    v[ HIST_HEATER_POWER ] = st->heater_power;
+    v[ HIST_LN2_HEATER_POWER ] = st->ln2_heater_power;
+    v[ HIST_FLOW_RATE ] = st->flow_rate;
+
+    for (int t = 0; t < HISTORY_TIERS; t++) {
+        struct history_tier *tier = &h->tier[ t ];
+        double start = tier->width > 0.0
+                       ? floor( st->wall_time / tier->width ) * tier->width
+                       : st->wall_time;
+
+        if (tier->open.count && tier->open.start != start) {
+            tier_commit( tier );
+        }
+        if (tier->open.count == 0) {
+            tier->open.start = start;
+        }
+        bucket_add( &tier->open, v );
+        if (tier->width == 0.0) {
+            tier_commit( tier );
+        }
+    }
+}
+
+/*------------------------------------------------------------------*
+ * Calls cb for every bucket starting at or after 'from' (wall time),
+ * oldest first, from the finest tier that reaches back that far (or
+ * else the coarsest one). Returns the tier used.
+ *------------------------------------------------------------------*/
+
+int history_query( const struct bvt_history *h, double from,
+                   history_callback cb, void *arg )
+{
+    const struct history_tier *tier = NULL;
+    uint64_t first, lo, hi;
+    int t;
+
+    for (t = 0; t < HISTORY_TIERS - 1; t++) {
+        tier = &h->tier[ t ];
+        first = tier->head > tier->size ? tier->head - tier->size : 0;
+
+        /* Everything since the start is still there, or the oldest
+           bucket kept is old enough */
+
+        if (first == 0 || tier->bucket[ first % tier->size ].start <= from) {
+            break;
+        }
+    }
+    tier = &h->tier[ t ];
+    lo = tier->head > tier->size ? tier->head - tier->size : 0;
+    hi = tier->head;
+
+    /* Skip what is too old by bisection, the buckets being in time order */
+
+    while (lo < hi) {
+        uint64_t mid = lo + ( hi - lo ) / 2;
+
+        if (tier->bucket[ mid % tier->size ].start + tier->width < from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for ( ; lo < tier->head; lo++) {
+        cb( arg, &tier->bucket[ lo % tier->size ] );
+    }
+    if (tier->open.count) {
+        cb( arg, &tier->open );
+    }
+    return t;
+}
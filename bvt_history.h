@@ -0,0 +1,65 @@
+/* In-memory history of the daemon's samples, at several resolutions.
+ *
+ * Every sample goes into three preallocated rings: the last hour at the
+ * full sampling rate, the last day as 10 s aggregates and the last
+ * month as 1 min aggregates, each aggregate holding min / max / mean
+ * per channel. Aggregate buckets are aligned to the wall clock. A trend
+ * query is answered from the finest tier that still reaches back far
+ * enough, without touching the disk or the device.
+ */
+#pragma once
+#if ! defined BVT_HISTORY_HEADER
+#define BVT_HISTORY_HEADER
+
+#include <stdint.h>
+#include "bvt_shm.h"
+
+#define HISTORY_TIERS  3
+
+/* Span kept (s) and bucket width (s, 0 for every sample) of the tiers */
+
+#define HISTORY_RAW_SPAN       3600.0
+#define HISTORY_MEDIUM_SPAN   86400.0
+#define HISTORY_MEDIUM_WIDTH     10.0
+#define HISTORY_LONG_SPAN   2678400.0   /* 31 days */
+#define HISTORY_LONG_WIDTH       60.0
+
+enum history_channel {
+    HIST_TEMPERATURE,
+    HIST_SETPOINT,
+    HIST_HEATER_POWER,
+    HIST_LN2_HEATER_POWER,
+    HIST_FLOW_RATE,
+    HIST_CHANNELS
+};
+
+struct history_bucket {
+    double start;                   /* wall time of the first sample */
+    uint32_t count;
+    float min[ HIST_CHANNELS ];
+    float max[ HIST_CHANNELS ];
+    double sum[ HIST_CHANNELS ];
+};
+
+struct history_tier {
+    double width;
+    unsigned int size;
+    uint64_t head;                  /* buckets completed so far */
+    struct history_bucket open;     /* bucket being filled, count 0 if none */
+    struct history_bucket *bucket;
+};
+
+struct bvt_history {
+    struct history_tier tier[ HISTORY_TIERS ];
+};
+
+typedef void ( *history_callback )( void *arg, const struct history_bucket *b );
+
+struct bvt_history * history_create( double interval );
+void history_destroy( struct bvt_history *h );
+void history_add( struct bvt_history *h, const struct bvt_state *st );
+int history_query( const struct bvt_history *h, double from,
+                   history_callback cb, void *arg );
+int history_channel( const char *name );
+
+#endif
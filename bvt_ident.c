@@ -0,0 +1,689 @@
+/* bvt-ident: thermal models and PID settings from archived runs
+ *
+ * The temperature response to the heater power is fitted, by least
+ * squares, with a first order plus dead time model (FOPDT)
+ *
+ *   y[k+1] = a y[k] + b u[k-d] + c
+ *
+ * and a second order one, y[k+1] = a1 y[k] + a2 y[k-1] + b u[k-d] + c,
+ * for every dead time d up to IDENT_DELAYS - 1 samples, the best d
+ * being kept. Samples are grouped by gas flow rate (as one of the
+ * entries of the device's flow rate table) and by temperature band, as
+ * the dynamics change with both, and one model is fitted per group from
+ * all the archives given, which should be runs of one device with the
+ * same sampling interval.
+ *
+ * Each chunk is reduced to the normal equations of the fits by a pool
+ * of threads, so the work is spread over all the chunks of all runs;
+ * the equations just add up. For each model the PID settings of
+ * Skogestad's SIMC rules are printed, with the settling time they
+ * should give:
+ *
+ *   ***MODL: <flow l/h> <from K> <to K> <samples> <gain K/%> <tau s>
+ *            <dead time s> <tau2 s, 0 for first order> <rms error K>
+ *   ***PIDS: <flow l/h> <from K> <to K> <XP> <TI> <TD> <settling s>
+ *
+ * The proportional band is 100 / gain, i.e. in K for a gain in %/K, as
+ * for --autotune.
+ *
+ * With --search, a few tens of thousands of PID settings around these
+ * (cutbacks included) are also tried on the model in a simulation of
+ * the closed loop (see bvt_pidsim.h), and the best are printed, the
+ * winner also as options for BVTserialInterfacer:
+ *
+ *   ***RANK: <flow> <from> <to> <rank> <XP> <TI> <TD> <HB> <LB>
+ *            <settling s> <overshoot K> <heater energy, s at full power>
+ *   ***OPTS: --set-proportional-band=... --set-integral-time=... ...
+ *
+ * --model takes a model by hand instead of fitting one, and then the
+ * flow rate and band are printed as dashes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bvt_archive.h"
+#include "convenient_wrapper_functions.h"
+#include "bvt_pidsim.h"
+
+bool verboseFlag = false;
+
+#define IDENT_DELAYS   32           /* dead times tried, in samples */
+#define IDENT_MIN_FIT  100          /* samples needed for a fit */
+#define IDENT_VARS     5            /* y[k], y[k-1], u[k-d], 1, y[k+1] */
+#define IDENT_GRAM     ( IDENT_VARS * ( IDENT_VARS + 1 ) / 2 )
+
+enum { V_Y0, V_Y1, V_U, V_ONE, V_Y };
+
+/* Normal equations of one flow rate and temperature band, as the upper
+   triangle of the Gram matrix of the variables, per dead time */
+
+struct model {
+    int flow, band;
+    uint64_t n[ IDENT_DELAYS ];
+    double g[ IDENT_DELAYS ][ IDENT_GRAM ];
+};
+
+struct models {
+    struct model *model;
+    int count;
+};
+
+/* One chunk of one file */
+
+struct unit {
+    const struct archive_map *map;
+    const struct archive_index *ix;
+    double interval;                /* nominal sampling interval of the file */
+    bool bad;
+};
+
+struct ident {
+    double from, to;
+    double band;                    /* K */
+    double closed_loop;             /* SIMC tau_c, 0 for the default */
+    bool search;                    /* --search: also simulate the loop */
+    double step;                    /* K, setpoint step simulated */
+    double max_overshoot;           /* K, 0 for 2 % of the step */
+    int top;                        /* ranks printed */
+    long threads;
+
+    struct unit *unit;
+    uint32_t units;
+    uint32_t next;                  /* next unit to take, atomically */
+};
+
+struct worker_arg {
+    struct ident *q;
+    struct models m;
+};
+
+static int gram_index( int i, int j )
+{
+    return i * IDENT_VARS - i * ( i - 1 ) / 2 + ( j - i );
+}
+
+static struct model * model_find( struct models *m, int flow, int band )
+{
+    struct model *grown;
+
+    for (int i = m->count - 1; i >= 0; i--) {
+        if (m->model[ i ].flow == flow && m->model[ i ].band == band) {
+            return &m->model[ i ];
+        }
+    }
+    grown = realloc( m->model, ( m->count + 1 ) * sizeof *m->model );
+    if (grown == NULL) {
+        return NULL;
+    }
+    m->model = grown;
+    memset( &m->model[ m->count ], 0, sizeof *m->model );
+    m->model[ m->count ].flow = flow;
+    m->model[ m->count ].band = band;
+    return &m->model[ m->count++ ];
+}
+
+/*------------------------------------------------------------------*
+ * Decodes one chunk and adds its samples to the equations. A sample
+ * is used only with an unbroken run of samples at the nominal interval
+ * and the same flow rate behind it, reaching back over the dead time;
+ * runs do not carry over from one chunk to the next.
+ *------------------------------------------------------------------*/
+
+static void unit_run( struct ident *q, struct models *m, struct unit *u )
+{
+    const struct archive_map *map = u->map;
+    const unsigned char *p = map->base + u->ix->offset;
+    struct archive_chunk c;
+    uint32_t n = u->ix->count, run = 0;
+    double *t, *y, *op, *flow;
+    int *fi;
+
+    memcpy( &c, p, sizeof c );
+    t = malloc( n * sizeof *t );
+    y = malloc( n * sizeof *y );
+    op = malloc( n * sizeof *op );
+    flow = malloc( n * sizeof *flow );
+    fi = malloc( n * sizeof *fi );
+    if (   t == NULL || y == NULL || op == NULL || flow == NULL || fi == NULL
+        || c.count != n
+        || ! archive_column( &c, p + sizeof c, map->chunk_samples, COL_TIME, t )
+        || ! archive_column( &c, p + sizeof c, map->chunk_samples, COL_TEMPERATURE, y )
+        || ! archive_column( &c, p + sizeof c, map->chunk_samples, COL_HEATER_POWER, op )
+        || ! archive_column( &c, p + sizeof c, map->chunk_samples, COL_FLOW_RATE, flow )) {
+        u->bad = true;
+        goto done;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        fi[ i ] = flow_rate_index( flow[ i ] );
+    }
+
+    for (uint32_t i = 1; i < n; i++) {
+        uint32_t k = i - 1;
+        struct model *md;
+        double centre, v[ IDENT_VARS ];
+
+        if (   fabs( t[ i ] - t[ k ] - u->interval ) > 0.5 * u->interval
+            || fi[ i ] < 0 || fi[ i ] != fi[ k ]
+            || t[ k ] < q->from || t[ i ] > q->to
+            || ! isfinite( y[ i ] ) || ! isfinite( op[ i ] )) {
+            run = 0;
+            continue;
+        }
+        if (++run < 2) {
+            continue;
+        }
+
+        /* Temperatures relative to the middle of the band, powers to
+           50 %, to keep the equations well conditioned */
+
+        md = model_find( m, fi[ k ], floor( y[ k ] / q->band ) );
+        if (md == NULL) {
+            u->bad = true;
+            goto done;
+        }
+        centre = ( md->band + 0.5 ) * q->band;
+        v[ V_Y0 ] = y[ k ] - centre;
+        v[ V_Y1 ] = y[ k - 1 ] - centre;
+        v[ V_ONE ] = 1.0;
+        v[ V_Y ] = y[ i ] - centre;
+        for (uint32_t d = 0; d < IDENT_DELAYS && d < run - 1; d++) {
+            double *g = md->g[ d ];
+
+            v[ V_U ] = op[ k - d ] - 50.0;
+            for (int a = 0, e = 0; a < IDENT_VARS; a++) {
+                for (int b = a; b < IDENT_VARS; b++) {
+                    g[ e++ ] += v[ a ] * v[ b ];
+                }
+            }
+            md->n[ d ]++;
+        }
+    }
+
+done:
+    free( t );
+    free( y );
+    free( op );
+    free( flow );
+    free( fi );
+}
+
+static void * worker( void *arg )
+{
+    struct worker_arg *w = arg;
+    struct ident *q = w->q;
+    uint32_t i;
+
+    while (( i = __atomic_fetch_add( &q->next, 1, __ATOMIC_RELAXED ) ) < q->units) {
+        unit_run( q, &w->m, &q->unit[ i ] );
+    }
+    return NULL;
+}
+
+/*------------------------------------------------------------------*
+ * Least squares fit of y[k+1] on the variables in `vars', by Gaussian
+ * elimination on the normal equations. Returns the residual sum of
+ * squares, or a negative number if the equations are singular.
+ *------------------------------------------------------------------*/
+
+static double fit( const double *g, const int *vars, int p, double *theta )
+{
+    double a[ IDENT_VARS ][ IDENT_VARS + 1 ], sse;
+
+    for (int i = 0; i < p; i++) {
+        for (int j = 0; j < p; j++) {
+            int r = vars[ i ] < vars[ j ] ? vars[ i ] : vars[ j ];
+            int s = vars[ i ] < vars[ j ] ? vars[ j ] : vars[ i ];
+
+            a[ i ][ j ] = g[ gram_index( r, s ) ];
+        }
+        a[ i ][ p ] = g[ gram_index( vars[ i ], V_Y ) ];
+    }
+    for (int c = 0; c < p; c++) {
+        int pivot = c;
+
+        for (int r = c + 1; r < p; r++) {
+            if (fabs( a[ r ][ c ] ) > fabs( a[ pivot ][ c ] )) {
+                pivot = r;
+            }
+        }
+        if (fabs( a[ pivot ][ c ] ) < 1e-9 * ( 1.0 + fabs( a[ c ][ c ] ) )) {
+            return -1.0;
+        }
+        for (int j = 0; j <= p; j++) {
+            double swap = a[ c ][ j ];
+
+            a[ c ][ j ] = a[ pivot ][ j ];
+            a[ pivot ][ j ] = swap;
+        }
+        for (int r = c + 1; r < p; r++) {
+            double f = a[ r ][ c ] / a[ c ][ c ];
+
+            for (int j = c; j <= p; j++) {
+                a[ r ][ j ] -= f * a[ c ][ j ];
+            }
+        }
+    }
+    for (int c = p - 1; c >= 0; c--) {
+        theta[ c ] = a[ c ][ p ];
+        for (int j = c + 1; j < p; j++) {
+            theta[ c ] -= a[ c ][ j ] * theta[ j ];
+        }
+        theta[ c ] /= a[ c ][ c ];
+    }
+
+    sse = g[ gram_index( V_Y, V_Y ) ];
+    for (int i = 0; i < p; i++) {
+        sse -= theta[ i ] * g[ gram_index( vars[ i ], V_Y ) ];
+    }
+    return sse > 0.0 ? sse : 0.0;
+}
+
+/*------------------------------------------------------------------*
+ * Prints the SIMC settings for a model and, with --search, the best
+ * ones found by simulating the loop. `label' goes in front of the
+ * numbers: flow rate and band, or dashes for a model given by hand.
+ *------------------------------------------------------------------*/
+
+static void tune_print( const struct ident *q, const char *label, const struct pid_plant *p )
+{
+    struct pid_candidate *c;
+    double tau_c, kc, ti, td, f, xp;
+    int n;
+
+    /* SIMC, in series form, then converted to the ideal form */
+
+    tau_c = q->closed_loop > 0.0 ? q->closed_loop : fmax( p->dead, 0.1 * p->tau );
+    kc = p->tau / ( p->gain * ( tau_c + p->dead ) );
+    ti = fmin( p->tau, 4.0 * ( tau_c + p->dead ) );
+    td = p->tau2;
+    f = 1.0 + td / ti;
+    xp = fmin( fmax( 100.0 / ( kc * f ), 0.1 ), MAX_PROPORTIONAL_BAND );
+    ti = fmin( ti * f, MAX_INTEGRAL_TIME );
+    td = fmin( td / f, MAX_DERIVATIVE_TIME );
+    printf("***PIDS: %s %.2f %.2f %.2f %.1f\n", label, xp, ti, td, p->dead + 4.0 * tau_c);
+
+    if (! q->search) {
+        return;
+    }
+    n = pid_search( p, q->step, q->max_overshoot > 0.0 ? q->max_overshoot : 0.02 * q->step,
+                    xp, ti, q->threads, &c );
+    if (n < 0) {
+        fprintf(stderr,"FATAL: Out of memory for the PID search\n");
+        return;
+    }
+    if (n == 0) {
+        fprintf(stderr,"WARNING: No PID settings tried at %s settle without overshooting\n", label);
+    }
+    for (int i = 0; i < n && i < q->top; i++) {
+        printf("***RANK: %s %d %.2f %.2f %.2f %.2f %.2f %.1f %.3f %.1f\n", label, i + 1,
+                c[ i ].xp, c[ i ].ti, c[ i ].td, c[ i ].hb, c[ i ].lb,
+                c[ i ].settling, c[ i ].overshoot, c[ i ].energy);
+    }
+    if (n > 0) {
+        printf("***OPTS: --set-proportional-band=%.2f --set-integral-time=%.2f "
+                "--set-differential-time=%.2f --set-high-cutback=%.2f --set-low-cutback=%.2f\n",
+                c[ 0 ].xp, c[ 0 ].ti, c[ 0 ].td, c[ 0 ].hb, c[ 0 ].lb);
+    }
+    free( c );
+}
+
+/*------------------------------------------------------------------*
+ * Fits both models at every dead time, converts the best ones to
+ * continuous time and prints them with their PID settings. Fits are
+ * compared by their mean squared residual, as longer dead times leave
+ * fewer samples to fit. The second order model is used only if it
+ * explains clearly more than the first.
+ *------------------------------------------------------------------*/
+
+static void model_print( const struct ident *q, const struct model *md, double interval )
+{
+    static const int first[ ] = { V_Y0, V_U, V_ONE };
+    static const int second[ ] = { V_Y0, V_Y1, V_U, V_ONE };
+    struct pid_plant p = { 0.0, 0.0, 0.0, 0.0, 50.0, 100.0 };
+    double best1 = INFINITY, best2 = INFINITY, theta[ 4 ], n1 = 0.0, n2 = 0.0;
+    double lo = md->band * q->band, hi = lo + q->band;
+    double rate = translate_flow_rate( md->flow );
+    char label[ 64 ];
+
+    /* The power holding the middle of the band follows from the
+       constant term, as temperatures are relative to it */
+
+    for (int d = 0; d < IDENT_DELAYS; d++) {
+        double sse;
+
+        if (md->n[ d ] < IDENT_MIN_FIT) {
+            continue;
+        }
+        sse = fit( md->g[ d ], first, 3, theta );
+        if (   sse >= 0.0 && sse / md->n[ d ] < best1
+            && theta[ 0 ] > 0.0 && theta[ 0 ] < 1.0 && theta[ 1 ] > 0.0) {
+            best1 = sse / md->n[ d ];
+            n1 = md->n[ d ];
+            p.tau = -interval / log( theta[ 0 ] );
+            p.gain = theta[ 1 ] / ( 1.0 - theta[ 0 ] );
+            p.dead = d * interval;
+            p.power = 50.0 - theta[ 2 ] / theta[ 1 ];
+        }
+    }
+    if (isinf( best1 )) {
+        fprintf(stderr,"WARNING: No first order model fits at %.0f l/h, %.0f-%.0f K "
+                "(too few samples or too little change in heater power)\n", rate, lo, hi);
+        return;
+    }
+
+    for (int d = 0; d < IDENT_DELAYS; d++) {
+        double sse, disc, p1, p2;
+
+        if (md->n[ d ] < IDENT_MIN_FIT) {
+            continue;
+        }
+        sse = fit( md->g[ d ], second, 4, theta );
+        disc = theta[ 0 ] * theta[ 0 ] + 4.0 * theta[ 1 ];
+        if (sse < 0.0 || sse / md->n[ d ] >= best2 || disc < 0.0 || theta[ 2 ] <= 0.0) {
+            continue;
+        }
+        p1 = ( theta[ 0 ] + sqrt( disc ) ) / 2.0;
+        p2 = ( theta[ 0 ] - sqrt( disc ) ) / 2.0;
+        if (p1 < 1.0 && p2 > 0.0 && sse / md->n[ d ] < 0.9 * best1) {
+            best2 = sse / md->n[ d ];
+            n2 = md->n[ d ];
+            p.tau = -interval / log( p1 );
+            p.tau2 = -interval / log( p2 );
+            p.gain = theta[ 2 ] / ( 1.0 - theta[ 0 ] - theta[ 1 ] );
+            p.dead = d * interval;
+            p.power = 50.0 - theta[ 3 ] / theta[ 2 ];
+        }
+    }
+    p.power = fmin( fmax( p.power, 0.0 ), p.limit );
+
+    snprintf( label, sizeof label, "%.1f %.1f %.1f", rate, lo, hi );
+    printf("***MODL: %s %.0f %.6g %.6g %.6g %.6g %.6g\n", label, isinf( best2 ) ? n1 : n2,
+            p.gain, p.tau, p.dead, p.tau2, sqrt( isinf( best2 ) ? best1 : best2 ));
+    tune_print( q, label, &p );
+}
+
+static int model_compare( const void *a, const void *b )
+{
+    const struct model *x = a, *y = b;
+
+    return x->flow != y->flow ? x->flow - y->flow : x->band - y->band;
+}
+
+/* Median time between the samples of a file's first chunk */
+
+static int double_compare( const void *a, const void *b )
+{
+    const double *x = a, *y = b;
+
+    return *x < *y ? -1 : *x > *y;
+}
+
+static double file_interval( const struct archive_map *m )
+{
+    const unsigned char *p;
+    struct archive_chunk c;
+    double *t, interval = 0.0;
+
+    if (m->chunks == 0 || m->index[ 0 ].count < 2) {
+        return 0.0;
+    }
+    p = m->base + m->index[ 0 ].offset;
+    memcpy( &c, p, sizeof c );
+    t = malloc( c.count * sizeof *t );
+    if (t && archive_column( &c, p + sizeof c, m->chunk_samples, COL_TIME, t )) {
+        for (uint32_t i = 0; i + 1 < c.count; i++) {
+            t[ i ] = t[ i + 1 ] - t[ i ];
+        }
+        qsort( t, c.count - 1, sizeof *t, double_compare );
+        interval = t[ ( c.count - 1 ) / 2 ];
+    }
+    free( t );
+    return interval;
+}
+
+static int usage( const char *prog )
+{
+    fprintf(stderr,
+            "Usage: %s [OPTIONS] ARCHIVE...\n"
+            "       %s [OPTIONS] --model=GAIN,TAU,DEAD[,TAU2[,POWER]]\n"
+            "  -f, --from=TIME          Start of the range (unix time)\n"
+            "  -t, --to=TIME            End of the range (unix time)\n"
+            "  -b, --band=KELVIN        Width of the temperature bands (default 50)\n"
+            "  -c, --closed-loop=SECONDS  Closed-loop time constant to tune for\n"
+            "                             (default: the dead time, but at least a\n"
+            "                             tenth of the time constant)\n"
+            "  -j, --threads=N          Worker threads (default: one per CPU)\n"
+            "  -s, --search             Also search for the best PID settings by\n"
+            "                             simulating the loop on each model\n"
+            "  -S, --step=KELVIN        Setpoint step to simulate (default 10)\n"
+            "  -o, --max-overshoot=KELVIN  Overshoot allowed (default 2%% of the step)\n"
+            "  -n, --top=N              Print the N best settings (default 1)\n"
+            "  -m, --model=GAIN,TAU,DEAD[,TAU2[,POWER]]\n"
+            "                           Use this model (K/%%, s, s, s, %% holding\n"
+            "                             the temperature) instead of archives\n",
+            prog, prog);
+    return 1;
+}
+
+int main( int argc, char **argv )
+{
+    static const struct option options[] = {
+        { "from",        1, NULL, 'f' },
+        { "to",          1, NULL, 't' },
+        { "band",        1, NULL, 'b' },
+        { "closed-loop", 1, NULL, 'c' },
+        { "threads",     1, NULL, 'j' },
+        { "search",      0, NULL, 's' },
+        { "step",        1, NULL, 'S' },
+        { "max-overshoot", 1, NULL, 'o' },
+        { "top",         1, NULL, 'n' },
+        { "model",       1, NULL, 'm' },
+        { "help",        0, NULL, 'h' },
+        { NULL,          0, NULL, 0 }
+    };
+    struct ident q;
+    struct archive_map *maps;
+    double *interval, ref = 0.0;
+    struct worker_arg *w;
+    struct models all = { NULL, 0 };
+    struct pid_plant given = { 0.0, 0.0, 0.0, 0.0, 50.0, 100.0 };
+    bool model_given = false;
+    pthread_t *threads;
+    long nthreads = sysconf( _SC_NPROCESSORS_ONLN );
+    int files, opt, status = 0;
+
+    memset( &q, 0, sizeof q );
+    q.from = -INFINITY;
+    q.to = INFINITY;
+    q.band = 50.0;
+    q.step = 10.0;
+    q.top = 1;
+    while (( opt = getopt_long( argc, argv, "f:t:b:c:j:sS:o:n:m:h", options, NULL ) ) != -1) {
+        switch ( opt ) {
+            case 'f' :
+                q.from = atof( optarg );
+                break;
+            case 't' :
+                q.to = atof( optarg );
+                break;
+            case 'b' :
+                q.band = atof( optarg );
+                if (q.band <= 0.0) {
+                    fprintf(stderr,"FATAL: band width must be positive\n");
+                    return 1;
+                }
+                break;
+            case 'c' :
+                q.closed_loop = atof( optarg );
+                break;
+            case 'j' :
+                nthreads = atol( optarg );
+                break;
+            case 's' :
+                q.search = true;
+                break;
+            case 'S' :
+                q.step = atof( optarg );
+                break;
+            case 'o' :
+                q.max_overshoot = atof( optarg );
+                break;
+            case 'n' :
+                q.top = atoi( optarg );
+                break;
+            case 'm' :
+                if (   sscanf( optarg, "%lf,%lf,%lf,%lf,%lf", &given.gain, &given.tau, &given.dead,
+                               &given.tau2, &given.power ) < 3
+                    || given.gain <= 0.0 || given.tau <= 0.0 || given.dead < 0.0 || given.tau2 < 0.0
+                    || given.power < 0.0 || given.power > given.limit) {
+                    fprintf(stderr,"FATAL: --model needs GAIN,TAU,DEAD[,TAU2[,POWER]], all positive\n");
+                    return 1;
+                }
+                model_given = true;
+                break;
+            default :
+                return usage( argv[ 0 ] );
+        }
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    if (q.step <= 0.0) {
+        fprintf(stderr,"FATAL: step must be positive\n");
+        return 1;
+    }
+    q.threads = nthreads;
+    if (model_given) {
+        tune_print( &q, "- - -", &given );
+        return 0;
+    }
+    files = argc - optind;
+    if (files <= 0) {
+        return usage( argv[ 0 ] );
+    }
+
+    /* Map every file sampled at the same interval as the first one that
+       could be read, and make a unit of work of every chunk in range */
+
+    maps = calloc( files, sizeof *maps );
+    interval = calloc( files, sizeof *interval );
+    if (maps == NULL || interval == NULL) {
+        return 1;
+    }
+    for (int f = 0; f < files; f++) {
+        if (! archive_map( argv[ optind + f ], &maps[ f ] )) {
+            status = 1;
+            continue;
+        }
+        interval[ f ] = file_interval( &maps[ f ] );
+        if (! ( interval[ f ] > 0.0 )) {
+            fprintf(stderr,"WARNING: skipping %s, too few samples to tell how often it was sampled\n",
+                    argv[ optind + f ]);
+            archive_unmap( &maps[ f ] );
+            status = 1;
+            continue;
+        }
+        if (ref == 0.0) {
+            ref = interval[ f ];
+        }
+        if (fabs( interval[ f ] - ref ) > 0.05 * ref) {
+            fprintf(stderr,"WARNING: skipping %s, sampled every %g s rather than %g s\n",
+                    argv[ optind + f ], interval[ f ], ref);
+            archive_unmap( &maps[ f ] );
+            status = 1;
+            continue;
+        }
+        for (uint32_t i = archive_find( &maps[ f ], q.from );
+             i < maps[ f ].chunks && maps[ f ].index[ i ].t_first <= q.to; i++) {
+            q.units++;
+        }
+    }
+    q.unit = calloc( q.units ? q.units : 1, sizeof *q.unit );
+    if (q.unit == NULL) {
+        return 1;
+    }
+    q.units = 0;
+    for (int f = 0; f < files; f++) {
+        for (uint32_t i = archive_find( &maps[ f ], q.from );
+             maps[ f ].base && i < maps[ f ].chunks && maps[ f ].index[ i ].t_first <= q.to; i++) {
+            q.unit[ q.units ].map = &maps[ f ];
+            q.unit[ q.units ].ix = &maps[ f ].index[ i ];
+            q.unit[ q.units ].interval = interval[ f ];
+            q.units++;
+        }
+    }
+
+    if (nthreads > q.units) {
+        nthreads = q.units ? q.units : 1;
+    }
+    threads = calloc( nthreads, sizeof *threads );
+    w = calloc( nthreads, sizeof *w );
+    if (threads == NULL || w == NULL) {
+        return 1;
+    }
+
+    /* This thread is one of the workers */
+
+    for (long i = 0; i < nthreads; i++) {
+        w[ i ].q = &q;
+    }
+    for (long i = 1; i < nthreads; i++) {
+        if (pthread_create( &threads[ i ], NULL, worker, &w[ i ] )) {
+            nthreads = i;
+            break;
+        }
+    }
+    worker( &w[ 0 ] );
+    for (long i = 1; i < nthreads; i++) {
+        pthread_join( threads[ i ], NULL );
+    }
+
+    for (uint32_t u = 0; u < q.units; u++) {
+        if (q.unit[ u ].bad) {
+            fprintf(stderr,"WARNING: skipping a damaged chunk at offset %llu\n",
+                    (unsigned long long) q.unit[ u ].ix->offset);
+            status = 1;
+        }
+    }
+
+    /* The equations of all workers add up */
+
+    for (long i = 0; i < nthreads; i++) {
+        for (int k = 0; k < w[ i ].m.count; k++) {
+            const struct model *from = &w[ i ].m.model[ k ];
+            struct model *to = model_find( &all, from->flow, from->band );
+
+            if (to == NULL) {
+                return 1;
+            }
+            for (int d = 0; d < IDENT_DELAYS; d++) {
+                to->n[ d ] += from->n[ d ];
+                for (int e = 0; e < IDENT_GRAM; e++) {
+                    to->g[ d ][ e ] += from->g[ d ][ e ];
+                }
+            }
+        }
+        free( w[ i ].m.model );
+    }
+    qsort( all.model, all.count, sizeof *all.model, model_compare );
+    for (int k = 0; k < all.count; k++) {
+        model_print( &q, &all.model[ k ], ref );
+    }
+
+    for (int f = 0; f < files; f++) {
+        archive_unmap( &maps[ f ] );
+    }
+    free( all.model );
+    free( w );
+    free( threads );
+    free( q.unit );
+    free( interval );
+    free( maps );
+    return status;
+}
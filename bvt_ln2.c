@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "bvt_ln2.h"
+extern bool verboseFlag;
+
+static const char * const state_names[ ] = { "IDLE", "CONTROLLING", "HOLDING", "STOPPED" };
+static const char * const tank_names[ ] = { "OK", "REFILL", "EMPTY" };
+
+struct bvt_ln2 * ln2_create( double target, double integral_time, double limit )
+{
+    struct bvt_ln2 *n;
+
+    if (target <= 0.0 || target >= 100.0 || integral_time <= 0.0 || limit <= 0.0 || limit > 100.0) {
+        fprintf(stderr,"FATAL: LN2 control needs a heater target and power limit of 0-100 %% "
+                "and a positive integral time\n");
+        return NULL;
+    }
+    n = calloc( 1, sizeof *n );
+    if (n == NULL) {
+        fprintf(stderr,"FATAL: unable to allocate the LN2 controller\n");
+        return NULL;
+    }
+    n->target = target;
+    n->integral_time = integral_time;
+    n->limit = limit;
+    n->state = LN2_IDLE;
+    n->tank = LN2_OK;
+    return n;
+}
+
+/* The evaporator power to have now */
+
+static double ln2_wanted( const struct bvt_ln2 * n )
+{
+    return n->tank == LN2_TANK_EMPTY ? 0.0 : round( n->power * 100.0 ) / 100.0;
+}
+
+/*------------------------------------------------------------------*
+ * Looks at a new sample: follows the tank status, and moves the
+ * evaporator power by the integral of how far the main heater power is
+ * from the target
+ *------------------------------------------------------------------*/
+
+void ln2_update( struct bvt_ln2 * n, const struct bvt_state * st )
+{
+    int tank = bvt3000_ln2_tank_status( st->is );
+    double dt = n->last_time > 0.0 ? st->mono_time - n->last_time : 0.0;
+    double limit = n->limit;
+
+    /* Unread values come back as 0, which would look like a heater with
+       nothing to do */
+
+    if (! ( st->temperature > 0.0 )) {
+        ln2_miss( n );
+        return;
+    }
+    n->last_time = st->mono_time;
+    if (! n->started) {
+        n->original = n->written = st->ln2_heater_power;
+        n->power = fmin( st->ln2_heater_power, n->limit );
+        n->started = true;
+    }
+
+    if (tank != n->tank) {
+        if (tank == LN2_TANK_EMPTY) {
+            fprintf(stderr,"WARNING: LN2 tank empty, evaporator power at 0 %% until it is refilled\n");
+        } else if (tank == LN2_NEEDS_REFILL) {
+            n->ceiling = n->power;
+            fprintf(stderr,"WARNING: LN2 tank needs refilling, evaporator power held at or below %.2f %%\n",
+                    n->ceiling);
+        } else if (verboseFlag) {
+            printf("LN2 tank refilled, evaporator power back under control\n");
+        }
+        n->tank = tank;
+    }
+    if (tank == LN2_TANK_EMPTY) {
+        n->state = LN2_STOPPED;
+        return;
+    }
+    if (   ! ( st->is & BVT3000_HEATER_ON ) || ! ( st->is & BVT3000_LN2_HEATER_ON )
+        || ( st->sw & SENSOR_BREAK_FLAG )) {
+        n->state = LN2_IDLE;
+        return;
+    }
+
+    /* Heater working harder than the target means too much cooling */
+
+    if (tank == LN2_NEEDS_REFILL && n->ceiling < limit) {
+        limit = n->ceiling;
+    }
+    n->power -= ( st->heater_power - n->target ) * dt / n->integral_time;
+    n->power = fmin( fmax( n->power, 0.0 ), limit );
+    n->state = tank == LN2_NEEDS_REFILL ? LN2_HOLDING : LN2_CONTROLLING;
+}
+
+/* A sample the daemon could not take: the power stays, and nothing is
+   integrated over the gap */
+
+void ln2_miss( struct bvt_ln2 * n )
+{
+    n->last_time = 0.0;
+}
+
+bool ln2_due( const struct bvt_ln2 * n )
+{
+    double wanted = ln2_wanted( n );
+
+    return n->started && ( fabs( wanted - n->written ) >= LN2_MIN_CHANGE
+                           || ( wanted == 0.0 && n->written != 0.0 ) );
+}
+
+void ln2_step( struct bvt_ln2 * n, struct sp_port * port_choice )
+{
+    n->written = ln2_wanted( n );
+    bvt3000_set_ln2_heater_power( n->written, port_choice );
+    if (verboseFlag) {
+        printf("LN2 control: evaporator power %.2f %%\n", n->written);
+    }
+}
+
+/*------------------------------------------------------------------*
+ * Puts back the evaporator power found at the first sample, as the
+ * daemon is stopping
+ *------------------------------------------------------------------*/
+
+void ln2_restore( struct bvt_ln2 * n, struct sp_port * port_choice )
+{
+    if (! n->started || n->written == n->original) {
+        return;
+    }
+    bvt3000_set_ln2_heater_power( n->original, port_choice );
+    if (verboseFlag) {
+        printf("LN2 control: evaporator power restored to %.2f %%\n", n->original);
+    }
+}
+
+/* One line on how it is doing, for the TCP status command */
+
+void ln2_describe( const struct bvt_ln2 * n, char * buf, size_t len )
+{
+    snprintf( buf, len, "%s %.2f %s", state_names[ n->state ], n->written, tank_names[ n->tank ] );
+}
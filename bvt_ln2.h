@@ -0,0 +1,64 @@
+/* Coordinated control of the LN2 evaporator and the main heater, run by
+ * the daemon, for work below ambient.
+ *
+ * Below ambient the sample is cooled by nitrogen gas boiled off by the
+ * evaporator heater and warmed back to the setpoint by the main heater.
+ * Any power on both at once is wasted twice: nitrogen boiled off only to
+ * be heated up again. The main loop (the Eurotherm's PID, or --mpc) goes
+ * on holding the setpoint as it is fast, and this slowly moves the
+ * evaporator power so that the main heater ends up working at a small
+ * --ln2-heater-target power: just enough to control in both directions,
+ * on as little nitrogen as will do. If the heater works harder than
+ * that, there is too much cooling and the evaporator power comes down;
+ * if it works less, down to 0, there is too little and it goes up. Only
+ * the heater power is looked at, as it is what the main loop does about
+ * PV. The correction integrates over --ln2-integral-time, which should
+ * be several times slower than the main loop so that the two do not
+ * fight.
+ *
+ * The tank status (see bvt3000_ln2_tank_status()) is a constraint: while
+ * the tank needs refilling the evaporator power is not raised, to make
+ * the nitrogen left last, and with the tank empty it is set to 0 until
+ * the tank is refilled. Nothing changes while the main heater, or the
+ * evaporator heater, is off, on a sensor break, or while samples cannot
+ * be read. The evaporator power is never above --ln2-power-limit, and
+ * is put back as it was when the daemon stops. While this runs it owns
+ * the LN2 heater power.
+ */
+#pragma once
+#if ! defined BVT_LN2_HEADER
+#define BVT_LN2_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "serial_jjm.h"
+#include "bvt_shm.h"
+
+#define LN2_MIN_CHANGE   0.2        /* % of evaporator power worth a write */
+
+enum ln2_state { LN2_IDLE, LN2_CONTROLLING, LN2_HOLDING, LN2_STOPPED };
+
+struct bvt_ln2 {
+    double target;                  /* % main heater power aimed for */
+    double integral_time;           /* s */
+    double limit;                   /* % evaporator power */
+
+    enum ln2_state state;
+    double power;                   /* % evaporator power wanted */
+    double written;                 /* % evaporator power last written */
+    double ceiling;                 /* % not to go above while the tank needs refilling */
+    double last_time;               /* CLOCK_MONOTONIC of the last sample, 0 before the first */
+    int tank;                       /* LN2_OK, LN2_NEEDS_REFILL or LN2_TANK_EMPTY */
+    bool started;                   /* `original' has been sampled */
+    double original;
+};
+
+struct bvt_ln2 * ln2_create( double target, double integral_time, double limit );
+void ln2_update( struct bvt_ln2 * n, const struct bvt_state * st );
+void ln2_miss( struct bvt_ln2 * n );
+bool ln2_due( const struct bvt_ln2 * n );
+void ln2_step( struct bvt_ln2 * n, struct sp_port * port_choice );
+void ln2_restore( struct bvt_ln2 * n, struct sp_port * port_choice );
+void ln2_describe( const struct bvt_ln2 * n, char * buf, size_t len );
+
+#endif
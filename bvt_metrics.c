@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "bvt_metrics.h"
+#include "bvt_server.h"
+extern bool verboseFlag;
+
+struct metrics_client {
+    int fd;                         /* -1 if the slot is free */
+    double since;                   /* when it connected */
+    char in[ METRICS_REQUEST_MAX ];
+    size_t in_len;
+    char *out;                      /* response, NULL until the request is in */
+    size_t out_len, out_off;
+};
+
+struct bvt_metrics {
+    int listen_fd;
+    struct metrics_client client[ METRICS_MAX_CLIENTS ];
+};
+
+/*------------------------------------------------------------------*
+ * Status bits exported individually
+ *------------------------------------------------------------------*/
+
+enum { WORD_IS, WORD_SW, WORD_XS };
+
+static const struct {
+    int word;
+    unsigned int mask;
+    const char *flag;
+} status_bits[ ] = {
+    { WORD_IS, BVT3000_HEATER_ON,            "heater_on" },
+    { WORD_IS, BVT3000_EVAPORATOR_CONNECTED, "evaporator_connected" },
+    { WORD_IS, BVT3000_MISSING_GAS_FLOW,     "missing_gas_flow" },
+    { WORD_IS, BVT3000_HEATER_OVERHEATING,   "heater_overheating" },
+    { WORD_IS, BVT3000_EXCHANGER_CONNECTED,  "exchanger_connected" },
+    { WORD_IS, BVT3000_LN2_REFILL,           "ln2_refill" },
+    { WORD_IS, BVT3000_LN2_EMPTY,            "ln2_empty" },
+    { WORD_IS, BVT3000_LN2_HEATER_ON,        "ln2_heater_on" },
+    { WORD_IS, BVT3000_BVBT3500_PRESENT,     "bvt3500_present" },
+    { WORD_SW, SENSOR_BREAK_FLAG,            "sensor_break" },
+    { WORD_SW, KEYLOCK_FLAG,                 "keylock" },
+    { WORD_SW, ALARM1_STATE_FLAG,            "alarm1" },
+    { WORD_SW, ALARM2_STATE_FLAG,            "alarm2" },
+    { WORD_SW, ALARMS_STATE_FLAG,            "alarms" },
+    { WORD_SW, ACTIVE_SETPOINT_FLAG,         "setpoint2_active" },
+    { WORD_SW, REMOTE_ACTIVE_FLAG,           "remote" },
+    { WORD_SW, MANUAL_MODE_FLAG,             "manual_mode" },
+    { WORD_XS, SELF_TUNE_FLAG,               "self_tune" },
+    { WORD_XS, ADAPTIVE_TUNE_FLAG,           "adaptive_tune" },
+    { WORD_XS, ACTIVE_PID_FLAG,              "pid2_active" },
+};
+
+static const char * const word_names[ ] = { "is", "sw", "xs" };
+
+static double monotonic_now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*------------------------------------------------------------------*
+ * Writes the exposition. Everything comes from the last sample and the
+ * link counters already in memory.
+ *------------------------------------------------------------------*/
+
+static void metrics_gauge( FILE *f, const char *name, const char *help, double value )
+{
+    fprintf( f, "# HELP %s %s\n# TYPE %s gauge\n%s %.10g\n", name, help, name, name, value );
+}
+
+static void metrics_counter( FILE *f, const char *name, const char *help, unsigned long value )
+{
+    fprintf( f, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", name, help, name, name, value );
+}
+
+static void metrics_write( FILE *f, const struct bvt_state *st )
+{
+    const struct bvt3000_link_stats *ls = bvt3000_get_link_stats( );
+    unsigned int words[ 3 ];
+    unsigned long cumulative = 0;
+
+    metrics_counter( f, "bvt_samples_total", "Samples taken by the daemon", st->seq );
+
+    if (st->seq != 0) {
+        words[ WORD_IS ] = st->is;
+        words[ WORD_SW ] = st->sw;
+        words[ WORD_XS ] = st->xs;
+
+        metrics_gauge( f, "bvt_sample_timestamp_seconds", "Wall clock time of the last sample", st->wall_time );
+        metrics_gauge( f, "bvt_sample_age_seconds", "Time since the last sample",
+                       monotonic_now( ) - st->mono_time );
+        metrics_gauge( f, "bvt_temperature_kelvin", "Measured temperature (PV)", st->temperature );
+
+        fprintf( f, "# HELP bvt_setpoint_kelvin Temperature setpoints\n"
+                    "# TYPE bvt_setpoint_kelvin gauge\n"
+                    "bvt_setpoint_kelvin{setpoint=\"working\"} %.10g\n"
+                    "bvt_setpoint_kelvin{setpoint=\"1\"} %.10g\n"
+                    "bvt_setpoint_kelvin{setpoint=\"2\"} %.10g\n",
+                 st->working_setpoint, st->setpoint1, st->setpoint2 );
+
+        metrics_gauge( f, "bvt_heater_power_percent", "Heater output power (OP)", st->heater_power );
+        metrics_gauge( f, "bvt_ln2_heater_power_percent", "LN2 evaporator heater power", st->ln2_heater_power );
+        metrics_gauge( f, "bvt_gas_flow_litres_per_hour", "Gas flow rate", st->flow_rate );
+        metrics_gauge( f, "bvt_gas_flow_index", "Raw gas flow valve setting (AF)", st->flow_index );
+
+        fprintf( f, "# HELP bvt_status_word Raw status words\n# TYPE bvt_status_word gauge\n" );
+        for (int i = 0; i < 3; i++) {
+            fprintf( f, "bvt_status_word{word=\"%s\"} %u\n", word_names[ i ], words[ i ] );
+        }
+        fprintf( f, "# HELP bvt_status_bit Decoded status bits\n# TYPE bvt_status_bit gauge\n" );
+        for (size_t i = 0; i < sizeof status_bits / sizeof status_bits[ 0 ]; i++) {
+            fprintf( f, "bvt_status_bit{word=\"%s\",flag=\"%s\"} %d\n",
+                     word_names[ status_bits[ i ].word ], status_bits[ i ].flag,
+                     ( words[ status_bits[ i ].word ] & status_bits[ i ].mask ) != 0 );
+        }
+    }
+
+    metrics_counter( f, "bvt_serial_queries_total", "Reads sent to the device", ls->queries );
+    metrics_counter( f, "bvt_serial_coalesced_total", "Reads answered from a recent identical read", ls->coalesced );
+    metrics_counter( f, "bvt_serial_commands_total", "Writes sent to the device", ls->commands );
+    metrics_counter( f, "bvt_serial_timeouts_total", "Replies or ACKs not received in time", ls->timeouts );
+    metrics_counter( f, "bvt_serial_naks_total", "Writes refused with NAK", ls->naks );
+    metrics_counter( f, "bvt_serial_bcc_errors_total", "Replies with a bad block check character", ls->bcc_errors );
+    metrics_counter( f, "bvt_serial_framing_errors_total", "Malformed or unexpected replies", ls->framing_errors );
+    metrics_counter( f, "bvt_serial_failed_reads_total", "Reads that got no usable value", ls->failed_reads );
+
+    fprintf( f, "# HELP bvt_serial_rtt_seconds Round-trip time of serial transactions\n"
+                "# TYPE bvt_serial_rtt_seconds histogram\n" );
+    for (int i = 0; i < RTT_BUCKETS; i++) {
+        cumulative += ls->rtt_bucket[ i ];
+        fprintf( f, "bvt_serial_rtt_seconds_bucket{le=\"%g\"} %lu\n", bvt3000_rtt_bounds[ i ], cumulative );
+    }
+    fprintf( f, "bvt_serial_rtt_seconds_bucket{le=\"+Inf\"} %lu\n", ls->rtt_count );
+    fprintf( f, "bvt_serial_rtt_seconds_sum %.10g\n", ls->rtt_sum );
+    fprintf( f, "bvt_serial_rtt_seconds_count %lu\n", ls->rtt_count );
+}
+
+/*------------------------------------------------------------------*
+ * Builds the HTTP response to a complete request
+ *------------------------------------------------------------------*/
+
+static void metrics_respond( struct metrics_client *c, const struct bvt_state *st )
+{
+    char *body = NULL;
+    size_t body_len = 0;
+    const char *status = "200 OK";
+    FILE *f = open_memstream( &body, &body_len );
+
+    if (f == NULL) {
+        return;
+    }
+    if (strncmp( c->in, "GET ", 4 ) && strncmp( c->in, "HEAD ", 5 )) {
+        status = "405 Method Not Allowed";
+        fprintf( f, "Only GET is supported\n" );
+    } else if (strncmp( strchr( c->in, ' ' ) + 1, "/metrics", 8 )
+               || ! strchr( " ?", strchr( c->in, ' ' )[ 9 ] )) {
+        status = "404 Not Found";
+        fprintf( f, "Try /metrics\n" );
+    } else {
+        metrics_write( f, st );
+    }
+    fclose( f );
+
+    f = open_memstream( &c->out, &c->out_len );
+    if (f == NULL) {
+        free( body );
+        return;
+    }
+    fprintf( f, "HTTP/1.0 %s\r\n"
+                "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                "Content-Length: %zu\r\n"
+                "Connection: close\r\n\r\n", status, body_len );
+    if (strncmp( c->in, "HEAD ", 5 )) {
+        fwrite( body, 1, body_len, f );
+    }
+    fclose( f );
+    free( body );
+}
+
+/*------------------------------------------------------------------*
+ * Socket handling, driven from the daemon's poll() loop
+ *------------------------------------------------------------------*/
+
+struct bvt_metrics * metrics_open( const char * address, int port )
+{
+    struct bvt_metrics *m = calloc( 1, sizeof *m );
+
+    if (m == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        m->client[ i ].fd = -1;
+    }
+    m->listen_fd = server_listen( address, port );
+    if (m->listen_fd < 0) {
+        free( m );
+        return NULL;
+    }
+    return m;
+}
+
+static void metrics_drop( struct metrics_client *c )
+{
+    close( c->fd );
+    free( c->out );
+    memset( c, 0, sizeof *c );
+    c->fd = -1;
+}
+
+void metrics_close( struct bvt_metrics * m )
+{
+    if (m == NULL) {
+        return;
+    }
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        if (m->client[ i ].fd >= 0) {
+            metrics_drop( &m->client[ i ] );
+        }
+    }
+    close( m->listen_fd );
+    free( m );
+}
+
+int metrics_pollfds( struct bvt_metrics * m, struct pollfd * fds, int max )
+{
+    int n = 0;
+
+    if (max < 1 + METRICS_MAX_CLIENTS) {
+        return 0;
+    }
+    fds[ n ].fd = m->listen_fd;
+    fds[ n++ ].events = POLLIN;
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        if (m->client[ i ].fd >= 0) {
+            fds[ n ].fd = m->client[ i ].fd;
+            fds[ n++ ].events = m->client[ i ].out ? POLLOUT : POLLIN;
+        }
+    }
+    return n;
+}
+
+static void metrics_accept( struct bvt_metrics * m )
+{
+    int fd;
+
+    while ( ( fd = accept4( m->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC ) ) >= 0 ) {
+        struct metrics_client *c = NULL;
+
+        for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+            if (m->client[ i ].fd < 0) {
+                c = &m->client[ i ];
+                break;
+            }
+        }
+        if (c == NULL) {
+            close( fd );
+            continue;
+        }
+        c->fd = fd;
+        c->since = monotonic_now( );
+    }
+}
+
+void metrics_service( struct bvt_metrics * m, const struct pollfd * fds, int n,
+                      const struct bvt_state * st )
+{
+    for (int i = 0; i < n; i++) {
+        struct metrics_client *c = NULL;
+        ssize_t len;
+
+        if (fds[ i ].revents == 0) {
+            continue;
+        }
+        if (fds[ i ].fd == m->listen_fd) {
+            metrics_accept( m );
+            continue;
+        }
+        for (int j = 0; j < METRICS_MAX_CLIENTS; j++) {
+            if (m->client[ j ].fd == fds[ i ].fd) {
+                c = &m->client[ j ];
+            }
+        }
+        if (c == NULL) {
+            continue;
+        }
+
+        if (c->out == NULL) {
+            len = read( c->fd, c->in + c->in_len, sizeof c->in - 1 - c->in_len );
+            if (len <= 0) {
+                if (len == 0 || ( errno != EAGAIN && errno != EINTR )) {
+                    metrics_drop( c );
+                }
+                continue;
+            }
+            c->in_len += len;
+            c->in[ c->in_len ] = '\0';
+            if (strstr( c->in, "\r\n\r\n" ) || strstr( c->in, "\n\n" )) {
+                metrics_respond( c, st );
+                if (c->out == NULL) {
+                    metrics_drop( c );
+                }
+            } else if (c->in_len == sizeof c->in - 1) {
+                metrics_drop( c );
+            }
+            continue;
+        }
+
+        len = send( c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL );
+        if (len < 0 && errno != EAGAIN && errno != EINTR) {
+            metrics_drop( c );
+        } else if (len > 0 && ( c->out_off += len ) == c->out_len) {
+            metrics_drop( c );
+        }
+    }
+}
+
+/* Drops scrapes that have not sent their request in time; called on
+   every pass of the daemon's loop, whether poll() found anything or not */
+
+void metrics_expire( struct bvt_metrics * m )
+{
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        struct metrics_client *c = &m->client[ i ];
+
+        if (c->fd >= 0 && c->out == NULL && monotonic_now( ) - c->since > METRICS_TIMEOUT) {
+            metrics_drop( c );
+        }
+    }
+}
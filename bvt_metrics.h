@@ -0,0 +1,29 @@
+/* Prometheus / OpenMetrics exporter built into the daemon.
+ *
+ * GET /metrics on the metrics port returns the latest sample and the
+ * serial link statistics in the Prometheus text exposition format. A
+ * scrape is answered entirely from memory: it never causes a serial
+ * transaction, so monitoring cannot get in the way of control.
+ */
+#pragma once
+#if ! defined BVT_METRICS_HEADER
+#define BVT_METRICS_HEADER
+
+#include <poll.h>
+#include "serial_jjm.h"
+#include "bvt_shm.h"
+
+#define METRICS_MAX_CLIENTS   4
+#define METRICS_REQUEST_MAX 1024    /* longest HTTP request header accepted */
+#define METRICS_TIMEOUT     5.0     /* s for a scrape to send its request */
+
+struct bvt_metrics;
+
+struct bvt_metrics * metrics_open( const char * address, int port );
+void metrics_close( struct bvt_metrics * m );
+int metrics_pollfds( struct bvt_metrics * m, struct pollfd * fds, int max );
+void metrics_service( struct bvt_metrics * m, const struct pollfd * fds, int n,
+                      const struct bvt_state * st );
+void metrics_expire( struct bvt_metrics * m );
+
+#endif
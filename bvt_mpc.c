@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bvt_mpc.h"
+#include "convenient_wrapper_functions.h"
+extern bool verboseFlag;
+
+/*------------------------------------------------------------------*
+ * Sets up a controller from a model "GAIN,TAU,DEAD[,TAU2]" (K/%, s),
+ * run every `interval' s. A `response' of 0 makes the reference time
+ * constant a quarter of the model's, or the dead time if longer. Returns
+ * NULL, having said why, if the model will not do.
+ *------------------------------------------------------------------*/
+
+struct bvt_mpc * mpc_create( const char * model, double response, double limit,
+                             double flow, double interval )
+{
+    struct bvt_mpc *c = calloc( 1, sizeof *c );
+
+    if (c == NULL) {
+        fprintf(stderr,"FATAL: unable to allocate the predictive controller\n");
+        return NULL;
+    }
+    if (   sscanf( model, "%lf,%lf,%lf,%lf", &c->gain, &c->tau, &c->dead, &c->tau2 ) < 3
+        || c->gain <= 0.0 || c->tau <= 0.0 || c->dead < 0.0 || c->tau2 < 0.0) {
+        fprintf(stderr,"FATAL: --mpc needs GAIN,TAU,DEAD[,TAU2], all positive\n");
+        free( c );
+        return NULL;
+    }
+    if (limit <= 0.0 || limit > 100.0 || response < 0.0) {
+        fprintf(stderr,"FATAL: predictive control needs a power limit of 0-100 %% and a positive response\n");
+        free( c );
+        return NULL;
+    }
+    c->response = response > 0.0 ? response : fmax( ( c->tau + c->tau2 ) / 4.0, c->dead );
+    c->delay = lround( c->dead / interval );
+    c->horizon = c->delay + (int) ceil( MPC_COINCIDENCE * c->response / interval );
+    if (c->delay >= MPC_MAX_DELAY || c->horizon > MPC_MAX_HORIZON) {
+        fprintf(stderr,"FATAL: --mpc would predict %d samples ahead at a %.2f s poll interval; "
+                "poll less often or shorten --mpc-response\n", c->horizon, interval);
+        free( c );
+        return NULL;
+    }
+    c->limit = limit;
+    c->flow = flow;
+    c->interval = interval;
+    c->a1 = 1.0 - exp( -interval / c->tau );
+    c->a2 = c->tau2 > 0.0 ? 1.0 - exp( -interval / c->tau2 ) : 1.0;
+    return c;
+}
+
+/* Advances model state (x1, x2) by one sample with power u */
+
+static void model_advance( const struct bvt_mpc * c, double * x1, double * x2, double u )
+{
+    *x1 += c->a1 * ( c->gain * u - *x1 );
+    *x2 += c->a2 * ( *x1 - *x2 );
+}
+
+/*------------------------------------------------------------------*
+ * Takes the heater power over, before the daemon's loop starts: saves
+ * the mode, output and limits, clamps the output limit, sets the flow,
+ * and goes to manual with the model settled at the power found
+ *------------------------------------------------------------------*/
+
+void mpc_start( struct bvt_mpc * c, struct sp_port * port_choice )
+{
+    c->mode = eurotherm902s_get_mode( port_choice );
+    c->op = eurotherm902s_get_heater_power( port_choice );
+    c->ho = eurotherm902s_get_heater_power_limit( port_choice );
+    if (c->ho < c->limit) {
+        fprintf(stderr,"WARNING: Predictive control limited to the controller's %.1f %% output limit\n", c->ho);
+        c->limit = c->ho;
+    }
+    eurotherm902s_set_heater_power_limit( c->limit, port_choice );
+    if (c->flow >= 0.0) {
+        c->flow_index = bvt3000_get_flow_rate( port_choice );
+        if (set_flow_rate( c->flow, port_choice ) != 0) {
+            fprintf(stderr,"WARNING: Flow rate %.0f l/h not set\n", c->flow);
+        }
+    }
+    if (c->mode != MANUAL_MODE) {
+        eurotherm902s_set_mode( MANUAL_MODE, port_choice );
+    }
+
+    c->power = fmin( fmax( c->op, 0.0 ), c->limit );
+    c->x1 = c->x2 = c->gain * c->power;
+    for (int i = 0; i <= c->delay; i++) {
+        c->queue[ i ] = c->power;
+    }
+    if (verboseFlag) {
+        printf("Predictive control: model %g K/%%, %g s + %g s, dead time %g s; "
+               "%d samples ahead, reference %g s, power limit %.1f %%\n",
+                c->gain, c->tau, c->tau2, c->dead, c->horizon, c->response, c->limit);
+    }
+}
+
+/*------------------------------------------------------------------*
+ * Works out the power from a new sample and posts it. The prediction is
+ * the bias plus the model's free response (the powers already on their
+ * way, then none) plus its step response times the new power; the power
+ * is the least squares fit of that to the reference past the dead time,
+ * with a small weight on staying at the last power.
+ *------------------------------------------------------------------*/
+
+void mpc_update( struct bvt_mpc * c, const struct bvt_state * st, const struct bvt_profile * p )
+{
+    double pv = st->temperature, now = st->mono_time, h = c->interval;
+    double sp_now, x1, x2, s1 = 0.0, s2 = 0.0, num = 0.0, den = 0.0, u;
+    bool heater = st->is & BVT3000_HEATER_ON;
+
+    if (c->fault) {
+        return;
+    }
+    if (! ( pv > 0.0 )) {
+        mpc_miss( c );
+        return;
+    }
+    c->missed = 0;
+    if (st->sw & SENSOR_BREAK_FLAG) {
+        fprintf(stderr,"WARNING: Sensor break, predictive control stopped with the heater at 0 %%\n");
+        c->fault = true;
+        c->power = 0.0;
+        eurotherm902s_post_heater_power( 0.0 );
+        c->pending = true;
+        return;
+    }
+
+    /* Move the model on by the sample just gone, with what the heater
+       got then, and correct the bias toward the measurement */
+
+    if (c->samples++ > 0) {
+        model_advance( c, &c->x1, &c->x2, c->queue[ 0 ] );
+        memmove( c->queue, c->queue + 1, c->delay * sizeof c->queue[ 0 ] );
+    }
+    if (c->samples == 1) {
+        if (! heater) {
+            c->x1 = c->x2 = 0.0;
+            for (int i = 0; i <= c->delay; i++) {
+                c->queue[ i ] = 0.0;
+            }
+        }
+        c->bias = pv - c->x2;
+    } else {
+        c->bias += MPC_BIAS_GAIN * ( pv - c->x2 - c->bias );
+    }
+
+    sp_now = profile_preview( p, now );
+    if (isnan( sp_now )) {
+        sp_now = st->working_setpoint;
+    }
+    x1 = c->x1;
+    x2 = c->x2;
+    for (int j = 1; j <= c->horizon; j++) {
+        double sp = profile_preview( p, now + j * h ), ref;
+
+        model_advance( c, &x1, &x2, j <= c->delay ? c->queue[ j - 1 ] : 0.0 );
+        model_advance( c, &s1, &s2, j <= c->delay ? 0.0 : 1.0 );
+        if (j <= c->delay) {
+            continue;
+        }
+        if (isnan( sp )) {
+            sp = st->working_setpoint;
+        }
+        ref = sp - ( sp_now - pv ) * exp( -j * h / c->response );
+        num += s2 * ( ref - c->bias - x2 );
+        den += s2 * s2;
+    }
+    u = ( num + MPC_MOVE_WEIGHT * den * c->power ) / ( ( 1.0 + MPC_MOVE_WEIGHT ) * den );
+    u = fmin( fmax( u, 0.0 ), c->limit );
+
+    /* While the heater is off it gets nothing, whatever is asked */
+
+    c->power = round( u * 10.0 ) / 10.0;
+    c->queue[ c->delay ] = heater ? c->power : 0.0;
+    eurotherm902s_post_heater_power( c->power );
+    c->pending = true;
+}
+
+/*------------------------------------------------------------------*
+ * Accounts for a sample the daemon could not take: the heater goes on
+ * getting the power last sent, which the model follows, and after
+ * MPC_MAX_MISSED such samples in a row the power is stopped
+ *------------------------------------------------------------------*/
+
+void mpc_miss( struct bvt_mpc * c )
+{
+    if (c->fault || c->samples == 0) {
+        return;
+    }
+    model_advance( c, &c->x1, &c->x2, c->queue[ 0 ] );
+    memmove( c->queue, c->queue + 1, c->delay * sizeof c->queue[ 0 ] );
+    if (++c->missed == MPC_MAX_MISSED) {
+        fprintf(stderr,"WARNING: No reading for %d samples, predictive control stopped with the heater at 0 %%\n",
+                MPC_MAX_MISSED);
+        c->fault = true;
+        c->power = 0.0;
+        eurotherm902s_post_heater_power( 0.0 );
+        c->pending = true;
+    }
+}
+
+bool mpc_due( const struct bvt_mpc * c )
+{
+    return c->pending;
+}
+
+void mpc_step( struct bvt_mpc * c, struct sp_port * port_choice )
+{
+    bvt3000_flush_posted_writes( port_choice );
+    c->pending = false;
+}
+
+/*------------------------------------------------------------------*
+ * Puts back what mpc_start() found, as the daemon is stopping
+ *------------------------------------------------------------------*/
+
+void mpc_stop( struct bvt_mpc * c, struct sp_port * port_choice )
+{
+    if (c->mode == MANUAL_MODE) {
+        eurotherm902s_post_heater_power( c->fault ? 0.0 : fmin( fmax( c->op, 0.0 ), 100.0 ) );
+        bvt3000_flush_posted_writes( port_choice );
+    } else if (c->fault) {
+        fprintf(stderr,"WARNING: Controller left in manual with the heater at 0 %% after the fault\n");
+    } else {
+        eurotherm902s_set_mode( AUTOMATIC_MODE, port_choice );
+    }
+    eurotherm902s_set_heater_power_limit( c->ho, port_choice );
+    if (c->flow >= 0.0) {
+        bvt3000_set_flow_rate( c->flow_index, port_choice );
+    }
+    c->pending = false;
+    if (verboseFlag) {
+        printf("Predictive control: controller settings restored\n");
+    }
+}
+
+/* One line on how it is doing, for the TCP status command */
+
+void mpc_describe( const struct bvt_mpc * c, char * buf, size_t len )
+{
+    snprintf( buf, len, "%s %.1f %.2f", c->fault ? "STOPPED" : "RUNNING", c->power, c->bias );
+}
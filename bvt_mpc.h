@@ -0,0 +1,74 @@
+/* Model-predictive control of the heater power, run by the daemon.
+ *
+ * Instead of the Eurotherm's PID, the daemon can drive the heater power
+ * itself, with the controller in manual mode. At every sample a plant
+ * model (first or second order lag plus dead time, e.g. from bvt-ident)
+ * predicts the temperature over the dead time and MPC_COINCIDENCE
+ * --mpc-response times beyond, corrected for the difference between
+ * model and PV, and the power is chosen that best makes the prediction
+ * follow a reference approaching the setpoint with that time constant
+ * (a quarter of the model's by default), so no integral is needed. The
+ * reference follows the setpoint profile where one is running, so ramps
+ * and steps are acted on a dead time ahead rather than followed.
+ *
+ * The power is clamped to --mpc-power-limit, which is also written to
+ * the controller's own output limit (HO) for as long as this runs, so a
+ * wrong model or a host crash cannot drive the heater harder. On a
+ * sensor break, or after MPC_MAX_MISSED samples in a row the device did
+ * not answer, the power goes to 0 and stays there. The controller's
+ * mode, output limit and (with --mpc-flow) gas flow are put back when
+ * the daemon stops. While this runs it owns the heater power.
+ */
+#pragma once
+#if ! defined BVT_MPC_HEADER
+#define BVT_MPC_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "serial_jjm.h"
+#include "bvt_shm.h"
+#include "bvt_profile.h"
+
+#define MPC_MAX_DELAY      256      /* samples of dead time */
+#define MPC_MAX_HORIZON    1024     /* samples predicted */
+#define MPC_COINCIDENCE    2.0      /* reference time constants predicted */
+#define MPC_BIAS_GAIN      0.3      /* share of the model error corrected per sample */
+#define MPC_MOVE_WEIGHT    0.05     /* cost of changing the power, relative to tracking */
+#define MPC_MAX_MISSED     5        /* samples in a row without a reading before stopping */
+
+struct bvt_mpc {
+    double gain;                    /* K/% */
+    double tau, tau2;               /* s, tau2 0 for first order */
+    double dead;                    /* s */
+    double response;                /* s, reference time constant */
+    double limit;                   /* % */
+    double flow;                    /* l/h to set, negative to leave alone */
+    double interval;                /* s per sample */
+
+    int delay, horizon;             /* samples */
+    double a1, a2;                  /* discrete lags per sample */
+    double x1, x2;                  /* model states, K above zero power */
+    double queue[ MPC_MAX_DELAY + 1 ];  /* powers on their way, oldest first */
+    double bias;                    /* PV minus model */
+    double power;                   /* last commanded */
+    unsigned long samples;
+    int missed;                     /* samples in a row without a reading */
+    bool pending;                   /* a power write is posted */
+    bool fault;
+
+    int mode;                       /* to put back */
+    double op, ho;
+    unsigned int flow_index;
+};
+
+struct bvt_mpc * mpc_create( const char * model, double response, double limit,
+                             double flow, double interval );
+void mpc_start( struct bvt_mpc * c, struct sp_port * port_choice );
+void mpc_update( struct bvt_mpc * c, const struct bvt_state * st, const struct bvt_profile * p );
+void mpc_miss( struct bvt_mpc * c );
+bool mpc_due( const struct bvt_mpc * c );
+void mpc_step( struct bvt_mpc * c, struct sp_port * port_choice );
+void mpc_stop( struct bvt_mpc * c, struct sp_port * port_choice );
+void mpc_describe( const struct bvt_mpc * c, char * buf, size_t len );
+
+#endif
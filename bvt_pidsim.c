@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "bvt_pidsim.h"
+#include "serial_jjm.h"
+
+/* The grid, as factors on the starting XP and TI, fractions of TI for
+   TD and multiples of XP for the cutbacks */
+
+#define GRID_XP  17                 /* 1/4 ... 4, four per octave */
+#define GRID_TI  13                 /* 1/4 ... 4, three per octave */
+static const double grid_td[ ] = { 0.0, 0.05, 0.1, 0.15, 0.2, 0.25 };
+static const double grid_cb[ ] = { 0.5, 1.0, 2.0, 4.0 };
+
+#define GRID_TDS ( sizeof grid_td / sizeof grid_td[ 0 ] )
+#define GRID_CBS ( sizeof grid_cb / sizeof grid_cb[ 0 ] )
+
+struct pidsim {
+    const struct pid_plant *plant;
+    double step;
+    double h;                       /* s per time step */
+    int dead;                       /* time steps */
+    struct pid_candidate *cand;
+    uint32_t count;
+    uint32_t batches;
+    uint32_t next;                  /* next batch to take, atomically */
+};
+
+/*------------------------------------------------------------------*
+ * Runs one batch through the setpoint going up by `step' at the start
+ * and back down half way. Everything is relative to the temperature
+ * held by `power'; each array holds one value per lane, and the inner
+ * loops have no branches so that they vectorise.
+ *------------------------------------------------------------------*/
+
+static void batch_run( const struct pidsim *s, struct pid_candidate *c, int n, double *ring )
+{
+    const struct pid_plant *p = s->plant;
+    const double h = s->h, band = 0.02 * s->step, limit = p->limit, power = p->power, gain = p->gain;
+    const double a1 = 1.0 - exp( -h / p->tau );
+    const double a2 = p->tau2 > 0.0 ? 1.0 - exp( -h / p->tau2 ) : 1.0;
+    const int slots = s->dead + 1;
+    double kp[ PIDSIM_BATCH ], ki[ PIDSIM_BATCH ], kd[ PIDSIM_BATCH ];
+    double hb[ PIDSIM_BATCH ], lb[ PIDSIM_BATCH ];
+    double x[ PIDSIM_BATCH ], y[ PIDSIM_BATCH ], integ[ PIDSIM_BATCH ], prev[ PIDSIM_BATCH ];
+    double energy[ PIDSIM_BATCH ], over[ PIDSIM_BATCH ];
+    int bad[ 2 ][ PIDSIM_BATCH ];
+
+    /* Unused lanes run a copy of the first candidate */
+
+    for (int j = 0; j < PIDSIM_BATCH; j++) {
+        const struct pid_candidate *cj = &c[ j < n ? j : 0 ];
+
+        kp[ j ] = 100.0 / cj->xp;
+        ki[ j ] = kp[ j ] / cj->ti;
+        kd[ j ] = kp[ j ] * cj->td / h;
+        hb[ j ] = cj->hb;
+        lb[ j ] = cj->lb;
+        x[ j ] = y[ j ] = prev[ j ] = integ[ j ] = energy[ j ] = over[ j ] = 0.0;
+        bad[ 0 ][ j ] = bad[ 1 ][ j ] = 0;
+    }
+    for (int i = 0; i < slots * PIDSIM_BATCH; i++) {
+        ring[ i ] = power;
+    }
+
+    for (int k = 0; k < 2 * PIDSIM_STEPS; k++) {
+        const int half = k >= PIDSIM_STEPS;
+        const double sp = half ? 0.0 : s->step, sign = half ? -1.0 : 1.0;
+        const int since = k - half * PIDSIM_STEPS + 1;
+        double *in = ring + ( k % slots ) * PIDSIM_BATCH;
+        const double *out = ring + ( ( k + 1 ) % slots ) * PIDSIM_BATCH;
+        int *last = bad[ half ];
+
+        for (int j = 0; j < PIDSIM_BATCH; j++) {
+            double e = sp - y[ j ];
+            double pd = kp[ j ] * e - kd[ j ] * ( y[ j ] - prev[ j ] );
+            double ni = integ[ j ] + ki[ j ] * e * h;
+            double u = power + pd + ni;
+            double sat = u > limit ? limit : ( u < 0.0 ? 0.0 : u );
+            int wind = ( ( u > limit ) & ( e > 0.0 ) ) | ( ( u < 0.0 ) & ( e < 0.0 ) );
+            int low = e > lb[ j ], high = -e > hb[ j ];
+
+            /* Cutback overrides the PID and presets the integral */
+
+            sat = low ? limit : ( high ? 0.0 : sat );
+            integ[ j ] = low ? limit - power - pd : ( high ? -power - pd : ( wind ? integ[ j ] : ni ) );
+            in[ j ] = sat;
+
+            prev[ j ] = y[ j ];
+            x[ j ] += a1 * ( gain * ( out[ j ] - power ) - x[ j ] );
+            y[ j ] += a2 * ( x[ j ] - y[ j ] );
+            energy[ j ] += out[ j ] * h / 100.0;
+
+            e = sign * ( sp - y[ j ] );
+            over[ j ] = -e > over[ j ] ? -e : over[ j ];
+            last[ j ] = fabs( e ) > band ? since : last[ j ];
+        }
+    }
+
+    /* Settled means within the band for the last tenth of each half
+       at least */
+
+    for (int j = 0; j < n; j++) {
+        int last = bad[ 0 ][ j ] > bad[ 1 ][ j ] ? bad[ 0 ][ j ] : bad[ 1 ][ j ];
+
+        c[ j ].settling = last > PIDSIM_STEPS * 9 / 10 ? INFINITY : last * h;
+        c[ j ].overshoot = over[ j ];
+        c[ j ].energy = energy[ j ];
+    }
+}
+
+static void * worker( void *arg )
+{
+    struct pidsim *s = arg;
+    double *ring = malloc( ( s->dead + 1 ) * PIDSIM_BATCH * sizeof *ring );
+    uint32_t b;
+
+    if (ring == NULL) {
+        return NULL;
+    }
+    while (( b = __atomic_fetch_add( &s->next, 1, __ATOMIC_RELAXED ) ) < s->batches) {
+        uint32_t first = b * PIDSIM_BATCH;
+        uint32_t n = s->count - first < PIDSIM_BATCH ? s->count - first : PIDSIM_BATCH;
+
+        batch_run( s, &s->cand[ first ], n, ring );
+    }
+    free( ring );
+    return NULL;
+}
+
+static int candidate_compare( const void *a, const void *b )
+{
+    const struct pid_candidate *x = a, *y = b;
+
+    if (x->settling != y->settling) {
+        return x->settling < y->settling ? -1 : 1;
+    }
+    if (x->overshoot != y->overshoot) {
+        return x->overshoot < y->overshoot ? -1 : 1;
+    }
+    if (x->energy != y->energy) {
+        return x->energy < y->energy ? -1 : 1;
+    }
+
+    /* Settings that do equally well are told apart by the gentler
+       cutback, as it is the less likely to act */
+
+    if (x->lb != y->lb) {
+        return x->lb > y->lb ? -1 : 1;
+    }
+    return ( x->hb < y->hb ) - ( x->hb > y->hb );
+}
+
+/*------------------------------------------------------------------*
+ * Simulates the grid around (xp, ti) on `threads' threads, the calling
+ * one included. Returns the number of candidates that settle without
+ * overshooting more than `overshoot', best first, in *result (to be
+ * freed), or -1 if out of memory.
+ *------------------------------------------------------------------*/
+
+int pid_search( const struct pid_plant *plant, double step, double overshoot,
+                double xp, double ti, long threads, struct pid_candidate **result )
+{
+    struct pidsim s;
+    pthread_t *tid;
+    double span = plant->tau + plant->tau2 + plant->dead;
+    uint32_t kept = 0;
+
+    memset( &s, 0, sizeof s );
+    s.plant = plant;
+    s.step = step;
+    s.h = 20.0 * span / PIDSIM_STEPS;
+    s.dead = lround( plant->dead / s.h );
+    s.count = GRID_XP * GRID_TI * GRID_TDS * GRID_CBS * GRID_CBS;
+    s.batches = ( s.count + PIDSIM_BATCH - 1 ) / PIDSIM_BATCH;
+    s.cand = calloc( s.count, sizeof *s.cand );
+    if (s.cand == NULL) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < s.count; i++) {
+        struct pid_candidate *c = &s.cand[ i ];
+        uint32_t r = i;
+
+        c->xp = fmin( fmax( xp * exp2( ( r % GRID_XP ) / 4.0 - 2.0 ), 0.1 ), MAX_PROPORTIONAL_BAND );
+        r /= GRID_XP;
+        c->ti = fmin( fmax( ti * exp2( ( r % GRID_TI ) / 3.0 - 2.0 ), 0.1 ), MAX_INTEGRAL_TIME );
+        r /= GRID_TI;
+        c->td = fmin( c->ti * grid_td[ r % GRID_TDS ], MAX_DERIVATIVE_TIME );
+        r /= GRID_TDS;
+        c->hb = fmin( c->xp * grid_cb[ r % GRID_CBS ], MAX_CUTBACK );
+        r /= GRID_CBS;
+        c->lb = fmin( c->xp * grid_cb[ r % GRID_CBS ], MAX_CUTBACK );
+        c->settling = INFINITY;
+    }
+
+    if (threads > s.batches) {
+        threads = s.batches;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    tid = calloc( threads, sizeof *tid );
+    if (tid == NULL) {
+        free( s.cand );
+        return -1;
+    }
+    for (long i = 1; i < threads; i++) {
+        if (pthread_create( &tid[ i ], NULL, worker, &s )) {
+            threads = i;
+            break;
+        }
+    }
+    worker( &s );
+    for (long i = 1; i < threads; i++) {
+        pthread_join( tid[ i ], NULL );
+    }
+    free( tid );
+
+    for (uint32_t i = 0; i < s.count; i++) {
+        if (isfinite( s.cand[ i ].settling ) && s.cand[ i ].overshoot <= overshoot) {
+            s.cand[ kept++ ] = s.cand[ i ];
+        }
+    }
+    qsort( s.cand, kept, sizeof *s.cand, candidate_compare );
+    *result = s.cand;
+    return kept;
+}
@@ -0,0 +1,47 @@
+/* Closed-loop simulation of the Eurotherm PID on a plant model.
+ *
+ * The plant is a first or second order lag plus dead time, as fitted by
+ * bvt-ident, working around the heater power `power' that holds the
+ * temperature. The controller is the 902's: a PID on the error with the
+ * derivative on the temperature, integral held while the output is
+ * saturated, and cutback, i.e. full or no power while the temperature
+ * is more than LB below or HB above the setpoint, the integral being
+ * preset on entering the band so that the output carries on smoothly.
+ *
+ * A search runs a grid of XP, TI, TD, HB and LB around a starting point
+ * through a step of the setpoint up and back down, and ranks them by
+ * the time to settle within 2 % of the step for good (the slower of the
+ * two), then by overshoot, then by heater energy (as seconds at full
+ * power). Settings overshooting by more than `max_overshoot', or that
+ * do not settle, are dropped. The candidates are simulated in batches,
+ * one candidate per lane, so that the compiler can vectorise the loop,
+ * and the batches are spread over a pool of threads.
+ */
+#pragma once
+#if ! defined BVT_PIDSIM_HEADER
+#define BVT_PIDSIM_HEADER
+
+#include <stdint.h>
+
+#define PIDSIM_BATCH     64         /* candidates simulated together */
+#define PIDSIM_STEPS     2000       /* time steps per half of the run */
+
+struct pid_plant {
+    double gain;                    /* K/% */
+    double tau, tau2;               /* s, tau2 0 for first order */
+    double dead;                    /* s */
+    double power;                   /* % holding the temperature */
+    double limit;                   /* % heater power limit */
+};
+
+struct pid_candidate {
+    double xp, ti, td, hb, lb;
+    double settling;                /* s, INFINITY if it never settles */
+    double overshoot;               /* K */
+    double energy;                  /* s at full power */
+};
+
+int pid_search( const struct pid_plant *plant, double step, double max_overshoot,
+                double xp, double ti, long threads, struct pid_candidate **result );
+
+#endif
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "bvt_profile.h"
+extern bool verboseFlag;
+
+bool profile_add( struct bvt_profile * p, double rate, double target, double dwell )
+{
+    if (   p->segments == PROFILE_MAX_SEGMENTS
+        || ! ( rate >= 0.0 ) || ! ( dwell >= 0.0 )
+        || ! ( target >= MIN_SETPOINT && target <= MAX_SETPOINT )) {
+        return false;
+    }
+    p->segment[ p->segments ].rate = rate;
+    p->segment[ p->segments ].target = target;
+    p->segment[ p->segments ].dwell = dwell;
+    p->segments++;
+    return true;
+}
+
+/*------------------------------------------------------------------*
+ * Reads a profile from a file with one segment per line, "<rate K/min>
+ * <target K> <dwell s>". Blank lines and anything after '#' are ignored.
+ *------------------------------------------------------------------*/
+
+bool profile_load( struct bvt_profile * p, const char * path )
+{
+    FILE *f = fopen( path, "r" );
+    char line[ 256 ];
+    int n = 0;
+
+    if (f == NULL) {
+        fprintf(stderr,"FATAL: cannot open profile %s\n", path);
+        return false;
+    }
+    while ( fgets( line, sizeof line, f ) != NULL ) {
+        double rate, target, dwell;
+        char *hash = strchr( line, '#' );
+        int fields;
+
+        n++;
+        if (hash) {
+            *hash = '\0';
+        }
+        fields = sscanf( line, "%lf %lf %lf", &rate, &target, &dwell );
+        if (fields == EOF) {
+            continue;
+        }
+        if (fields != 3 || ! profile_add( p, rate, target, dwell )) {
+            fprintf(stderr,"FATAL: %s:%d: bad or too many segments\n", path, n);
+            fclose( f );
+            return false;
+        }
+    }
+    fclose( f );
+    if (verboseFlag) {
+        printf("Loaded a profile of %d segments from %s\n", p->segments, path);
+    }
+    return true;
+}
+
+void profile_clear( struct bvt_profile * p )
+{
+    p->segments = 0;
+}
+
+bool profile_start( struct bvt_profile * p )
+{
+    if (p->state != PROFILE_IDLE || p->segments == 0) {
+        return false;
+    }
+    p->state = PROFILE_STARTING;
+    p->sp = -1;
+    return true;
+}
+
+void profile_pause( struct bvt_profile * p, double now )
+{
+    if (p->state == PROFILE_RUNNING) {
+        p->state = PROFILE_PAUSED;
+        p->paused = now;
+    }
+}
+
+/* The whole remaining profile moves back by the time spent paused */
+
+void profile_resume( struct bvt_profile * p, double now )
+{
+    if (p->state == PROFILE_PAUSED) {
+        p->t0 += now - p->paused;
+        p->next += now - p->paused;
+        p->state = PROFILE_RUNNING;
+    }
+}
+
+void profile_abort( struct bvt_profile * p )
+{
+    p->state = PROFILE_IDLE;
+}
+
+bool profile_due( const struct bvt_profile * p, double now )
+{
+    return p->state == PROFILE_STARTING || ( p->state == PROFILE_RUNNING && now >= p->next );
+}
+
+double profile_deadline( const struct bvt_profile * p )
+{
+    if (p->state == PROFILE_STARTING) {
+        return 0.0;
+    }
+    return p->state == PROFILE_RUNNING ? p->next : INFINITY;
+}
+
+const char * profile_state_name( const struct bvt_profile * p )
+{
+    static const char * const names[ ] = { "IDLE", "STARTING", "RUNNING", "PAUSED" };
+
+    return names[ p->state ];
+}
+
+/*------------------------------------------------------------------*
+ * Time between setpoint writes of a ramp: one 0.1 K step of the
+ * device, but not more often than every PROFILE_MIN_STEP
+ *------------------------------------------------------------------*/
+
+static double step_time( const struct profile_segment * s )
+{
+    double t = 0.1 / ( s->rate / 60.0 );
+
+    return t > PROFILE_MIN_STEP ? t : PROFILE_MIN_STEP;
+}
+
+static bool is_step( const struct bvt_profile * p, const struct profile_segment * s )
+{
+    return s->rate == 0.0 || fabs( s->target - p->from ) < 0.05;
+}
+
+static void segment_begin( struct bvt_profile * p, double t )
+{
+    const struct profile_segment *s = &p->segment[ p->current ];
+
+    p->from = p->setpoint;
+    p->t0 = t;
+    p->steps = 0;
+    p->dwelling = false;
+    p->next = is_step( p, s ) ? t : t + step_time( s );
+}
+
+/*------------------------------------------------------------------*
+ * Does what is due, at most one serial transaction. Deadlines are
+ * kept on the ideal schedule of the profile; if we fell behind, the
+ * ramp skips ahead to where it should be rather than catching up in a
+ * burst of writes.
+ *------------------------------------------------------------------*/
+
+void profile_step( struct bvt_profile * p, double now, struct sp_port * port_choice )
+{
+    const struct profile_segment *s;
+
+    if (p->state == PROFILE_STARTING && p->sp < 0) {
+        p->sp = eurotherm902s_get_active_setpoint( port_choice );
+        return;
+    }
+    if (p->state == PROFILE_STARTING) {
+
+        /* The ramp starts from the working setpoint, read with a BCC and
+           to the last digit, unlike SL / S2 (see step_setpoint()) */
+
+        p->setpoint = eurotherm902s_get_working_setpoint( port_choice );
+        if (! bvt3000_last_query_ok( )) {
+            return;
+        }
+        p->current = 0;
+        p->state = PROFILE_RUNNING;
+        segment_begin( p, now );
+        return;
+    }
+    if (! profile_due( p, now )) {
+        return;
+    }
+    s = &p->segment[ p->current ];
+
+    if (p->dwelling) {
+        if (++p->current == p->segments) {
+            p->state = PROFILE_IDLE;
+            if (verboseFlag) {
+                printf("Profile finished at %.1f K\n", p->setpoint);
+            }
+            return;
+        }
+        segment_begin( p, p->next );
+        return;
+    }
+
+    if (is_step( p, s )) {
+        p->setpoint = s->target;
+        p->next = p->t0 + s->dwell;
+        p->dwelling = true;
+    } else {
+        double dt = step_time( s );
+        double span = fabs( s->target - p->from );
+        int k = floor( ( now - p->t0 ) / dt );
+        double moved;
+
+        if (k <= p->steps) {
+            k = p->steps + 1;
+        }
+        moved = s->rate / 60.0 * k * dt;
+        p->steps = k;
+        if (moved >= span) {
+            p->setpoint = s->target;
+            p->dwelling = true;
+            p->next = p->t0 + span / ( s->rate / 60.0 ) + s->dwell;
+        } else {
+            p->setpoint = round( ( p->from + copysign( moved, s->target - p->from ) ) * 10.0 ) / 10.0;
+            p->next = p->t0 + ( k + 1 ) * dt;
+        }
+    }
+    eurotherm902s_set_setpoint( p->sp, p->setpoint, port_choice );
+    if (verboseFlag) {
+        printf("Profile segment %d: setpoint %.1f K\n", p->current + 1, p->setpoint);
+    }
+}
+
+/*------------------------------------------------------------------*
+ * The setpoint a running profile will be at, on its ideal schedule, at
+ * `t' (CLOCK_MONOTONIC, now or later), for controllers that want to
+ * see ramps coming; NAN if no profile is running
+ *------------------------------------------------------------------*/
+
+double profile_preview( const struct bvt_profile * p, double t )
+{
+    double from = p->from, t0 = p->t0;
+
+    if (p->state != PROFILE_RUNNING) {
+        return NAN;
+    }
+    for (int i = p->current; i < p->segments; i++) {
+        const struct profile_segment *s = &p->segment[ i ];
+        double span = fabs( s->target - from );
+        double ramp = s->rate == 0.0 || span < 0.05 ? 0.0 : span / ( s->rate / 60.0 );
+
+        if (t < t0 + ramp) {
+            return from + copysign( s->rate / 60.0 * ( t - t0 ), s->target - from );
+        }
+        if (t < t0 + ramp + s->dwell || i == p->segments - 1) {
+            return s->target;
+        }
+        from = s->target;
+        t0 += ramp + s->dwell;
+    }
+    return p->setpoint;
+}
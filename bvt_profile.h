@@ -0,0 +1,63 @@
+/* Setpoint profiles run by the daemon.
+ *
+ * A profile is a list of segments, each ramping the setpoint (SP1 or
+ * SP2, whichever is in use when the profile starts) at a given rate to
+ * a target and then holding it there for a dwell time. The daemon
+ * writes the ramp at the device's own 0.1 K resolution, on absolute
+ * deadlines computed from the start of the segment, so the ramp rate
+ * stays exact however busy the serial link is. A rate of 0 steps
+ * straight to the target.
+ *
+ * While a profile is running the daemon owns the setpoint: writes from
+ * clients are overwritten by the next step. Pausing freezes the profile
+ * (and the setpoint) where it is, resuming carries on from there, and
+ * aborting leaves the setpoint at its last value.
+ */
+#pragma once
+#if ! defined BVT_PROFILE_HEADER
+#define BVT_PROFILE_HEADER
+
+#include <stdbool.h>
+#include "serial_jjm.h"
+
+#define PROFILE_MAX_SEGMENTS  256
+#define PROFILE_MIN_STEP      0.5   /* s, shortest time between setpoint writes */
+
+struct profile_segment {
+    double rate;                    /* K/min, 0 for a step */
+    double target;                  /* K */
+    double dwell;                   /* s */
+};
+
+enum profile_state { PROFILE_IDLE, PROFILE_STARTING, PROFILE_RUNNING, PROFILE_PAUSED };
+
+struct bvt_profile {
+    struct profile_segment segment[ PROFILE_MAX_SEGMENTS ];
+    int segments;
+
+    enum profile_state state;
+    int current;                    /* segment being run */
+    bool dwelling;                  /* ramp done, holding the target */
+    double from;                    /* setpoint at the start of the segment */
+    double t0;                      /* CLOCK_MONOTONIC start of the ramp or dwell */
+    int steps;                      /* setpoint writes done in this ramp */
+    double next;                    /* CLOCK_MONOTONIC deadline of the next step */
+    double paused;                  /* when it was paused */
+    double setpoint;                /* last written */
+    int sp;                         /* SP1 or SP2, -1 until found */
+};
+
+bool profile_add( struct bvt_profile * p, double rate, double target, double dwell );
+bool profile_load( struct bvt_profile * p, const char * path );
+void profile_clear( struct bvt_profile * p );
+bool profile_start( struct bvt_profile * p );
+void profile_pause( struct bvt_profile * p, double now );
+void profile_resume( struct bvt_profile * p, double now );
+void profile_abort( struct bvt_profile * p );
+bool profile_due( const struct bvt_profile * p, double now );
+double profile_deadline( const struct bvt_profile * p );
+void profile_step( struct bvt_profile * p, double now, struct sp_port * port_choice );
+double profile_preview( const struct bvt_profile * p, double t );
+const char * profile_state_name( const struct bvt_profile * p );
+
+#endif
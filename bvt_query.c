@@ -0,0 +1,500 @@
+/* bvt-query: statistics over archives written by the daemon's --archive
+ *
+ * Every archive given is mapped into memory, and the chunks overlapping
+ * the requested time range, of all files, are decoded and summarised by
+ * a pool of threads. The results are then put together file by file, in
+ * time order, and printed in the same tagged form as the main program:
+ *
+ *   ***FILE: <path>                      before each file's results
+ *   ***STAT: <n> <min> <max> <mean> <sd> over the whole range
+ *   ***HIST: <time> <min> <max> <mean>   per --downsample interval
+ *   ***CROS: <time> up|down              per crossing of --crossing
+ *   ***SETL: <time> <setpoint> <seconds> per setpoint change, the time
+ *                                        until PV stayed within --settle
+ *                                        of it (-1 if it never did)
+ *   ***EVNT: <time> <event> ON|OFF       per status transition, from the
+ *                                        archive's event index
+ *
+ * Times are unix times, as in the archive.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bvt_archive.h"
+
+bool verboseFlag = false;
+
+struct stats {
+    uint64_t n;
+    double min, max, mean, m2;      /* m2: sum of squared deviations */
+};
+
+/* One chunk of one file, decoded and summarised by a worker */
+
+struct unit {
+    const struct archive_map *map;
+    const struct archive_index *ix;
+    uint32_t n;                     /* samples within the range */
+    double *t, *v, *sp;             /* kept if needed after the workers */
+    struct stats st;
+    bool bad;
+};
+
+struct query {
+    double from, to;
+    int col;
+    double downsample;              /* 0 if not wanted */
+    bool stats, crossings, settle;
+    bool events;
+    int event;                      /* only this one, or -1 for all */
+    double crossing, tolerance;
+
+    struct unit *unit;
+    uint32_t units;
+    uint32_t next;                  /* next unit to take, atomically */
+};
+
+/*------------------------------------------------------------------*
+ * Statistics of a column, in two passes over the array. The passes
+ * keep four independent lanes, so that the compiler can keep them in
+ * vector registers without having to reorder floating point sums.
+ * Partial statistics are merged with Chan's formula.
+ *------------------------------------------------------------------*/
+
+#define LANES  4
+
+static void column_stats( const double *v, uint32_t n, struct stats *s )
+{
+    double min[ LANES ], max[ LANES ], sum[ LANES ], m2[ LANES ], mean;
+    uint32_t i, k;
+
+    for (k = 0; k < LANES; k++) {
+        min[ k ] = max[ k ] = v[ 0 ];
+        sum[ k ] = m2[ k ] = 0.0;
+    }
+    for (i = 0; i + LANES <= n; i += LANES) {
+        for (k = 0; k < LANES; k++) {
+            min[ k ] = v[ i + k ] < min[ k ] ? v[ i + k ] : min[ k ];
+            max[ k ] = v[ i + k ] > max[ k ] ? v[ i + k ] : max[ k ];
+            sum[ k ] += v[ i + k ];
+        }
+    }
+    for (k = 0; i + k < n; k++) {
+        min[ k ] = v[ i + k ] < min[ k ] ? v[ i + k ] : min[ k ];
+        max[ k ] = v[ i + k ] > max[ k ] ? v[ i + k ] : max[ k ];
+        sum[ k ] += v[ i + k ];
+    }
+    for (k = 1; k < LANES; k++) {
+        min[ 0 ] = min[ k ] < min[ 0 ] ? min[ k ] : min[ 0 ];
+        max[ 0 ] = max[ k ] > max[ 0 ] ? max[ k ] : max[ 0 ];
+        sum[ 0 ] += sum[ k ];
+    }
+    mean = sum[ 0 ] / n;
+
+    for (i = 0; i + LANES <= n; i += LANES) {
+        for (k = 0; k < LANES; k++) {
+            m2[ k ] += ( v[ i + k ] - mean ) * ( v[ i + k ] - mean );
+        }
+    }
+    for (k = 0; i + k < n; k++) {
+        m2[ k ] += ( v[ i + k ] - mean ) * ( v[ i + k ] - mean );
+    }
+
+    s->n = n;
+    s->min = min[ 0 ];
+    s->max = max[ 0 ];
+    s->mean = mean;
+    s->m2 = m2[ 0 ] + m2[ 1 ] + m2[ 2 ] + m2[ 3 ];
+}
+
+static void stats_merge( struct stats *a, const struct stats *b )
+{
+    double n, delta;
+
+    if (b->n == 0) {
+        return;
+    }
+    if (a->n == 0) {
+        *a = *b;
+        return;
+    }
+    n = a->n + b->n;
+    delta = b->mean - a->mean;
+    a->min = b->min < a->min ? b->min : a->min;
+    a->max = b->max > a->max ? b->max : a->max;
+    a->m2 += b->m2 + delta * delta * a->n * b->n / n;
+    a->mean += delta * b->n / n;
+    a->n += b->n;
+}
+
+/*------------------------------------------------------------------*
+ * Decodes one chunk and cuts it to the time range
+ *------------------------------------------------------------------*/
+
+static void unit_run( struct query *q, struct unit *u )
+{
+    const struct archive_map *m = u->map;
+    const unsigned char *p = m->base + u->ix->offset;
+    struct archive_chunk c;
+    uint32_t n = u->ix->count, lo = 0, hi;
+    double *t, *v, *sp;
+
+    memcpy( &c, p, sizeof c );
+    t = malloc( n * sizeof *t );
+    v = malloc( n * sizeof *v );
+    sp = q->settle ? malloc( n * sizeof *sp ) : NULL;
+    if (   t == NULL || v == NULL || ( q->settle && sp == NULL )
+        || c.count != n
+        || ! archive_column( &c, p + sizeof c, m->chunk_samples, COL_TIME, t )
+        || ! archive_column( &c, p + sizeof c, m->chunk_samples, q->col, v )
+        || ( sp && ! archive_column( &c, p + sizeof c, m->chunk_samples, COL_SETPOINT, sp ) )) {
+        u->bad = true;
+        free( t );
+        free( v );
+        free( sp );
+        return;
+    }
+
+    while (lo < n && t[ lo ] < q->from) {
+        lo++;
+    }
+    for (hi = lo; hi < n && t[ hi ] <= q->to; hi++) {
+    }
+    u->n = hi - lo;
+    if (u->n) {
+        column_stats( v + lo, u->n, &u->st );
+    }
+
+    /* The rest of the work needs the samples in order across chunks */
+
+    if (u->n && ( q->downsample > 0.0 || q->crossings || q->settle )) {
+        memmove( t, t + lo, u->n * sizeof *t );
+        memmove( v, v + lo, u->n * sizeof *v );
+        if (sp) {
+            memmove( sp, sp + lo, u->n * sizeof *sp );
+        }
+        u->t = t;
+        u->v = v;
+        u->sp = sp;
+    } else {
+        free( t );
+        free( v );
+        free( sp );
+    }
+}
+
+static void * worker( void *arg )
+{
+    struct query *q = arg;
+    uint32_t i;
+
+    while (( i = __atomic_fetch_add( &q->next, 1, __ATOMIC_RELAXED ) ) < q->units) {
+        unit_run( q, &q->unit[ i ] );
+    }
+    return NULL;
+}
+
+/*------------------------------------------------------------------*
+ * Sequential passes over one file's samples, chunk after chunk
+ *------------------------------------------------------------------*/
+
+struct scan {
+    bool have;                      /* a previous sample */
+    double t, v, sp;
+
+    double bucket;                  /* --downsample bucket being filled */
+    struct stats st;
+
+    double change;                  /* --settle: time of the setpoint change */
+    double inside;                  /* since when PV is within tolerance, or -1 */
+};
+
+static void print_bucket( const struct scan *s )
+{
+    if (s->st.n) {
+        printf("***HIST: %.3f %.10g %.10g %.10g\n", s->bucket, s->st.min, s->st.max, s->st.mean);
+    }
+}
+
+static void print_settle( const struct scan *s )
+{
+    if (s->change >= 0.0) {
+        printf("***SETL: %.3f %.10g %.3f\n", s->change, s->sp,
+                s->inside >= 0.0 ? s->inside - s->change : -1.0);
+    }
+}
+
+static void scan_unit( const struct query *q, struct scan *s, const struct unit *u )
+{
+    for (uint32_t i = 0; i < u->n; i++) {
+        double t = u->t[ i ], v = u->v[ i ];
+
+        if (q->downsample > 0.0) {
+            double bucket = floor( t / q->downsample ) * q->downsample;
+
+            if (s->st.n && bucket != s->bucket) {
+                print_bucket( s );
+                s->st.n = 0;
+            }
+            if (s->st.n == 0) {
+                s->bucket = bucket;
+                s->st.min = s->st.max = v;
+                s->st.mean = 0.0;
+            }
+            s->st.min = v < s->st.min ? v : s->st.min;
+            s->st.max = v > s->st.max ? v : s->st.max;
+            s->st.mean += ( v - s->st.mean ) / ++s->st.n;
+        }
+
+        if (q->crossings && s->have && ( s->v < q->crossing ) != ( v < q->crossing )) {
+            double at = s->t + ( t - s->t ) * ( q->crossing - s->v ) / ( v - s->v );
+
+            printf("***CROS: %.3f %s\n", at, v >= q->crossing ? "up" : "down");
+        }
+
+        if (q->settle) {
+            if (s->have && u->sp[ i ] != s->sp) {
+                print_settle( s );
+                s->change = t;
+                s->inside = -1.0;
+            }
+            s->sp = u->sp[ i ];
+            if (! ( fabs( v - s->sp ) <= q->tolerance )) {
+                s->inside = -1.0;
+            } else if (s->inside < 0.0) {
+                s->inside = t;
+            }
+        }
+
+        s->have = true;
+        s->t = t;
+        s->v = v;
+    }
+}
+
+static int usage( const char *prog )
+{
+    fprintf(stderr,
+            "Usage: %s [OPTIONS] ARCHIVE...\n"
+            "  -f, --from=TIME          Start of the range (unix time)\n"
+            "  -t, --to=TIME            End of the range (unix time)\n"
+            "  -c, --channel=NAME       temperature (default), setpoint, heater-power,\n"
+            "                             ln2-heater-power or flow-rate\n"
+            "  -s, --stats              Count, minimum, maximum, mean and standard\n"
+            "                             deviation over the range (the default)\n"
+            "  -d, --downsample=SECONDS Minimum, maximum and mean per interval\n"
+            "  -x, --crossing=VALUE     Times the channel crosses this value\n"
+            "  -S, --settle=KELVIN      Settling time after each setpoint change\n"
+            "  -e, --events[=EVENT]     Status transitions (heater-on, manual-mode,\n"
+            "                             setpoint-2, alarm, ln2-refill, ln2-empty,\n"
+            "                             sensor-break, ...), all or just EVENT\n"
+            "  -j, --threads=N          Worker threads (default: one per CPU)\n",
+            prog);
+    return 1;
+}
+
+int main( int argc, char **argv )
+{
+    static const struct option options[] = {
+        { "from",       1, NULL, 'f' },
+        { "to",         1, NULL, 't' },
+        { "channel",    1, NULL, 'c' },
+        { "stats",      0, NULL, 's' },
+        { "downsample", 1, NULL, 'd' },
+        { "crossing",   1, NULL, 'x' },
+        { "settle",     1, NULL, 'S' },
+        { "events",     2, NULL, 'e' },
+        { "threads",    1, NULL, 'j' },
+        { "help",       0, NULL, 'h' },
+        { NULL,         0, NULL, 0 }
+    };
+    struct query q;
+    struct archive_map *maps;
+    pthread_t *threads;
+    long nthreads = sysconf( _SC_NPROCESSORS_ONLN );
+    int files, opt, status = 0;
+    bool samples;
+
+    memset( &q, 0, sizeof q );
+    q.from = -INFINITY;
+    q.to = INFINITY;
+    q.col = COL_TEMPERATURE;
+    while (( opt = getopt_long( argc, argv, "f:t:c:sd:x:S:e::j:h", options, NULL ) ) != -1) {
+        switch ( opt ) {
+            case 'f' :
+                q.from = atof( optarg );
+                break;
+            case 't' :
+                q.to = atof( optarg );
+                break;
+            case 'c' :
+                q.col = archive_column_by_name( optarg );
+                if (q.col <= COL_TIME || q.col >= ARCHIVE_DOUBLE_COLUMNS) {
+                    fprintf(stderr,"FATAL: unknown channel %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's' :
+                q.stats = true;
+                break;
+            case 'd' :
+                q.downsample = atof( optarg );
+                if (q.downsample <= 0.0) {
+                    fprintf(stderr,"FATAL: downsampling interval must be positive\n");
+                    return 1;
+                }
+                break;
+            case 'x' :
+                q.crossings = true;
+                q.crossing = atof( optarg );
+                break;
+            case 'S' :
+                q.settle = true;
+                q.tolerance = atof( optarg );
+                break;
+            case 'e' :
+                q.events = true;
+                q.event = optarg ? bvt_status_event_find( optarg ) : -1;
+                if (optarg && q.event < 0) {
+                    fprintf(stderr,"FATAL: unknown event %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'j' :
+                nthreads = atol( optarg );
+                break;
+            default :
+                return usage( argv[ 0 ] );
+        }
+    }
+    files = argc - optind;
+    if (files <= 0) {
+        return usage( argv[ 0 ] );
+    }
+    if (q.settle && q.col != COL_TEMPERATURE) {
+        fprintf(stderr,"FATAL: --settle works on the temperature channel\n");
+        return 1;
+    }
+    if (! q.stats && q.downsample == 0.0 && ! q.crossings && ! q.settle && ! q.events) {
+        q.stats = true;
+    }
+    samples = q.stats || q.downsample > 0.0 || q.crossings || q.settle;
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+
+    /* Map every file and make a unit of work of every chunk in range */
+
+    maps = calloc( files, sizeof *maps );
+    if (maps == NULL) {
+        return 1;
+    }
+    for (int f = 0; f < files; f++) {
+        if (! archive_map( argv[ optind + f ], &maps[ f ] )) {
+            status = 1;
+            continue;
+        }
+        for (uint32_t i = archive_find( &maps[ f ], q.from );
+             samples && i < maps[ f ].chunks && maps[ f ].index[ i ].t_first <= q.to; i++) {
+            q.units++;
+        }
+    }
+    q.unit = calloc( q.units ? q.units : 1, sizeof *q.unit );
+    if (q.unit == NULL) {
+        return 1;
+    }
+    q.units = 0;
+    for (int f = 0; f < files; f++) {
+        for (uint32_t i = archive_find( &maps[ f ], q.from );
+             samples && i < maps[ f ].chunks && maps[ f ].index[ i ].t_first <= q.to; i++) {
+            q.unit[ q.units ].map = &maps[ f ];
+            q.unit[ q.units ].ix = &maps[ f ].index[ i ];
+            q.units++;
+        }
+    }
+
+    if (nthreads > q.units) {
+        nthreads = q.units ? q.units : 1;
+    }
+    threads = calloc( nthreads, sizeof *threads );
+    if (threads == NULL) {
+        return 1;
+    }
+    /* This thread is one of the workers */
+
+    for (long i = 1; i < nthreads; i++) {
+        if (pthread_create( &threads[ i ], NULL, worker, &q )) {
+            nthreads = i;
+            break;
+        }
+    }
+    worker( &q );
+    for (long i = 1; i < nthreads; i++) {
+        pthread_join( threads[ i ], NULL );
+    }
+
+    /* Put the results together, file by file */
+
+    for (uint32_t u = 0, f = 0; f < (uint32_t) files; f++) {
+        struct stats st = { 0, 0.0, 0.0, 0.0, 0.0 };
+        struct scan s;
+
+        if (maps[ f ].base == NULL) {
+            continue;
+        }
+        memset( &s, 0, sizeof s );
+        s.change = -1.0;
+        s.inside = -1.0;
+        if (files > 1) {
+            printf("***FILE: %s\n", argv[ optind + f ]);
+        }
+        if (q.events && maps[ f ].events_base == NULL) {
+            fprintf(stderr,"WARNING: %s has no event index\n", argv[ optind + f ]);
+        }
+        for (uint32_t i = q.events ? archive_find_event( &maps[ f ], q.from ) : maps[ f ].events;
+             i < maps[ f ].events && maps[ f ].event[ i ].time <= q.to; i++) {
+            const struct archive_event *ev = &maps[ f ].event[ i ];
+
+            if (ev->event < BVT_STATUS_EVENTS && ( q.event < 0 || ev->event == q.event )) {
+                printf("***EVNT: %.3f %s %s\n", ev->time, bvt_status_events[ ev->event ].name,
+                        ev->state ? "ON" : "OFF");
+            }
+        }
+        for ( ; u < q.units && q.unit[ u ].map == &maps[ f ]; u++) {
+            if (q.unit[ u ].bad) {
+                fprintf(stderr,"WARNING: %s: skipping a damaged chunk at offset %llu\n",
+                        argv[ optind + f ], (unsigned long long) q.unit[ u ].ix->offset);
+                status = 1;
+                continue;
+            }
+            stats_merge( &st, &q.unit[ u ].st );
+            if (q.unit[ u ].t) {
+                scan_unit( &q, &s, &q.unit[ u ] );
+            }
+            free( q.unit[ u ].t );
+            free( q.unit[ u ].v );
+            free( q.unit[ u ].sp );
+        }
+        if (q.downsample > 0.0) {
+            print_bucket( &s );
+        }
+        if (q.settle) {
+            print_settle( &s );
+        }
+        if (q.stats) {
+            printf("***STAT: %llu %.10g %.10g %.10g %.10g\n", (unsigned long long) st.n,
+                    st.min, st.max, st.mean, st.n > 1 ? sqrt( st.m2 / ( st.n - 1 ) ) : 0.0);
+        }
+        archive_unmap( &maps[ f ] );
+    }
+    free( threads );
+    free( q.unit );
+    free( maps );
+    return status;
+}
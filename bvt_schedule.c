@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "bvt_schedule.h"
+extern bool verboseFlag;
+
+/* The writes making a band's settings effective, in order. The first
+   time, the settings to restore at the end are read beforehand. */
+
+enum { OP_SAVE_XS, OP_SAVE_XP, OP_SAVE_TI, OP_SAVE_TD, OP_SAVE_HB, OP_SAVE_LB,
+       OP_READ_XS, OP_WRITE_XS, OP_XP, OP_TI, OP_TD, OP_HB, OP_LB, OPS };
+
+/*------------------------------------------------------------------*
+ * Reads a schedule from a file with one band per line, "<from K> <to K>
+ * <XP> <TI> <TD> [<HB> <LB>]" or "<from K> <to K> pid1|pid2". Blank
+ * lines and anything after '#' are ignored. Where bands overlap, the
+ * first one listed wins.
+ *------------------------------------------------------------------*/
+
+bool schedule_load( struct bvt_schedule * s, const char * path )
+{
+    FILE *f = fopen( path, "r" );
+    char line[ 256 ];
+    int n = 0;
+
+    if (f == NULL) {
+        fprintf(stderr,"FATAL: cannot open gain schedule %s\n", path);
+        return false;
+    }
+    memset( s, 0, sizeof *s );
+    s->current = -1;
+    s->op = SCHEDULE_DONE;
+    while ( fgets( line, sizeof line, f ) != NULL ) {
+        struct schedule_band b;
+        char *hash = strchr( line, '#' );
+        char set[ 8 ];
+        int fields;
+        bool ok;
+
+        n++;
+        if (hash) {
+            *hash = '\0';
+        }
+        memset( &b, 0, sizeof b );
+        b.set = 1;
+        fields = sscanf( line, "%lf %lf %lf %lf %lf %lf %lf", &b.from, &b.to,
+                         &b.xp, &b.ti, &b.td, &b.hb, &b.lb );
+        if (fields == EOF) {
+            continue;
+        }
+        if (fields == 2 && sscanf( line, "%*f %*f %7s", set ) == 1
+            && ( ! strcmp( set, "pid1" ) || ! strcmp( set, "pid2" ) )) {
+            b.set = set[ 3 ] - '0';
+            ok = true;
+        } else {
+            b.terms = true;
+            ok =  ( fields == 5 || fields == 7 )
+               && b.xp > 0.0 && b.xp <= MAX_PROPORTIONAL_BAND
+               && b.ti >= 0.0 && b.ti <= MAX_INTEGRAL_TIME
+               && b.td >= 0.0 && b.td <= MAX_DERIVATIVE_TIME
+               && ( fields == 5 || ( b.hb > 0.0 && b.hb <= MAX_CUTBACK && b.lb > 0.0 && b.lb <= MAX_CUTBACK ) );
+        }
+        if (! ok || ! ( b.from < b.to ) || s->bands == SCHEDULE_MAX_BANDS) {
+            fprintf(stderr,"FATAL: %s:%d: bad or too many bands\n", path, n);
+            fclose( f );
+            return false;
+        }
+        s->band[ s->bands++ ] = b;
+    }
+    fclose( f );
+    if (s->bands == 0) {
+        fprintf(stderr,"FATAL: gain schedule %s has no bands\n", path);
+        return false;
+    }
+    if (verboseFlag) {
+        printf("Loaded a gain schedule of %d bands from %s\n", s->bands, path);
+    }
+    return true;
+}
+
+/*------------------------------------------------------------------*
+ * Looks at a new sample, and starts on the settings of another band if
+ * PV has clearly moved into it. A sample without a reading (PV 0, as an
+ * unread value comes back) changes nothing.
+ *------------------------------------------------------------------*/
+
+void schedule_update( struct bvt_schedule * s, const struct bvt_state * st )
+{
+    double pv = st->temperature;
+
+    if (! ( pv > 0.0 )) {
+        return;
+    }
+    s->active_set = st->xs & ACTIVE_PID_FLAG ? 2 : 1;
+    if (s->current >= 0) {
+        const struct schedule_band *b = &s->band[ s->current ];
+
+        if (pv >= b->from - SCHEDULE_HYSTERESIS && pv <= b->to + SCHEDULE_HYSTERESIS) {
+            return;
+        }
+    }
+    for (int i = 0; i < s->bands; i++) {
+        if (pv >= s->band[ i ].from && pv < s->band[ i ].to) {
+            if (i != s->current) {
+                s->current = i;
+                s->op = 0;
+                if (verboseFlag) {
+                    printf("Gain schedule: PV %.1f K, switching to band %d (%.1f-%.1f K)\n",
+                            pv, i + 1, s->band[ i ].from, s->band[ i ].to);
+                }
+            }
+            return;
+        }
+    }
+}
+
+bool schedule_due( const struct bvt_schedule * s )
+{
+    return s->op != SCHEDULE_DONE;
+}
+
+static bool op_needed( const struct bvt_schedule * s, const struct schedule_band * b, int op )
+{
+    switch ( op ) {
+        case OP_SAVE_XS : case OP_SAVE_XP : case OP_SAVE_TI :
+        case OP_SAVE_TD : case OP_SAVE_HB : case OP_SAVE_LB :
+            return ! s->saved;
+        case OP_READ_XS : case OP_WRITE_XS :
+            return s->active_set != b->set;
+        case OP_XP : case OP_TI : case OP_TD :
+            return b->terms;
+        case OP_HB : case OP_LB :
+            return b->terms && b->hb > 0.0;
+    }
+    return false;
+}
+
+static void op_next( struct bvt_schedule * s )
+{
+    const struct schedule_band *b = &s->band[ s->current ];
+
+    while ( s->op < OPS && ! op_needed( s, b, s->op ) ) {
+        s->op++;
+    }
+    if (s->op == OPS) {
+        s->op = SCHEDULE_DONE;
+        if (verboseFlag) {
+            printf("Gain schedule: band %d in force\n", s->current + 1);
+        }
+    }
+}
+
+/* Makes PID set `set' active, from the XS just read */
+
+static void write_active_set( unsigned int xs, int set, struct sp_port * port_choice )
+{
+    eurotherm902s_set_xs( set == 2 ? xs | ACTIVE_PID_FLAG : xs & ~ACTIVE_PID_FLAG, port_choice );
+}
+
+/*------------------------------------------------------------------*
+ * Does the next serial transaction of a band change
+ *------------------------------------------------------------------*/
+
+void schedule_step( struct bvt_schedule * s, struct sp_port * port_choice )
+{
+    const struct schedule_band *b;
+
+    if (! schedule_due( s )) {
+        return;
+    }
+    op_next( s );
+    if (! schedule_due( s )) {
+        return;
+    }
+    b = &s->band[ s->current ];
+
+    switch ( s->op ) {
+        case OP_SAVE_XS :
+            s->xs = eurotherm902s_get_xs( port_choice );
+            s->active_set = s->original.set = s->xs & ACTIVE_PID_FLAG ? 2 : 1;
+            break;
+        case OP_SAVE_XP :
+            s->original.xp = eurotherm902s_get_proportional_band( port_choice );
+            break;
+        case OP_SAVE_TI :
+            s->original.ti = eurotherm902s_get_integral_time( port_choice );
+            break;
+        case OP_SAVE_TD :
+            s->original.td = eurotherm902s_get_derivative_time( port_choice );
+            break;
+        case OP_SAVE_HB :
+            s->original.hb = eurotherm902s_get_cutback_high( port_choice );
+            break;
+        case OP_SAVE_LB :
+            s->original.lb = eurotherm902s_get_cutback_low( port_choice );
+            s->saved = true;
+            break;
+        case OP_READ_XS :
+            s->xs = eurotherm902s_get_xs( port_choice );
+            s->active_set = s->xs & ACTIVE_PID_FLAG ? 2 : 1;
+            break;
+        case OP_WRITE_XS :
+            write_active_set( s->xs, b->set, port_choice );
+            s->active_set = b->set;
+            break;
+        case OP_XP :
+            eurotherm902s_set_proportional_band( b->xp, port_choice );
+            break;
+        case OP_TI :
+            eurotherm902s_set_integral_time( b->ti, port_choice );
+            break;
+        case OP_TD :
+            eurotherm902s_set_derivative_time( b->td, port_choice );
+            break;
+        case OP_HB :
+            eurotherm902s_set_cutback_high( b->hb, port_choice );
+            break;
+        case OP_LB :
+            eurotherm902s_set_cutback_low( b->lb, port_choice );
+            break;
+    }
+    s->op++;
+    op_next( s );
+}
+
+/*------------------------------------------------------------------*
+ * Puts back the settings found before the first band change, all at
+ * once as the daemon is stopping
+ *------------------------------------------------------------------*/
+
+void schedule_restore( struct bvt_schedule * s, struct sp_port * port_choice )
+{
+    if (! s->saved) {
+        return;
+    }
+    eurotherm902s_set_proportional_band( s->original.xp, port_choice );
+    eurotherm902s_set_integral_time( s->original.ti, port_choice );
+    eurotherm902s_set_derivative_time( s->original.td, port_choice );
+    eurotherm902s_set_cutback_high( s->original.hb, port_choice );
+    eurotherm902s_set_cutback_low( s->original.lb, port_choice );
+    s->xs = eurotherm902s_get_xs( port_choice );
+    if (( s->xs & ACTIVE_PID_FLAG ? 2 : 1 ) != s->original.set) {
+        write_active_set( s->xs, s->original.set, port_choice );
+    }
+    if (verboseFlag) {
+        printf("Gain schedule: original PID settings restored\n");
+    }
+}
@@ -0,0 +1,58 @@
+/* Gain scheduling run by the daemon.
+ *
+ * How fast the sample responds to the heater changes a lot between
+ * 100 K and 400 K, so one PID tuning is a compromise over the whole
+ * range. A schedule is a table of temperature bands, each with either
+ * its own XP, TI and TD (and optionally the cutbacks HB and LB), which
+ * are written to PID set 1, or "pid1" / "pid2" to just make one of the
+ * controller's two PID sets active (the ACTIVE_PID_FLAG bit of XS), set
+ * up beforehand on the front panel or with the PID options.
+ *
+ * The daemon looks at every sample, and once PV has moved more than
+ * SCHEDULE_HYSTERESIS past the edges of the band in force into another
+ * band, writes that band's settings, one serial transaction per pass of
+ * its loop like a profile step. Outside all bands, and over samples that
+ * could not be read, the settings stay as they are. The settings found before the first change are put back
+ * when the daemon stops. While a schedule runs it owns the PID terms:
+ * writes from clients last until the next band change.
+ */
+#pragma once
+#if ! defined BVT_SCHEDULE_HEADER
+#define BVT_SCHEDULE_HEADER
+
+#include <stdbool.h>
+#include "serial_jjm.h"
+#include "bvt_shm.h"
+
+#define SCHEDULE_MAX_BANDS    32
+#define SCHEDULE_HYSTERESIS   1.0   /* K past a band edge before switching */
+
+struct schedule_band {
+    double from, to;                /* K */
+    int set;                        /* PID set made active, 1 or 2 */
+    bool terms;                     /* write XP, TI and TD (PID set 1 only) */
+    double xp, ti, td;
+    double hb, lb;                  /* 0 to leave alone */
+};
+
+struct bvt_schedule {
+    struct schedule_band band[ SCHEDULE_MAX_BANDS ];
+    int bands;
+
+    int current;                    /* band in force, or being written; -1 for none */
+    int op;                         /* next write for it, SCHEDULE_DONE when done */
+    int active_set;                 /* as last sampled */
+    unsigned int xs;                /* as read just before writing it */
+    bool saved;                     /* the original settings below have been read */
+    struct schedule_band original;
+};
+
+#define SCHEDULE_DONE  -1
+
+bool schedule_load( struct bvt_schedule * s, const char * path );
+void schedule_update( struct bvt_schedule * s, const struct bvt_state * st );
+bool schedule_due( const struct bvt_schedule * s );
+void schedule_step( struct bvt_schedule * s, struct sp_port * port_choice );
+void schedule_restore( struct bvt_schedule * s, struct sp_port * port_choice );
+
+#endif
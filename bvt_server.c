@@ -0,0 +1,1400 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <math.h>
+
+#include "bvt_server.h"
+#include "convenient_wrapper_functions.h"
+extern bool verboseFlag;
+
+/*------------------------------------------------------------------*
+ * Connections and the request queue
+ *------------------------------------------------------------------*/
+
+struct outbuf {
+    char *data;
+    size_t len, cap;
+};
+
+/* Requests are executed by class, across connections. Within a
+   connection, nothing overtakes an earlier write (heater-on then
+   heater-off must leave the heater off, a read after a write sees it),
+   but writes do overtake the connection's own earlier reads, so a
+   heater-off never waits behind a backlog of reads. Replies still go
+   out in request order: a request that is done early keeps its reply on
+   its connection's list until everything before it is done */
+
+struct request {
+    struct client *client;          /* NULL once the client has gone */
+    const struct server_command *cmd;
+    double arg;
+    struct outbuf out;
+    int frame;                      /* how to frame out in binary mode */
+    int mode;                       /* mode to switch to once sent, or -1 */
+    bool done;
+    int waiting;                    /* earlier writes of the connection not yet done */
+    struct request *next;           /* in the class queue */
+    struct request *cnext;          /* in the client's reply order */
+};
+
+struct subscription {
+    int event;                      /* bvt_status_events[ ], or EVENT_PV_* */
+    double threshold;
+    int state;                      /* last state sent, -1 if none yet */
+};
+
+/* What the client has reconstructed of the sample stream so far, in
+   the units the deltas are sent in */
+
+struct stream_state {
+    bool key;                       /* next sample must be a key frame */
+    int since_key;
+    uint64_t seq;
+    int64_t time_ms, pv, sp, op;    /* ms, 0.1 K, 0.1 K, 0.1 % */
+    uint32_t flow_index;
+    uint16_t is, sw, xs;
+};
+
+struct client {
+    int fd;                         /* -1 if the slot is free */
+    char in[ SERVER_LINE_MAX ];
+    size_t in_len;
+    struct outbuf out;
+    struct request *first, *last;   /* replies not yet sent, oldest first */
+    int queued;
+    int writes_undone;              /* writes still to be carried out */
+    struct subscription sub[ SERVER_MAX_SUBSCRIPTIONS ];
+    int subs;
+    bool binary;                    /* replies are sent as binary frames */
+    bool want_binary;               /* ... once the replies before are out */
+    bool streaming;                 /* every sample is sent */
+    struct stream_state stream;
+    bool background;                /* reads are logging traffic */
+    bool closing;                   /* close once the replies are sent */
+};
+
+struct bvt_server {
+    int listen_fd;
+    struct bvt_state last;          /* latest sample, seq 0 if none yet */
+    const struct bvt_history *history;
+    struct bvt_profile *profile;
+    const struct bvt_schedule *schedule;
+    const struct bvt_mpc *mpc;
+    const struct bvt_ln2 *ln2;
+    struct client client[ SERVER_MAX_CLIENTS ];
+    struct request *head[ REQUEST_CLASSES ];
+    struct request *tail[ REQUEST_CLASSES ];
+};
+
+typedef void ( *command_handler )( struct outbuf *c, const char *name,
+                                   double arg, struct sp_port *port_choice );
+
+struct server_command {
+    const char *name;
+    int cls;
+    bool has_arg;
+    double min, max;                /* allowed range of the argument */
+    command_handler run;
+};
+
+/*------------------------------------------------------------------*
+ * Replies. A client may have gone away by the time its request is
+ * carried out (c == NULL): the request still is, but the reply is lost.
+ *------------------------------------------------------------------*/
+
+static void outbuf_append( struct outbuf *c, const void *data, size_t len )
+{
+    if (c->len + len + 1 > c->cap) {
+        size_t cap = c->cap ? c->cap : 256;
+        char *out;
+
+        while (c->len + len + 1 > cap) {
+            cap *= 2;
+        }
+        out = realloc( c->data, cap );
+        if (out == NULL) {
+            return;
+        }
+        c->data = out;
+        c->cap = cap;
+    }
+    memcpy( c->data + c->len, data, len );
+    c->len += len;
+    c->data[ c->len ] = '\0';
+}
+
+static void reply( struct outbuf *c, const char *fmt, ... )
+{
+    char buf[ 256 ];
+    va_list ap;
+    int len;
+
+    if (c == NULL) {
+        return;
+    }
+    va_start( ap, fmt );
+    len = vsnprintf( buf, sizeof buf, fmt, ap );
+    va_end( ap );
+    if (len >= (int) sizeof buf) {
+        len = sizeof buf - 1;
+    }
+    outbuf_append( c, buf, len );
+}
+
+static void reply_ok( struct outbuf *c, const char *name )
+{
+    reply( c, "***OK  : %s\n", name );
+}
+
+/*------------------------------------------------------------------*
+ * Binary framing: a type byte, the payload length as a varint, and the
+ * payload (see bvt_server.h)
+ *------------------------------------------------------------------*/
+
+static size_t put_varint( unsigned char *buf, uint64_t v )
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        buf[ n++ ] = ( v & 0x7F ) | 0x80;
+        v >>= 7;
+    }
+    buf[ n++ ] = v;
+    return n;
+}
+
+static size_t put_zigzag( unsigned char *buf, int64_t v )
+{
+    return put_varint( buf, ( (uint64_t) v << 1 ) ^ (uint64_t) ( v >> 63 ) );
+}
+
+static void client_send( struct client *c, int frame, const void *data, size_t len )
+{
+    unsigned char head[ 11 ];
+    size_t n;
+
+    if (c->binary) {
+        head[ 0 ] = frame;
+        n = 1 + put_varint( head + 1, len );
+        outbuf_append( &c->out, ( const char * ) head, n );
+    }
+    outbuf_append( &c->out, data, len );
+}
+
+static void client_text( struct client *c, const char *fmt, ... )
+{
+    char buf[ 256 ];
+    va_list ap;
+    int len;
+
+    va_start( ap, fmt );
+    len = vsnprintf( buf, sizeof buf, fmt, ap );
+    va_end( ap );
+    if (len >= (int) sizeof buf) {
+        len = sizeof buf - 1;
+    }
+    client_send( c, FRAME_TEXT, buf, len );
+}
+
+/*------------------------------------------------------------------*
+ * Command handlers, mirroring what main() does for each option
+ *------------------------------------------------------------------*/
+
+static void cmd_read_temperature( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***TEMP: %f\n", eurotherm902s_get_temperature( p ) );
+}
+
+static void cmd_check_sensor_break( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***SBC : %s\n", eurotherm902s_check_sensor_break( p ) == SET ? "FAIL" : "OK" );
+}
+
+static void cmd_check_heater( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    if (bvt3000_check_heater( p ) == HEATER_OVERHEATING) {
+        bvt3000_set_heater_state( UNSET, p );
+        fprintf(stderr,"Heater overheating, heater disabled.\n");
+        reply( c, "***HCC : FAIL\n" );
+    } else {
+        reply( c, "***HCC : OK\n" );
+    }
+}
+
+static void cmd_get_heater_state( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***HSC : %s\n", bvt3000_get_heater_state( p ) == SET ? "ON" : "OFF" );
+}
+
+static void cmd_heater_on( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    bvt3000_set_heater_state( SET, p );
+    cmd_get_heater_state( c, name, arg, p );
+}
+
+static void cmd_heater_off( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    bvt3000_set_heater_state( UNSET, p );
+    cmd_get_heater_state( c, name, arg, p );
+}
+
+static void cmd_get_heater_power_limit( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***HPWL: %lf\n", eurotherm902s_get_heater_power_limit( p ) );
+}
+
+static void cmd_set_heater_power_limit( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    eurotherm902s_set_heater_power_limit( arg, p );
+    reply_ok( c, name );
+}
+
+static void cmd_get_heater_power( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***HPWR: %lf\n", eurotherm902s_get_heater_power( p ) );
+}
+
+/* Streamed values are posted, so one equal to what the device already
+   has is not sent again, and replaces anything a control loop still has
+   posted. They go out before the reply, which says whether the device
+   took them. */
+
+static void reply_posted( struct outbuf *c, const char *name, struct sp_port *p )
+{
+    if (bvt3000_flush_posted_writes( p ) < 0) {
+        reply( c, "***ERR : %s: not acknowledged by the device\n", name );
+    } else {
+        reply_ok( c, name );
+    }
+}
+
+static void cmd_set_heater_power( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    eurotherm902s_post_heater_power( arg );
+    reply_posted( c, name, p );
+}
+
+static void cmd_enable_pid_control( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) arg;
+    eurotherm902s_set_mode( AUTOMATIC_MODE, p );
+    reply_ok( c, name );
+}
+
+static void cmd_manual_mode( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) arg;
+    eurotherm902s_set_mode( MANUAL_MODE, p );
+    reply_ok( c, name );
+}
+
+static void cmd_get_mode( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***PIDM: %s\n", eurotherm902s_get_mode( p ) == MANUAL_MODE ? "MANUAL" : "AUTO" );
+}
+
+static void cmd_get_gas_flow_rate( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    unsigned int gfr = bvt3000_get_flow_rate( p );
+
+    (void) arg;
+    if (gfr > 15) {
+        reply( c, "***ERR : %s: invalid flow rate index %u\n", name, gfr );
+        return;
+    }
+    reply( c, "***GASR: %lf\n", translate_flow_rate( gfr ) );
+}
+
+static void cmd_set_gas_flow_rate( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    if (bvt3000_get_heater_state( p ) != SET) {
+        reply( c, "***ERR : %s: cannot change gas flow rate with heater off\n", name );
+        return;
+    }
+    if (set_flow_rate( arg, p ) != 0) {
+        reply( c, "***ERR : %s: not acknowledged by the device\n", name );
+    } else {
+        reply_ok( c, name );
+    }
+}
+
+static void cmd_get_temperature_setpoint( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***TSP : %lf\n", eurotherm902s_get_current_setpoint( p ) );
+}
+
+static void cmd_set_temperature_setpoint( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    eurotherm902s_post_setpoint( eurotherm902s_get_active_setpoint( p ), arg );
+    reply_posted( c, name, p );
+}
+
+static void cmd_get_eurotherm_status( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***EALM: %s\n", eurotherm902s_get_alarm_state( p ) == SET ? "ON" : "OFF" );
+}
+
+static void cmd_lock_keypad( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    eurotherm902s_lock_keyboard( (bool) arg, p );
+    reply_ok( c, name );
+}
+
+static void cmd_get_proportional_band( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***PPID: %lf\n", eurotherm902s_get_proportional_band( p ) );
+}
+
+static void cmd_set_proportional_band( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    eurotherm902s_set_proportional_band( arg, p );
+    reply_ok( c, name );
+}
+
+static void cmd_get_integral_time( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***IPID: %lf\n", eurotherm902s_get_integral_time( p ) );
+}
+
+static void cmd_set_integral_time( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    eurotherm902s_set_integral_time( arg, p );
+    reply_ok( c, name );
+}
+
+static void cmd_get_differential_time( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***DPID: %lf\n", eurotherm902s_get_derivative_time( p ) );
+}
+
+static void cmd_set_differential_time( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    eurotherm902s_set_derivative_time( arg, p );
+    reply_ok( c, name );
+}
+
+static void cmd_get_ln2_heater_state( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***N2HE: %s\n", bvt3000_get_ln2_heater_state( p ) == SET ? "ON" : "OFF" );
+}
+
+static void cmd_set_ln2_heater_state( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    bvt3000_set_ln2_heater_state( (bool) arg, p );
+    reply_ok( c, name );
+}
+
+static void cmd_get_ln2_heater_power( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***N2HP: %lf\n", bvt3000_get_ln2_heater_power( p ) );
+}
+
+static void cmd_set_ln2_heater_power( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    bvt3000_set_ln2_heater_power( arg, p );
+    reply_ok( c, name );
+}
+
+static void cmd_check_ln2_heater( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    int result = bvt3000_check_ln2_heater( p );
+
+    (void) name; (void) arg;
+    reply( c, "***N2TK: %s\n", result == LN2_TANK_EMPTY ? "EMPTY"
+                              : result == LN2_NEEDS_REFILL ? "FILL_ME" : "OK" );
+}
+
+static void cmd_get_high_cutback( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***HCUT: %lf\n", eurotherm902s_get_cutback_high( p ) );
+}
+
+static void cmd_set_high_cutback( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    eurotherm902s_set_cutback_high( arg, p );
+    reply_ok( c, name );
+}
+
+static void cmd_get_low_cutback( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***LCUT: %lf\n", eurotherm902s_get_cutback_low( p ) );
+}
+
+static void cmd_set_low_cutback( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    eurotherm902s_set_cutback_low( arg, p );
+    reply_ok( c, name );
+}
+
+static void cmd_get_adaptive_tune_level( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    (void) name; (void) arg;
+    reply( c, "***ADTR: %lf\n", eurotherm902s_get_adaptive_tune_trigger( p ) );
+}
+
+static void cmd_set_adaptive_tune_level( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    eurotherm902s_set_adaptive_tune_trigger( arg, p );
+    reply_ok( c, name );
+}
+
+static void cmd_status_all( struct outbuf *c, const char *name, double arg, struct sp_port *p )
+{
+    cmd_check_sensor_break( c, name, arg, p );
+    cmd_check_heater( c, name, arg, p );
+    cmd_get_heater_state( c, name, arg, p );
+    cmd_get_mode( c, name, arg, p );
+    cmd_get_eurotherm_status( c, name, arg, p );
+}
+
+/* Argument ranges are checked here, since the driver asserts on them
+   and a bad request must not bring the daemon down */
+
+static const struct server_command commands[ ] = {
+    { "heater-off",               CLASS_EMERGENCY,   false, 0, 0, cmd_heater_off },
+    { "check-heater",             CLASS_EMERGENCY,   false, 0, 0, cmd_check_heater },
+    { "heater-on",                CLASS_CONTROL,     false, 0, 0, cmd_heater_on },
+    { "set-heater-power-limit",   CLASS_CONTROL,     true,  0, 100, cmd_set_heater_power_limit },
+    { "set-heater-power",         CLASS_CONTROL,     true,  0, 100, cmd_set_heater_power },
+    { "enable-PID-control",       CLASS_CONTROL,     false, 0, 0, cmd_enable_pid_control },
+    { "manual-mode",              CLASS_CONTROL,     false, 0, 0, cmd_manual_mode },
+    { "set-gas-flow-rate",        CLASS_CONTROL,     true,  0, 2000, cmd_set_gas_flow_rate },
+    { "set-temperature-setpoint", CLASS_CONTROL,     true,  MIN_SETPOINT, MAX_SETPOINT, cmd_set_temperature_setpoint },
+    { "lock-keypad",              CLASS_CONTROL,     true,  0, 1, cmd_lock_keypad },
+    { "set-proportional-band",    CLASS_CONTROL,     true,  0, MAX_PROPORTIONAL_BAND, cmd_set_proportional_band },
+    { "set-integral-time",        CLASS_CONTROL,     true,  0, MAX_INTEGRAL_TIME, cmd_set_integral_time },
+    { "set-differential-time",    CLASS_CONTROL,     true,  0, MAX_DERIVATIVE_TIME, cmd_set_differential_time },
+    { "set-ln2-heater-state",     CLASS_CONTROL,     true,  0, 1, cmd_set_ln2_heater_state },
+    { "set-ln2-heater-power",     CLASS_CONTROL,     true,  0, 100, cmd_set_ln2_heater_power },
+    { "set-high-cutback",         CLASS_CONTROL,     true,  0, MAX_CUTBACK, cmd_set_high_cutback },
+    { "set-low-cutback",          CLASS_CONTROL,     true,  0, MAX_CUTBACK, cmd_set_low_cutback },
+    { "set-adaptive-tune-level",  CLASS_CONTROL,     true,  0, MAX_AT_TRIGGER_LEVEL, cmd_set_adaptive_tune_level },
+    { "read-temperature",         CLASS_INTERACTIVE, false, 0, 0, cmd_read_temperature },
+    { "check-sensor-break",       CLASS_INTERACTIVE, false, 0, 0, cmd_check_sensor_break },
+    { "get-heater-state",         CLASS_INTERACTIVE, false, 0, 0, cmd_get_heater_state },
+    { "get-heater-power-limit",   CLASS_INTERACTIVE, false, 0, 0, cmd_get_heater_power_limit },
+    { "get-heater-power",         CLASS_INTERACTIVE, false, 0, 0, cmd_get_heater_power },
+    { "get-mode",                 CLASS_INTERACTIVE, false, 0, 0, cmd_get_mode },
+    { "get-gas-flow-rate",        CLASS_INTERACTIVE, false, 0, 0, cmd_get_gas_flow_rate },
+    { "get-temperature-setpoint", CLASS_INTERACTIVE, false, 0, 0, cmd_get_temperature_setpoint },
+    { "get-eurotherm-status",     CLASS_INTERACTIVE, false, 0, 0, cmd_get_eurotherm_status },
+    { "get-proportional-band",    CLASS_INTERACTIVE, false, 0, 0, cmd_get_proportional_band },
+    { "get-integral-time",        CLASS_INTERACTIVE, false, 0, 0, cmd_get_integral_time },
+    { "get-differential-time",    CLASS_INTERACTIVE, false, 0, 0, cmd_get_differential_time },
+    { "get-ln2-heater-state",     CLASS_INTERACTIVE, false, 0, 0, cmd_get_ln2_heater_state },
+    { "get-ln2-heater-power",     CLASS_INTERACTIVE, false, 0, 0, cmd_get_ln2_heater_power },
+    { "check-ln2-heater",         CLASS_INTERACTIVE, false, 0, 0, cmd_check_ln2_heater },
+    { "get-high-cutback",         CLASS_INTERACTIVE, false, 0, 0, cmd_get_high_cutback },
+    { "get-low-cutback",          CLASS_INTERACTIVE, false, 0, 0, cmd_get_low_cutback },
+    { "get-adaptive-tune-level",  CLASS_INTERACTIVE, false, 0, 0, cmd_get_adaptive_tune_level },
+    { "status-all",               CLASS_INTERACTIVE, false, 0, 0, cmd_status_all },
+};
+
+#define NUM_COMMANDS ( sizeof commands / sizeof commands[ 0 ] )
+
+/*------------------------------------------------------------------*
+ * Things a client can subscribe to instead of polling for them: status
+ * bits (see bvt_shm.h), and the temperature crossing a threshold
+ *------------------------------------------------------------------*/
+
+#define EVENT_PV_ABOVE  BVT_STATUS_EVENTS
+#define EVENT_PV_BELOW  ( BVT_STATUS_EVENTS + 1 )
+#define NUM_EVENTS      ( BVT_STATUS_EVENTS + 2 )
+
+static const char * event_label( int event )
+{
+    if (event < BVT_STATUS_EVENTS) {
+        return bvt_status_events[ event ].name;
+    }
+    return event == EVENT_PV_ABOVE ? "temperature-above" : "temperature-below";
+}
+
+static int event_state( const struct subscription * sub, const struct bvt_state * st )
+{
+    switch ( sub->event ) {
+        case EVENT_PV_ABOVE :
+            /* Only drop out again once clearly back below, so noise on
+               the PV does not produce a stream of events */
+            if (sub->state == 1) {
+                return st->temperature > sub->threshold - SUBSCRIBE_HYSTERESIS;
+            }
+            return st->temperature > sub->threshold;
+        case EVENT_PV_BELOW :
+            if (sub->state == 1) {
+                return st->temperature < sub->threshold + SUBSCRIBE_HYSTERESIS;
+            }
+            return st->temperature < sub->threshold;
+    }
+    return bvt_status_event_state( sub->event, st );
+}
+
+static void event_name( char * buf, size_t size, const struct subscription * sub )
+{
+    if (sub->event >= BVT_STATUS_EVENTS) {
+        snprintf( buf, size, "%s %f", event_label( sub->event ), sub->threshold );
+    } else {
+        snprintf( buf, size, "%s", event_label( sub->event ) );
+    }
+}
+
+/* (Un)subscribing needs no device access, so it is answered at once */
+
+static void client_subscribe( struct client * c, struct outbuf * out,
+                              const char * cmd, const char * name, const char * argstr )
+{
+    struct subscription sub = { -1, 0.0, -1 };
+    char *end;
+    size_t i;
+
+    if (name == NULL) {
+        reply( out, "***ERR : %s: missing event name\n", cmd );
+        return;
+    }
+    for (i = 0; i < NUM_EVENTS; i++) {
+        if (! strcmp( name, event_label( i ) )) {
+            break;
+        }
+    }
+    if (i == NUM_EVENTS) {
+        reply( out, "***ERR : %s: unknown event %s\n", cmd, name );
+        return;
+    }
+    sub.event = i;
+    if (i >= BVT_STATUS_EVENTS) {
+        if (argstr == NULL) {
+            reply( out, "***ERR : %s: %s needs a temperature\n", cmd, name );
+            return;
+        }
+        sub.threshold = strtod( argstr, &end );
+        if (*end != '\0') {
+            reply( out, "***ERR : %s: bad temperature %s\n", cmd, argstr );
+            return;
+        }
+    }
+
+    for (i = 0; i < (size_t) c->subs; i++) {
+        if (c->sub[ i ].event == sub.event && c->sub[ i ].threshold == sub.threshold) {
+            break;
+        }
+    }
+    if (! strcmp( cmd, "unsubscribe" )) {
+        if (i < (size_t) c->subs) {
+            c->sub[ i ] = c->sub[ --c->subs ];
+        }
+    } else if (i == (size_t) c->subs) {
+        if (c->subs == SERVER_MAX_SUBSCRIPTIONS) {
+            reply( out, "***ERR : %s: too many subscriptions\n", cmd );
+            return;
+        }
+        c->sub[ c->subs++ ] = sub;
+    }
+    reply_ok( out, cmd );
+}
+
+/*------------------------------------------------------------------*
+ * Opens a non-blocking listening socket (also used for the metrics
+ * endpoint). Returns -1 on failure.
+ *------------------------------------------------------------------*/
+
+int server_listen( const char * address, int port )
+{
+    struct sockaddr_in sa;
+    int fd, one = 1;
+
+    memset( &sa, 0, sizeof sa );
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons( port );
+    if (inet_pton( AF_INET, address, &sa.sin_addr ) != 1) {
+        fprintf(stderr,"FATAL: invalid listen address %s\n", address);
+        return -1;
+    }
+
+    fd = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if (fd < 0) {
+        perror( "socket" );
+        return -1;
+    }
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one );
+    if (   bind( fd, ( struct sockaddr * ) &sa, sizeof sa ) < 0
+        || listen( fd, 16 ) < 0 ) {
+        fprintf(stderr,"FATAL: cannot listen on %s:%d: %s\n", address, port, strerror( errno ));
+        close( fd );
+        return -1;
+    }
+    if (verboseFlag) {
+        printf("Listening on %s:%d\n", address, port);
+    }
+    return fd;
+}
+
+struct bvt_server * server_open( const char * address, int port )
+{
+    struct bvt_server *srv;
+
+    srv = calloc( 1, sizeof *srv );
+    if (srv == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        srv->client[ i ].fd = -1;
+    }
+    srv->listen_fd = server_listen( address, port );
+    if (srv->listen_fd < 0) {
+        free( srv );
+        return NULL;
+    }
+    return srv;
+}
+
+static void request_free( struct request * r )
+{
+    free( r->out.data );
+    free( r );
+}
+
+static void client_drop( struct bvt_server * srv, struct client * c )
+{
+    struct request *r, *next, *prev = NULL;
+
+    (void) srv;
+    if (verboseFlag) {
+        printf("Client on fd %d disconnected\n", c->fd);
+    }
+
+    /* Requests still queued are carried out regardless, but must not be
+       answered to whoever gets the slot next */
+
+    for (r = c->first; r != NULL; r = next) {
+        next = r->cnext;
+        if (r->done) {
+            request_free( r );
+            continue;
+        }
+        /* Keep the remaining requests chained, for their ordering */
+        r->client = NULL;
+        r->cnext = NULL;
+        if (prev) {
+            prev->cnext = r;
+        }
+        prev = r;
+    }
+    close( c->fd );
+    free( c->out.data );
+    memset( c, 0, sizeof *c );
+    c->fd = -1;
+}
+
+void server_close( struct bvt_server * srv )
+{
+    struct request *r;
+
+    if (srv == NULL) {
+        return;
+    }
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (srv->client[ i ].fd >= 0) {
+            client_drop( srv, &srv->client[ i ] );
+        }
+    }
+    for (int cls = 0; cls < REQUEST_CLASSES; cls++) {
+        while ( ( r = srv->head[ cls ] ) != NULL ) {
+            srv->head[ cls ] = r->next;
+            request_free( r );
+        }
+    }
+    close( srv->listen_fd );
+    free( srv );
+}
+
+/*------------------------------------------------------------------*
+ * Fills in the descriptors the daemon should poll for us. Clients
+ * that have too much queued, or too much unread output, are not polled
+ * for input: the kernel's socket buffer then fills up and TCP flow
+ * control pushes back on the sender.
+ *------------------------------------------------------------------*/
+
+int server_pollfds( struct bvt_server * srv, struct pollfd * fds, int max )
+{
+    int n = 0;
+
+    if (max < 1 + SERVER_MAX_CLIENTS) {
+        return 0;
+    }
+    fds[ n ].fd = srv->listen_fd;
+    fds[ n++ ].events = POLLIN;
+
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        struct client *c = &srv->client[ i ];
+
+        if (c->fd < 0) {
+            continue;
+        }
+        fds[ n ].fd = c->fd;
+        fds[ n ].events = 0;
+        if (   ! c->closing
+            && c->queued < SERVER_MAX_QUEUED
+            && c->out.len < SERVER_OUT_HIGH ) {
+            fds[ n ].events |= POLLIN;
+        }
+        if (c->out.len > 0) {
+            fds[ n ].events |= POLLOUT;
+        }
+        n++;
+    }
+    return n;
+}
+
+static struct client * client_by_fd( struct bvt_server * srv, int fd )
+{
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (srv->client[ i ].fd == fd) {
+            return &srv->client[ i ];
+        }
+    }
+    return NULL;
+}
+
+static void server_accept( struct bvt_server * srv )
+{
+    int fd, one = 1;
+
+    while ( ( fd = accept4( srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC ) ) >= 0 ) {
+        struct client *c = client_by_fd( srv, -1 );
+
+        if (c == NULL) {
+            const char *busy = "***ERR : too many clients\n";
+
+            if (send( fd, busy, strlen( busy ), MSG_NOSIGNAL ) < 0) {
+                /* nothing more we can do */
+            }
+            close( fd );
+            continue;
+        }
+        setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one );
+        c->fd = fd;
+        if (verboseFlag) {
+            printf("Client connected on fd %d\n", fd);
+        }
+    }
+}
+
+/*------------------------------------------------------------------*
+ * Moves the replies that are ready, in request order, to the output
+ *------------------------------------------------------------------*/
+
+static void client_release( struct client * c )
+{
+    struct request *r;
+
+    while ( ( r = c->first ) != NULL && r->done ) {
+        client_send( c, r->frame, r->out.data, r->out.len );
+        if (r->mode >= 0) {
+            c->binary = r->mode;
+        }
+        c->first = r->cnext;
+        if (c->first == NULL) {
+            c->last = NULL;
+        }
+        c->queued--;
+        request_free( r );
+    }
+}
+
+/*------------------------------------------------------------------*
+ * Parses one request line and queues it by class
+ *------------------------------------------------------------------*/
+
+static struct request * client_request( struct client * c )
+{
+    struct request *r = calloc( 1, sizeof *r );
+
+    if (r == NULL) {
+        return NULL;
+    }
+    r->client = c;
+    r->frame = FRAME_TEXT;
+    r->mode = -1;
+    if (c->last) {
+        c->last->cnext = r;
+    } else {
+        c->first = r;
+    }
+    c->last = r;
+    c->queued++;
+    return r;
+}
+
+static void server_queue( struct bvt_server * srv, struct request * r )
+{
+    int cls = r->cmd->cls;
+
+    if (cls == CLASS_INTERACTIVE && r->client->background) {
+        cls = CLASS_BACKGROUND;
+    }
+    r->waiting = r->client->writes_undone;
+    if (r->cmd->cls <= CLASS_CONTROL) {
+        r->client->writes_undone++;
+    }
+    if (srv->tail[ cls ]) {
+        srv->tail[ cls ]->next = r;
+    } else {
+        srv->head[ cls ] = r;
+    }
+    srv->tail[ cls ] = r;
+}
+
+/*------------------------------------------------------------------*
+ * "history <channel> <seconds>": trend of a channel over the given
+ * time, answered from the daemon's in-memory history as one line per
+ * sample or aggregate, '***HIST: <time> <min> <max> <mean>'
+ *------------------------------------------------------------------*/
+
+struct history_reply {
+    struct outbuf *out;
+    int channel;
+};
+
+static void history_line( void *arg, const struct history_bucket *b )
+{
+    struct history_reply *hr = arg;
+
+    reply( hr->out, "***HIST: %.3f %g %g %g\n", b->start, b->min[ hr->channel ],
+           b->max[ hr->channel ], b->sum[ hr->channel ] / b->count );
+}
+
+static void client_history( struct bvt_server * srv, struct outbuf * out,
+                            const char * chan, const char * span )
+{
+    struct history_reply hr = { out, -1 };
+    struct timespec now;
+    double seconds;
+    char *end;
+
+    if (srv->history == NULL) {
+        reply( out, "***ERR : history: not kept\n" );
+        return;
+    }
+    if (chan == NULL || ( hr.channel = history_channel( chan ) ) < 0) {
+        reply( out, "***ERR : history: unknown channel %s\n", chan ? chan : "" );
+        return;
+    }
+    if (span == NULL || ( seconds = strtod( span, &end ) ) <= 0.0 || *end != '\0') {
+        reply( out, "***ERR : history: bad time span\n" );
+        return;
+    }
+    clock_gettime( CLOCK_REALTIME, &now );
+    history_query( srv->history, now.tv_sec + now.tv_nsec * 1e-9 - seconds,
+                   history_line, &hr );
+    reply_ok( out, "history" );
+}
+
+void server_set_history( struct bvt_server * srv, const struct bvt_history * h )
+{
+    srv->history = h;
+}
+
+/*------------------------------------------------------------------*
+ * "profile ...": edits and controls the setpoint profile. The daemon
+ * carries it out, so this needs no device access itself.
+ *------------------------------------------------------------------*/
+
+static void client_profile( struct bvt_server * srv, struct outbuf * out, const char * what )
+{
+    struct bvt_profile *p = srv->profile;
+    struct timespec ts;
+    double now;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    now = ts.tv_sec + ts.tv_nsec * 1e-9;
+
+    if (p == NULL) {
+        reply( out, "***ERR : profile: not available\n" );
+    } else if (what == NULL || ! strcmp( what, "status" )) {
+        reply( out, "***PROF: %s %d/%d %.1f\n", profile_state_name( p ),
+               p->state == PROFILE_IDLE ? 0 : p->current + 1, p->segments, p->setpoint );
+    } else if (! strcmp( what, "add" )) {
+        double v[ 3 ];
+        int i;
+
+        for (i = 0; i < 3; i++) {
+            char *s = strtok( NULL, " \t\r" ), *end;
+
+            if (s == NULL || ( v[ i ] = strtod( s, &end ), *end != '\0' )) {
+                break;
+            }
+        }
+        if (i < 3 || ! profile_add( p, v[ 0 ], v[ 1 ], v[ 2 ] )) {
+            reply( out, "***ERR : profile: add needs <K/min> <K> <s> within limits\n" );
+            return;
+        }
+        reply_ok( out, "profile" );
+    } else if (! strcmp( what, "clear" )) {
+        if (p->state != PROFILE_IDLE) {
+            reply( out, "***ERR : profile: still running\n" );
+            return;
+        }
+        profile_clear( p );
+        reply_ok( out, "profile" );
+    } else if (! strcmp( what, "start" )) {
+        if (! profile_start( p )) {
+            reply( out, "***ERR : profile: %s\n", p->segments ? "already running" : "empty" );
+            return;
+        }
+        reply_ok( out, "profile" );
+    } else if (! strcmp( what, "pause" )) {
+        profile_pause( p, now );
+        reply_ok( out, "profile" );
+    } else if (! strcmp( what, "resume" )) {
+        profile_resume( p, now );
+        reply_ok( out, "profile" );
+    } else if (! strcmp( what, "abort" )) {
+        profile_abort( p );
+        reply_ok( out, "profile" );
+    } else {
+        reply( out, "***ERR : profile: unknown action %s\n", what );
+    }
+}
+
+void server_set_profile( struct bvt_server * srv, struct bvt_profile * p )
+{
+    srv->profile = p;
+}
+
+void server_set_schedule( struct bvt_server * srv, const struct bvt_schedule * s )
+{
+    srv->schedule = s;
+}
+
+void server_set_mpc( struct bvt_server * srv, const struct bvt_mpc * c )
+{
+    srv->mpc = c;
+}
+
+void server_set_ln2( struct bvt_server * srv, const struct bvt_ln2 * n )
+{
+    srv->ln2 = n;
+}
+
+static void server_parse( struct bvt_server * srv, struct client * c, char * line )
+{
+    char *name, *argstr, *end;
+    struct request *r;
+    size_t i;
+
+    name = strtok( line, " \t\r" );
+    if (name == NULL) {
+        return;
+    }
+    argstr = strtok( NULL, " \t\r" );
+    if (! strncmp( name, "--", 2 )) {
+        name += 2;
+    }
+
+    if (! strcmp( name, "quit" )) {
+        c->closing = true;
+        return;
+    }
+    if (( r = client_request( c ) ) == NULL) {
+        c->closing = true;
+        return;
+    }
+
+    /* Anything we can answer without the device is done straight away,
+       but still only sent after the replies to earlier requests */
+
+    r->done = true;
+    if (! strcmp( name, "subscribe" ) || ! strcmp( name, "unsubscribe" )) {
+        client_subscribe( c, &r->out, name, argstr, strtok( NULL, " \t\r" ) );
+        return;
+    }
+    if (! strcmp( name, "background" ) || ! strcmp( name, "interactive" )) {
+        c->background = name[ 0 ] == 'b';
+        reply_ok( &r->out, name );
+        return;
+    }
+    if (! strcmp( name, "binary" ) || ! strcmp( name, "text" )) {
+        c->want_binary = name[ 0 ] == 'b';
+        r->mode = c->want_binary;
+        reply_ok( &r->out, name );
+        return;
+    }
+    if (! strcmp( name, "history" )) {
+        client_history( srv, &r->out, argstr, strtok( NULL, " \t\r" ) );
+        return;
+    }
+    if (! strcmp( name, "profile" )) {
+        client_profile( srv, &r->out, argstr );
+        return;
+    }
+    if (! strcmp( name, "schedule" )) {
+        if (srv->schedule == NULL) {
+            reply( &r->out, "***ERR : schedule: not available\n" );
+        } else {
+            reply( &r->out, "***SCHD: %d/%d %s\n", srv->schedule->current + 1, srv->schedule->bands,
+                   schedule_due( srv->schedule ) ? "SWITCHING" : "IN-FORCE" );
+        }
+        return;
+    }
+    if (! strcmp( name, "mpc" )) {
+        char line[ 64 ];
+
+        if (srv->mpc == NULL) {
+            reply( &r->out, "***ERR : mpc: not available\n" );
+        } else {
+            mpc_describe( srv->mpc, line, sizeof line );
+            reply( &r->out, "***MPC : %s\n", line );
+        }
+        return;
+    }
+    if (! strcmp( name, "ln2" )) {
+        char line[ 64 ];
+
+        if (srv->ln2 == NULL) {
+            reply( &r->out, "***ERR : ln2: not available\n" );
+        } else {
+            ln2_describe( srv->ln2, line, sizeof line );
+            reply( &r->out, "***LN2 : %s\n", line );
+        }
+        return;
+    }
+    if (! strcmp( name, "snapshot" ) || ! strcmp( name, "stream" )) {
+        if (! c->want_binary) {
+            reply( &r->out, "***ERR : %s: only available in binary mode\n", name );
+        } else if (name[ 1 ] == 't') {
+            c->streaming = argstr == NULL || strcmp( argstr, "off" );
+            c->stream.key = true;
+            reply_ok( &r->out, name );
+        } else if (srv->last.seq == 0) {
+            reply( &r->out, "***ERR : %s: no sample taken yet\n", name );
+        } else {
+            outbuf_append( &r->out, &srv->last, sizeof srv->last );
+            r->frame = FRAME_SNAPSHOT;
+        }
+        return;
+    }
+
+    for (i = 0; i < NUM_COMMANDS; i++) {
+        if (! strcmp( name, commands[ i ].name )) {
+            break;
+        }
+    }
+    if (i == NUM_COMMANDS) {
+        reply( &r->out, "***ERR : unknown command %s\n", name );
+        return;
+    }
+    if (commands[ i ].has_arg) {
+        if (argstr == NULL) {
+            reply( &r->out, "***ERR : %s: missing argument\n", name );
+            return;
+        }
+        r->arg = strtod( argstr, &end );
+        if (   *end != '\0'
+            || r->arg < commands[ i ].min || r->arg > commands[ i ].max ) {
+            reply( &r->out, "***ERR : %s: argument %s not in [%g, %g]\n", name, argstr,
+                   commands[ i ].min, commands[ i ].max );
+            return;
+        }
+    }
+    r->cmd = &commands[ i ];
+    r->done = false;
+    server_queue( srv, r );
+}
+
+static void server_read( struct bvt_server * srv, struct client * c )
+{
+    ssize_t len;
+    char *nl;
+
+    len = read( c->fd, c->in + c->in_len, sizeof c->in - c->in_len );
+    if (len == 0 || ( len < 0 && errno != EAGAIN && errno != EINTR )) {
+        client_drop( srv, c );
+        return;
+    }
+    if (len < 0) {
+        return;
+    }
+    c->in_len += len;
+
+    /* Pipelined requests: handle every complete line we have */
+
+    while ( ( nl = memchr( c->in, '\n', c->in_len ) ) != NULL ) {
+        size_t used = nl - c->in + 1;
+
+        *nl = '\0';
+        server_parse( srv, c, c->in );
+        memmove( c->in, c->in + used, c->in_len - used );
+        c->in_len -= used;
+    }
+    if (c->in_len == sizeof c->in) {
+        client_text( c, "***ERR : request too long\n" );
+        c->in_len = 0;
+    }
+    client_release( c );
+}
+
+static void server_write( struct bvt_server * srv, struct client * c )
+{
+    ssize_t len = send( c->fd, c->out.data, c->out.len, MSG_NOSIGNAL );
+
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            client_drop( srv, c );
+        }
+        return;
+    }
+    memmove( c->out.data, c->out.data + len, c->out.len - len );
+    c->out.len -= len;
+}
+
+/*------------------------------------------------------------------*
+ * Handles whatever poll() reported on our descriptors
+ *------------------------------------------------------------------*/
+
+void server_service( struct bvt_server * srv, const struct pollfd * fds, int n )
+{
+    for (int i = 0; i < n; i++) {
+        struct client *c;
+
+        if (fds[ i ].revents == 0) {
+            continue;
+        }
+        if (fds[ i ].fd == srv->listen_fd) {
+            server_accept( srv );
+            continue;
+        }
+        if (( c = client_by_fd( srv, fds[ i ].fd ) ) == NULL) {
+            continue;
+        }
+        if (fds[ i ].revents & POLLIN) {
+            server_read( srv, c );
+        }
+        if (c->fd >= 0 && ( fds[ i ].revents & ( POLLOUT | POLLERR | POLLHUP ) )) {
+            if (c->out.len > 0) {
+                server_write( srv, c );
+            } else if (fds[ i ].revents & ( POLLERR | POLLHUP )) {
+                client_drop( srv, c );
+            }
+        }
+    }
+
+    /* Close clients that said goodbye once everything has been sent */
+
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        struct client *c = &srv->client[ i ];
+
+        if (c->fd >= 0 && c->closing && c->out.len == 0 && c->queued == 0) {
+            client_drop( srv, c );
+        }
+    }
+}
+
+/*------------------------------------------------------------------*
+ * Called for every sample the daemon takes: pushes an event line to
+ * each subscriber whose condition changed. The first sample after
+ * subscribing always reports the current state.
+ *------------------------------------------------------------------*/
+
+static void client_stream( struct client * c, const struct bvt_state * st )
+{
+    struct stream_state *ss = &c->stream;
+    unsigned char buf[ 80 ];
+    int64_t time_ms = llround( st->mono_time * 1000.0 );
+    int64_t pv = llround( st->temperature * 10.0 );
+    int64_t sp = llround( st->working_setpoint * 10.0 );
+    int64_t op = llround( st->heater_power * 10.0 );
+    unsigned int changed = 0;
+    size_t n = 0;
+
+    /* Start over with a key frame now and then, and whenever the client
+       missed a sample */
+
+    if (   ss->key || st->seq != ss->seq + 1
+        || ++ss->since_key >= STREAM_KEY_INTERVAL ) {
+        client_send( c, FRAME_SNAPSHOT, st, sizeof *st );
+        ss->key = false;
+        ss->since_key = 0;
+    } else {
+        changed = ( st->is != ss->is )
+                | ( st->sw != ss->sw ) << 1
+                | ( st->xs != ss->xs ) << 2
+                | ( st->flow_index != ss->flow_index ) << 3;
+
+        n += put_zigzag( buf + n, time_ms - ss->time_ms );
+        n += put_zigzag( buf + n, pv - ss->pv );
+        n += put_zigzag( buf + n, sp - ss->sp );
+        n += put_zigzag( buf + n, op - ss->op );
+        buf[ n++ ] = changed;
+        if (changed & 1) {
+            n += put_varint( buf + n, st->is );
+        }
+        if (changed & 2) {
+            n += put_varint( buf + n, st->sw );
+        }
+        if (changed & 4) {
+            n += put_varint( buf + n, st->xs );
+        }
+        if (changed & 8) {
+            n += put_varint( buf + n, st->flow_index );
+        }
+        client_send( c, FRAME_DELTA, buf, n );
+    }
+
+    ss->seq = st->seq;
+    ss->time_ms = time_ms;
+    ss->pv = pv;
+    ss->sp = sp;
+    ss->op = op;
+    ss->is = st->is;
+    ss->sw = st->sw;
+    ss->xs = st->xs;
+    ss->flow_index = st->flow_index;
+}
+
+void server_publish( struct bvt_server * srv, const struct bvt_state * st )
+{
+    char name[ 64 ];
+
+    srv->last = *st;
+
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        struct client *c = &srv->client[ i ];
+
+        if (c->fd < 0) {
+            continue;
+        }
+        for (int j = 0; j < c->subs; j++) {
+            struct subscription *sub = &c->sub[ j ];
+            int state = event_state( sub, st );
+
+            if (state == sub->state) {
+                continue;
+            }
+
+            /* A client that does not keep up gets the state it has missed
+               once it has caught up, rather than every transition */
+
+            if (c->out.len >= SERVER_OUT_HIGH) {
+                sub->state = -1;
+                continue;
+            }
+            sub->state = state;
+            event_name( name, sizeof name, sub );
+            client_text( c, "***EVNT: %s %s\n", name, state ? "ON" : "OFF" );
+        }
+
+        /* A stream consumer that does not keep up loses samples, and
+           resynchronises on the key frame it gets when it is back */
+
+        if (c->streaming && c->binary) {
+            if (c->out.len < SERVER_OUT_HIGH) {
+                client_stream( c, st );
+            } else {
+                c->stream.key = true;
+            }
+        }
+    }
+}
+
+/*------------------------------------------------------------------*
+ * Finds the most urgent request that may run now, i.e. that its own
+ * connection sent no write still waiting before. Returns its class, or
+ * REQUEST_CLASSES if there is nothing to do.
+ *------------------------------------------------------------------*/
+
+static int server_next( const struct bvt_server * srv, struct request ** prev )
+{
+    struct request *r;
+    int cls;
+
+    for (cls = 0; cls < REQUEST_CLASSES; cls++) {
+        *prev = NULL;
+        for (r = srv->head[ cls ]; r != NULL; r = r->next) {
+            if (r->waiting == 0) {
+                return cls;
+            }
+            *prev = r;
+        }
+    }
+    return cls;
+}
+
+int server_pending( const struct bvt_server * srv )
+{
+    struct request *prev;
+
+    return server_next( srv, &prev );
+}
+
+/*------------------------------------------------------------------*
+ * Carries out the most urgent queued request
+ *------------------------------------------------------------------*/
+
+void server_run_next( struct bvt_server * srv, struct sp_port * port_choice )
+{
+    struct request *r, *prev, *later;
+    int cls = server_next( srv, &prev );
+
+    if (cls == REQUEST_CLASSES) {
+        return;
+    }
+    r = prev ? prev->next : srv->head[ cls ];
+    if (prev) {
+        prev->next = r->next;
+    } else {
+        srv->head[ cls ] = r->next;
+    }
+    if (srv->tail[ cls ] == r) {
+        srv->tail[ cls ] = prev;
+    }
+
+    if (verboseFlag) {
+        printf("Running %s (class %d)\n", r->cmd->name, cls);
+    }
+    r->cmd->run( r->client ? &r->out : NULL, r->cmd->name, r->arg, port_choice );
+
+    if (r->cmd->cls <= CLASS_CONTROL) {
+        for (later = r->cnext; later != NULL; later = later->cnext) {
+            later->waiting--;
+        }
+        if (r->client) {
+            r->client->writes_undone--;
+        }
+    }
+    if (r->client) {
+        r->done = true;
+        client_release( r->client );
+    } else {
+        request_free( r );
+    }
+
+    /* Once no more writes are waiting, let posted values go out */
+
+    if (server_pending( srv ) > CLASS_CONTROL) {
+        bvt3000_flush_posted_writes( port_choice );
+    }
+}
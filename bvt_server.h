@@ -0,0 +1,120 @@
+/* Line-oriented TCP server built into the daemon.
+ *
+ * Clients keep a connection open and send one command per line, using
+ * the same names as the command line options (with or without the
+ * leading "--"), e.g. "read-temperature" or "set-temperature-setpoint
+ * 310". Replies use the same '***XXXX: VALUE' lines as the CLI, in
+ * request order; commands that print nothing on the command line reply
+ * '***OK  : <command>', and anything that went wrong '***ERR : <reason>'.
+ * Requests may be pipelined.
+ *
+ * Instead of polling, a client can "subscribe <event> [temperature]"
+ * (and "unsubscribe" again) to status bits or to the temperature going
+ * above / below a threshold. The daemon then checks every sample it
+ * takes and pushes '***EVNT: <event> ON|OFF' lines whenever the state
+ * changes, starting with the current state.
+ *
+ * "history <channel> <seconds>" returns the recent trend of a channel
+ * from the daemon's memory (see bvt_history.h), as '***HIST: <time>
+ * <min> <max> <mean>' lines followed by '***OK  : history'.
+ *
+ * "profile add <K/min> <K> <s>" appends a ramp segment to the daemon's
+ * setpoint profile (see bvt_profile.h), "profile clear" empties it, and
+ * "profile start", "pause", "resume" and "abort" control it. "profile"
+ * alone reports '***PROF: <state> <segment>/<segments> <setpoint>'.
+ *
+ * "schedule" reports the gain schedule (see bvt_schedule.h) as '***SCHD:
+ * <band>/<bands> <state>', band 0 before PV first enters a band and the
+ * state IN-FORCE or SWITCHING.
+ *
+ * "mpc" reports the predictive controller (see bvt_mpc.h) as '***MPC :
+ * <state> <power> <bias>', the state RUNNING or STOPPED after a sensor
+ * break, the heater power last commanded and the model's offset in K.
+ *
+ * "ln2" reports the LN2 evaporator control (see bvt_ln2.h) as '***LN2 :
+ * <state> <power> <tank>', the state IDLE, CONTROLLING, HOLDING (while
+ * the tank needs refilling) or STOPPED (tank empty), and the tank OK,
+ * REFILL or EMPTY.
+ *
+ * After "binary" (and until "text") everything the server sends on the
+ * connection is framed as
+ *
+ *   uint8   frame type (FRAME_TEXT, FRAME_SNAPSHOT, FRAME_DELTA)
+ *   varint  payload length
+ *   bytes   payload
+ *
+ * where varints are little-endian base 128 (7 bits per byte, high bit
+ * set on all but the last byte). Text frames carry the reply lines as
+ * above. A snapshot frame is a struct bvt_state, laid out as in
+ * bvt_shm.h; "snapshot" returns the latest sample as one. "stream"
+ * ("stream off" to stop) sends every sample the daemon takes: a
+ * snapshot first, then delta frames holding, relative to the sample
+ * before,
+ *
+ *   zigzag  change of the monotonic time (ms)
+ *   zigzag  change of PV, working setpoint (0.1 K) and OP (0.1 %)
+ *   uint8   bit 0 - 3 set if IS, SW, XS, flow index changed
+ *   varint  the new value of each of those that changed
+ *
+ * with a new snapshot every STREAM_KEY_INTERVAL samples and whenever
+ * the client missed samples. Zigzag maps signed n to 2n (n >= 0) or
+ * -2n - 1 (n < 0) before it is sent as a varint.
+ *
+ * Requests from all clients are queued by class, and the daemon always
+ * carries out the most urgent one next, one serial transaction at a
+ * time, so a heater-off never waits behind reads, its own client's
+ * included. A client's writes are carried out in the order it sent
+ * them, and its reads after the writes sent before them; the replies
+ * always come back in request order.
+ */
+#pragma once
+#if ! defined BVT_SERVER_HEADER
+#define BVT_SERVER_HEADER
+
+#include <stdbool.h>
+#include <poll.h>
+#include "serial_jjm.h"
+#include "bvt_shm.h"
+#include "bvt_history.h"
+#include "bvt_profile.h"
+#include "bvt_schedule.h"
+#include "bvt_mpc.h"
+#include "bvt_ln2.h"
+
+#define SERVER_MAX_CLIENTS        32
+#define SERVER_LINE_MAX          256    /* longest request line accepted */
+#define SERVER_MAX_QUEUED         64    /* requests queued per client before we stop reading */
+#define SERVER_OUT_HIGH        65536    /* unsent reply bytes before we stop reading */
+#define SERVER_MAX_SUBSCRIPTIONS  16    /* events per client */
+#define SUBSCRIBE_HYSTERESIS     0.2    /* K, for temperature thresholds */
+#define STREAM_KEY_INTERVAL      256    /* samples between key frames */
+
+#define FRAME_TEXT      1
+#define FRAME_SNAPSHOT  2
+#define FRAME_DELTA     3
+
+enum request_class {
+    CLASS_EMERGENCY,            /* heater off, overheat check */
+    CLASS_CONTROL,              /* setpoints, flow, PID parameters ... */
+    CLASS_INTERACTIVE,          /* reads on behalf of a client */
+    CLASS_BACKGROUND,           /* reads for loggers, periodic sampling */
+    REQUEST_CLASSES
+};
+
+struct bvt_server;
+
+int server_listen( const char * address, int port );
+struct bvt_server * server_open( const char * address, int port );
+void server_close( struct bvt_server * srv );
+int server_pollfds( struct bvt_server * srv, struct pollfd * fds, int max );
+void server_service( struct bvt_server * srv, const struct pollfd * fds, int n );
+void server_set_history( struct bvt_server * srv, const struct bvt_history * h );
+void server_set_profile( struct bvt_server * srv, struct bvt_profile * p );
+void server_set_schedule( struct bvt_server * srv, const struct bvt_schedule * s );
+void server_set_mpc( struct bvt_server * srv, const struct bvt_mpc * c );
+void server_set_ln2( struct bvt_server * srv, const struct bvt_ln2 * n );
+void server_publish( struct bvt_server * srv, const struct bvt_state * st );
+int server_pending( const struct bvt_server * srv );
+void server_run_next( struct bvt_server * srv, struct sp_port * port_choice );
+
+#endif
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bvt_shm.h"
+#include "serial_jjm.h"
+
+const struct bvt_status_event bvt_status_events[ BVT_STATUS_EVENTS ] = {
+    { "heater-on",          BVT_WORD_IS, BVT3000_HEATER_ON },
+    { "missing-gas-flow",   BVT_WORD_IS, BVT3000_MISSING_GAS_FLOW },
+    { "heater-overheating", BVT_WORD_IS, BVT3000_HEATER_OVERHEATING },
+    { "ln2-refill",         BVT_WORD_IS, BVT3000_LN2_REFILL },
+    { "ln2-empty",          BVT_WORD_IS, BVT3000_LN2_EMPTY },
+    { "ln2-heater-on",      BVT_WORD_IS, BVT3000_LN2_HEATER_ON },
+    { "sensor-break",       BVT_WORD_SW, SENSOR_BREAK_FLAG },
+    { "alarm",              BVT_WORD_SW, ALARMS_STATE_FLAG },
+    { "setpoint-2",         BVT_WORD_SW, ACTIVE_SETPOINT_FLAG },
+    { "manual-mode",        BVT_WORD_SW, MANUAL_MODE_FLAG },
+    { "pid-2",              BVT_WORD_XS, ACTIVE_PID_FLAG },
+};
+
+int bvt_status_event_find( const char * name )
+{
+    for (int i = 0; i < BVT_STATUS_EVENTS; i++) {
+        if (! strcmp( name, bvt_status_events[ i ].name )) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool bvt_status_event_state( int event, const struct bvt_state * st )
+{
+    const struct bvt_status_event *ev = &bvt_status_events[ event ];
+    unsigned int word = ev->word == BVT_WORD_IS ? st->is : ev->word == BVT_WORD_SW ? st->sw : st->xs;
+
+    return ( word & ev->mask ) != 0;
+}
+
+/*------------------------------------------------------------------*
+ * Creates (or takes over) the shared-memory segment and maps it
+ *------------------------------------------------------------------*/
+
+struct bvt_shm * bvt_shm_create( const char * name )
+{
+    struct bvt_shm *shm;
+    uint32_t seq;
+    int fd = shm_open( name, O_RDWR | O_CREAT, 0644 );
+
+    if (fd < 0) {
+        perror( "shm_open" );
+        return NULL;
+    }
+    if (ftruncate( fd, sizeof *shm ) < 0) {
+        perror( "ftruncate" );
+        close( fd );
+        return NULL;
+    }
+    shm = mmap( NULL, sizeof *shm, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (shm == MAP_FAILED) {
+        perror( "mmap" );
+        return NULL;
+    }
+
+    /* Readers of a previous daemon's segment may still be mapping it:
+       clear it as an update, with the counter odd (it may already be, if
+       that daemon died half-way through one) and never going backwards */
+
+    seq = __atomic_load_n( &shm->lock, __ATOMIC_RELAXED ) | 1u;
+    __atomic_store_n( &shm->lock, seq, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    memset( &shm->state, 0, sizeof shm->state );
+    shm->version = BVT_SHM_VERSION;
+    shm->pid = getpid( );
+    __atomic_store_n( &shm->lock, seq + 1, __ATOMIC_RELEASE );
+    __atomic_store_n( &shm->magic, BVT_SHM_MAGIC, __ATOMIC_RELEASE );
+    return shm;
+}
+
+/*------------------------------------------------------------------*
+ * Seqlock writer: counter odd -> update -> counter even
+ *------------------------------------------------------------------*/
+
+void bvt_shm_publish( struct bvt_shm * shm, const struct bvt_state * st )
+{
+    uint32_t seq = __atomic_load_n( &shm->lock, __ATOMIC_RELAXED );
+
+    __atomic_store_n( &shm->lock, seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    memcpy( &shm->state, st, sizeof *st );
+    __atomic_store_n( &shm->lock, seq + 2, __ATOMIC_RELEASE );
+}
+
+/*------------------------------------------------------------------*
+ * Unmaps and removes the segment, so that readers cannot mistake the
+ * state of a daemon that has gone away for a live one
+ *------------------------------------------------------------------*/
+
+void bvt_shm_destroy( struct bvt_shm * shm, const char * name )
+{
+    if (shm) {
+        __atomic_store_n( &shm->magic, 0, __ATOMIC_RELEASE );
+        munmap( shm, sizeof *shm );
+    }
+    shm_unlink( name );
+}
+
+/*------------------------------------------------------------------*
+ * Maps an existing segment read-only, for consumers
+ *------------------------------------------------------------------*/
+
+struct bvt_shm * bvt_shm_attach( const char * name )
+{
+    struct bvt_shm *shm;
+    int fd = shm_open( name, O_RDONLY, 0 );
+
+    if (fd < 0) {
+        return NULL;
+    }
+    shm = mmap( NULL, sizeof *shm, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (shm == MAP_FAILED) {
+        return NULL;
+    }
+    if (   __atomic_load_n( &shm->magic, __ATOMIC_ACQUIRE ) != BVT_SHM_MAGIC
+        || shm->version != BVT_SHM_VERSION ) {
+        munmap( shm, sizeof *shm );
+        return NULL;
+    }
+    return shm;
+}
+
+/*------------------------------------------------------------------*
+ * Seqlock reader: copies a consistent snapshot, retrying while the
+ * daemon is in the middle of an update. Returns false if the daemon
+ * has not published a sample (yet, or any more), or is stuck in the
+ * middle of one for BVT_SHM_READ_TRIES tries (it died there, and *st
+ * is not to be trusted).
+ *------------------------------------------------------------------*/
+
+bool bvt_shm_read( const struct bvt_shm * shm, struct bvt_state * st )
+{
+    uint32_t before, after = 0;
+    int tries = 0;
+
+    do {
+        if (tries++ == BVT_SHM_READ_TRIES) {
+            return false;
+        }
+        before = __atomic_load_n( &shm->lock, __ATOMIC_ACQUIRE );
+        if (before & 1) {
+            sched_yield( );
+            continue;
+        }
+        memcpy( st, ( const void * ) &shm->state, sizeof *st );
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        after = __atomic_load_n( &shm->lock, __ATOMIC_RELAXED );
+    } while ( ( before & 1 ) || before != after );
+
+    return __atomic_load_n( &shm->magic, __ATOMIC_ACQUIRE ) == BVT_SHM_MAGIC
+           && st->seq != 0;
+}
+
+/*------------------------------------------------------------------*
+ * Sample ring: size in bytes of a ring with the given capacity
+ *------------------------------------------------------------------*/
+
+static size_t bvt_ring_bytes( unsigned int capacity )
+{
+    return sizeof( struct bvt_ring ) + capacity * sizeof( struct bvt_ring_slot );
+}
+
+struct bvt_ring * bvt_ring_create( const char * name, unsigned int capacity )
+{
+    struct bvt_ring *ring;
+    int fd;
+
+    if (capacity == 0 || ( capacity & ( capacity - 1 ) )) {
+        fprintf( stderr, "FATAL: ring size %u is not a power of two\n", capacity );
+        return NULL;
+    }
+
+    /* Start from a fresh segment: consumers of an old ring must not see
+       stale slots reappear with valid looking sample numbers */
+
+    shm_unlink( name );
+    fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0644 );
+    if (fd < 0) {
+        perror( "shm_open" );
+        return NULL;
+    }
+    if (ftruncate( fd, bvt_ring_bytes( capacity ) ) < 0) {
+        perror( "ftruncate" );
+        close( fd );
+        return NULL;
+    }
+    ring = mmap( NULL, bvt_ring_bytes( capacity ), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0 );
+    close( fd );
+    if (ring == MAP_FAILED) {
+        perror( "mmap" );
+        return NULL;
+    }
+
+    ring->version = BVT_SHM_VERSION;
+    ring->capacity = capacity;
+    ring->pid = getpid( );
+    ring->head = 0;
+    __atomic_store_n( &ring->magic, BVT_RING_MAGIC, __ATOMIC_RELEASE );
+    return ring;
+}
+
+/*------------------------------------------------------------------*
+ * Appends a sample (st->seq must be the next sample number)
+ *------------------------------------------------------------------*/
+
+void bvt_ring_publish( struct bvt_ring * ring, const struct bvt_state * st )
+{
+    struct bvt_ring_slot *slot = &ring->slot[ st->seq & ( ring->capacity - 1 ) ];
+
+    __atomic_store_n( &slot->seq, 0, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    memcpy( &slot->state, st, sizeof *st );
+    __atomic_store_n( &slot->seq, st->seq, __ATOMIC_RELEASE );
+    __atomic_store_n( &ring->head, st->seq, __ATOMIC_RELEASE );
+}
+
+void bvt_ring_destroy( struct bvt_ring * ring, const char * name )
+{
+    if (ring) {
+        __atomic_store_n( &ring->magic, 0, __ATOMIC_RELEASE );
+        munmap( ring, bvt_ring_bytes( ring->capacity ) );
+    }
+    shm_unlink( name );
+}
+
+struct bvt_ring * bvt_ring_attach( const char * name )
+{
+    struct bvt_ring *ring;
+    struct stat sb;
+    int fd = shm_open( name, O_RDONLY, 0 );
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat( fd, &sb ) < 0 || (size_t) sb.st_size < sizeof *ring) {
+        close( fd );
+        return NULL;
+    }
+    ring = mmap( NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (ring == MAP_FAILED) {
+        return NULL;
+    }
+    if (   __atomic_load_n( &ring->magic, __ATOMIC_ACQUIRE ) != BVT_RING_MAGIC
+        || ring->version != BVT_SHM_VERSION
+        || bvt_ring_bytes( ring->capacity ) > (size_t) sb.st_size ) {
+        munmap( ring, sb.st_size );
+        return NULL;
+    }
+    return ring;
+}
+
+/*------------------------------------------------------------------*
+ * Fetches the sample numbered *cursor and advances the cursor. Returns
+ * false when there is nothing new yet, or when the sample is still being
+ * written after BVT_SHM_READ_TRIES tries (the daemon died writing it;
+ * the cursor stays put). If the consumer fell so far
+ * behind that samples were overwritten, it is moved forward to the
+ * oldest sample still in the ring and the number of samples skipped is
+ * added to *lost. Start with *cursor = 1 for everything still in the
+ * ring, or with head + 1 for new samples only.
+ *------------------------------------------------------------------*/
+
+bool bvt_ring_next( const struct bvt_ring * ring, uint64_t * cursor,
+                    struct bvt_state * st, uint64_t * lost )
+{
+    const struct bvt_ring_slot *slot;
+    uint64_t head, before, after;
+
+    for (int tries = 0; tries < BVT_SHM_READ_TRIES; tries++) {
+        head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+        if (*cursor > head || *cursor == 0) {
+            if (*cursor == 0) {
+                *cursor = 1;
+            }
+            return false;
+        }
+        if (head - *cursor >= ring->capacity) {
+            *lost += head - ring->capacity + 1 - *cursor;
+            *cursor = head - ring->capacity + 1;
+        }
+
+        slot = &ring->slot[ *cursor & ( ring->capacity - 1 ) ];
+        before = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+        memcpy( st, ( const void * ) &slot->state, sizeof *st );
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        after = __atomic_load_n( &slot->seq, __ATOMIC_RELAXED );
+
+        if (before == *cursor && after == *cursor) {
+            ( *cursor )++;
+            return true;
+        }
+        /* Overwritten under our feet: go round again, which counts the
+           loss and moves us to the oldest surviving sample */
+
+        sched_yield( );
+    }
+    return false;
+}
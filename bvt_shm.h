@@ -0,0 +1,131 @@
+/* Shared-memory publication of the daemon's latest device state.
+ *
+ * The daemon owns a POSIX shared-memory segment (default name "/bvt3000")
+ * holding the last decoded sample, protected by a seqlock: the writer
+ * makes the sequence counter odd while it updates the state and even
+ * again afterwards, and a reader simply retries if the counter was odd
+ * or changed while it copied. Readers therefore never block the daemon,
+ * and reading the current state needs no syscalls once the segment is
+ * mapped. A reader gives up after BVT_SHM_READ_TRIES tries, so a daemon
+ * that died half-way through an update cannot hang it.
+ *
+ * The layout is fixed (all fields naturally aligned, no padding) so that
+ * non-C consumers can map it too, e.g. from Python with mmap + struct:
+ *
+ *   offset  type      field
+ *        0  uint32    magic (BVT_SHM_MAGIC)
+ *        4  uint32    version (BVT_SHM_VERSION)
+ *        8  uint32    seqlock counter (odd while being written)
+ *       12  uint32    daemon pid
+ *       16  state     struct bvt_state, see below
+ */
+#pragma once
+#if ! defined BVT_SHM_HEADER
+#define BVT_SHM_HEADER
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BVT_SHM_NAME     "/bvt3000"
+#define BVT_SHM_MAGIC    0x42565433      /* "BVT3" */
+#define BVT_SHM_VERSION  2
+#define BVT_SHM_READ_TRIES  10000    /* before taking the daemon for dead */
+
+struct bvt_state {
+    uint64_t seq;               /* sample number, counts from 1 */
+    double   wall_time;         /* CLOCK_REALTIME of the sample (s) */
+    double   mono_time;         /* CLOCK_MONOTONIC of the sample (s) */
+    double   temperature;       /* PV (K) */
+    double   working_setpoint;  /* SP (K) */
+    double   heater_power;      /* OP (%) */
+    double   flow_rate;         /* gas flow (l/hr) */
+    uint32_t flow_index;        /* raw AF valve index, 0 - 15 */
+    uint16_t is;                /* BVT3000 interface status word */
+    uint16_t sw;                /* Eurotherm status word */
+    uint16_t xs;                /* Eurotherm extension status word */
+    uint16_t reserved[ 3 ];
+    double   setpoint1;         /* SP1 (K) */
+    double   setpoint2;         /* SP2 (K) */
+    double   ln2_heater_power;  /* LN2 evaporator heater (%) */
+};
+
+struct bvt_shm {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t lock;
+    uint32_t pid;
+    struct bvt_state state;
+};
+
+/* Besides the latest snapshot the daemon appends every sample to a ring
+ * in a second segment (default "/bvt3000-ring"), so that consumers can
+ * follow the full-rate stream. The daemon never waits for anybody: each
+ * consumer keeps its own cursor (the next sample number it wants) and
+ * learns from the sample numbers how many samples it lost if it fell
+ * more than a ring's worth behind.
+ *
+ *   offset  type      field
+ *        0  uint32    magic (BVT_RING_MAGIC)
+ *        4  uint32    version (BVT_SHM_VERSION)
+ *        8  uint32    capacity, a power of two
+ *       12  uint32    daemon pid
+ *       16  uint64    number of the last sample written
+ *       24  slot[]    capacity x { uint64 seq; struct bvt_state }
+ *
+ * A slot's seq is zeroed while it is being rewritten and set to the
+ * sample number once complete. */
+
+#define BVT_RING_SUFFIX  "-ring"
+#define BVT_RING_MAGIC   0x42565452      /* "BVTR" */
+#define BVT_RING_SIZE    4096
+
+struct bvt_ring_slot {
+    uint64_t seq;
+    struct bvt_state state;
+};
+
+struct bvt_ring {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t pid;
+    uint64_t head;
+    struct bvt_ring_slot slot[ ];
+};
+
+/* Named status bits of a sample, for subscriptions and the archive's
+ * event index. Their numbers are stored in archives, so new ones go at
+ * the end. */
+
+enum { BVT_WORD_IS, BVT_WORD_SW, BVT_WORD_XS };
+
+struct bvt_status_event {
+    const char *name;
+    int word;                   /* BVT_WORD_* */
+    unsigned int mask;
+};
+
+#define BVT_STATUS_EVENTS  11
+
+extern const struct bvt_status_event bvt_status_events[ BVT_STATUS_EVENTS ];
+
+int bvt_status_event_find( const char * name );
+bool bvt_status_event_state( int event, const struct bvt_state * st );
+
+// Writer side (the daemon)
+struct bvt_shm * bvt_shm_create( const char * name );
+void bvt_shm_publish( struct bvt_shm * shm, const struct bvt_state * st );
+void bvt_shm_destroy( struct bvt_shm * shm, const char * name );
+
+// Reader side
+struct bvt_shm * bvt_shm_attach( const char * name );
+bool bvt_shm_read( const struct bvt_shm * shm, struct bvt_state * st );
+
+struct bvt_ring * bvt_ring_create( const char * name, unsigned int capacity );
+void bvt_ring_publish( struct bvt_ring * ring, const struct bvt_state * st );
+void bvt_ring_destroy( struct bvt_ring * ring, const char * name );
+struct bvt_ring * bvt_ring_attach( const char * name );
+bool bvt_ring_next( const struct bvt_ring * ring, uint64_t * cursor,
+                    struct bvt_state * st, uint64_t * lost );
+
+#endif
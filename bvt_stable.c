@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+
+#include "bvt_stable.h"
+extern bool verboseFlag;
+
+/*------------------------------------------------------------------*
+ * The ring holds a window's worth of samples at the polling interval,
+ * plus some slack for jitter; if it fills up anyway the oldest sample
+ * goes early.
+ *------------------------------------------------------------------*/
+
+struct bvt_stable * stable_create( double tolerance, double window, double interval )
+{
+    struct bvt_stable *s = calloc( 1, sizeof *s );
+
+    if (s == NULL) {
+        return NULL;
+    }
+    s->tolerance = tolerance;
+    s->window = window;
+    s->size = ceil( window / interval ) + 2;
+    s->sample = calloc( s->size, sizeof *s->sample );
+    if (s->sample == NULL) {
+        free( s );
+        return NULL;
+    }
+    stable_restart( s );
+    return s;
+}
+
+void stable_destroy( struct bvt_stable *s )
+{
+    if (s == NULL) {
+        return;
+    }
+    free( s->sample );
+    free( s );
+}
+
+void stable_restart( struct bvt_stable *s )
+{
+    s->head = s->count = 0;
+    s->since = NAN;
+    s->st = s->sd = s->stt = s->std = s->sdd = 0.0;
+    s->mean = s->deviation = s->slope = 0.0;
+}
+
+static void sums_add( struct bvt_stable *s, const struct stable_sample *x, double sign )
+{
+    s->st += sign * x->t;
+    s->sd += sign * x->dev;
+    s->stt += sign * x->t * x->t;
+    s->std += sign * x->t * x->dev;
+    s->sdd += sign * x->dev * x->dev;
+}
+
+/* Adding and removing samples slowly loses precision, so the sums are
+   recomputed from the window every time the ring wraps around */
+
+static void sums_recompute( struct bvt_stable *s )
+{
+    s->st = s->sd = s->stt = s->std = s->sdd = 0.0;
+    for (unsigned int i = 0; i < s->count; i++) {
+        sums_add( s, &s->sample[ ( s->head + s->size - s->count + i ) % s->size ], 1.0 );
+    }
+}
+
+/*------------------------------------------------------------------*
+ * Adds a sample taken at `now' (CLOCK_MONOTONIC, s) and tells whether
+ * the temperature is stable now
+ *------------------------------------------------------------------*/
+
+bool stable_add( struct bvt_stable *s, double now, double temperature, double setpoint )
+{
+    struct stable_sample x;
+    double n, var, det;
+
+    if (s->count > 0 && fabs( setpoint - s->setpoint ) > 0.05) {
+        stable_restart( s );
+    }
+    if (s->count == 0) {
+        s->t0 = now;
+        s->setpoint = setpoint;
+    }
+    x.t = now - s->t0;
+    x.dev = temperature - s->setpoint;
+
+    while ( s->count > 0 && ( s->count == s->size
+            || s->sample[ ( s->head + s->size - s->count ) % s->size ].t < x.t - s->window )) {
+        sums_add( s, &s->sample[ ( s->head + s->size - s->count ) % s->size ], -1.0 );
+        s->count--;
+    }
+    s->sample[ s->head ] = x;
+    s->head = ( s->head + 1 ) % s->size;
+    s->count++;
+    if (s->head == 0) {
+        sums_recompute( s );
+    } else {
+        sums_add( s, &x, 1.0 );
+    }
+
+    if (fabs( x.dev ) > s->tolerance) {
+        s->since = NAN;
+    } else if (isnan( s->since )) {
+        s->since = x.t;
+    }
+
+    n = s->count;
+    var = s->sdd / n - ( s->sd / n ) * ( s->sd / n );
+    det = n * s->stt - s->st * s->st;
+    s->mean = s->setpoint + s->sd / n;
+    s->deviation = var > 0.0 ? sqrt( var ) : 0.0;
+    s->slope = det > 0.0 ? ( n * s->std - s->st * s->sd ) / det : 0.0;
+
+    return ! isnan( s->since ) && x.t - s->since >= s->window
+           && fabs( s->slope ) * s->window <= s->tolerance;
+}
+
+/*------------------------------------------------------------------*
+ * Polls the temperature and working setpoint every `interval' seconds
+ * (on absolute deadlines) until it is stable, or `timeout' seconds have
+ * passed if that is positive
+ *------------------------------------------------------------------*/
+
+bool stable_wait( struct bvt_stable *s, double interval, double timeout, struct sp_port * port_choice )
+{
+    struct timespec ts, next;
+    double start;
+
+    clock_gettime( CLOCK_MONOTONIC, &next );
+    start = next.tv_sec + next.tv_nsec * 1e-9;
+
+    for (;;) {
+        double now, pv, sp;
+
+        /* Polling faster than the read coalescing window must still
+           give fresh readings, or they would count twice */
+
+        bvt3000_coalesce_invalidate( );
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        now = ts.tv_sec + ts.tv_nsec * 1e-9;
+        pv = eurotherm902s_get_temperature( port_choice );
+        sp = eurotherm902s_get_working_setpoint( port_choice );
+
+        if (stable_add( s, now, pv, sp )) {
+            return true;
+        }
+        if (verboseFlag) {
+            printf("PV %.1f SP %.1f: mean %f sd %f slope %f K/min, within %.2f K for %.0f s\n",
+                    pv, sp, s->mean, s->deviation, s->slope * 60.0, s->tolerance,
+                    isnan( s->since ) ? 0.0 : now - s->t0 - s->since);
+        }
+        if (timeout > 0.0 && now - start >= timeout) {
+            return false;
+        }
+
+        next.tv_nsec += (long) ( interval * 1e9 ) % 1000000000L;
+        next.tv_sec += (time_t) interval + next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+        if (next.tv_sec < ts.tv_sec || ( next.tv_sec == ts.tv_sec && next.tv_nsec < ts.tv_nsec )) {
+            next = ts;
+        }
+        while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL ) == EINTR ) {
+        }
+    }
+}
@@ -0,0 +1,48 @@
+/* Deciding when the temperature has settled.
+ *
+ * Samples of the deviation of the temperature from the working setpoint
+ * are kept for the last `window' seconds, together with running sums
+ * from which the mean, variance and least-squares slope over the window
+ * follow in constant time per sample. The temperature counts as stable
+ * once every sample for a whole window has been within the tolerance and
+ * the drift over the window (slope times window) is smaller than the
+ * tolerance too. A change of the working setpoint starts over.
+ */
+#pragma once
+#if ! defined BVT_STABLE_HEADER
+#define BVT_STABLE_HEADER
+
+#include <stdbool.h>
+#include "serial_jjm.h"
+
+struct stable_sample {
+    double t;                       /* s since the last restart */
+    double dev;                     /* temperature - working setpoint, K */
+};
+
+struct bvt_stable {
+    double tolerance;               /* K */
+    double window;                  /* s */
+
+    unsigned int size;
+    unsigned int head;              /* next slot to write */
+    unsigned int count;             /* samples in the window */
+    struct stable_sample *sample;
+
+    double t0;                      /* CLOCK_MONOTONIC time of the restart */
+    double setpoint;                /* working setpoint the samples refer to */
+    double since;                   /* start of the run within tolerance, NAN if outside */
+    double st, sd, stt, std, sdd;   /* sums of t, dev, t*t, t*dev, dev*dev */
+
+    double mean;                    /* temperature, K */
+    double deviation;               /* standard deviation, K */
+    double slope;                   /* K/s */
+};
+
+struct bvt_stable * stable_create( double tolerance, double window, double interval );
+void stable_destroy( struct bvt_stable *s );
+void stable_restart( struct bvt_stable *s );
+bool stable_add( struct bvt_stable *s, double now, double temperature, double setpoint );
+bool stable_wait( struct bvt_stable *s, double interval, double timeout, struct sp_port * port_choice );
+
+#endif
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/wait.h>
+
+#include "bvt_sweep.h"
+#include "bvt_stable.h"
+extern bool verboseFlag;
+
+static bool sweep_point( double t, double *point, int *n, int max )
+{
+    if (*n == max || ! ( t >= MIN_SETPOINT && t <= MAX_SETPOINT )) {
+        return false;
+    }
+    point[ ( *n )++ ] = t;
+    return true;
+}
+
+/*------------------------------------------------------------------*
+ * Expands a list like "300,310:340:10,295" into at most `max' setpoints.
+ * Returns how many, or -1 if the list is malformed, has a setpoint out
+ * of range or too many of them.
+ *------------------------------------------------------------------*/
+
+int sweep_parse( const char *list, double *point, int max )
+{
+    char *copy = strdup( list );
+    char *save = NULL;
+    char *item;
+    int n = 0;
+
+    if (copy == NULL) {
+        return -1;
+    }
+    for (item = strtok_r( copy, ",", &save ); item; item = strtok_r( NULL, ",", &save )) {
+        double from, to, step;
+        long steps, k;
+        char *end;
+
+        from = strtod( item, &end );
+        if (end == item) {
+            break;
+        }
+        if (*end == '\0') {
+            if (! sweep_point( from, point, &n, max )) {
+                break;
+            }
+            continue;
+        }
+        if (*end != ':') {
+            break;
+        }
+        item = end + 1;
+        to = strtod( item, &end );
+        if (end == item || *end != ':') {
+            break;
+        }
+        item = end + 1;
+        step = strtod( item, &end );
+        if (end == item || *end != '\0' || ! ( step > 0.0 )) {
+            break;
+        }
+
+        /* Both ends included, give or take rounding of the step */
+
+        steps = floor( fabs( to - from ) / step + 1e-6 );
+        for (k = 0; k <= steps; k++) {
+            if (! sweep_point( from + copysign( k * step, to - from ), point, &n, max )) {
+                break;
+            }
+        }
+        if (k <= steps) {
+            break;
+        }
+    }
+    free( copy );
+    return item == NULL && n > 0 ? n : -1;
+}
+
+static int sweep_hook( const char *hook, int i, double setpoint, double temperature )
+{
+    char value[ 32 ];
+    int status;
+
+    snprintf( value, sizeof value, "%d", i );
+    setenv( "BVT_POINT", value, 1 );
+    snprintf( value, sizeof value, "%.1f", setpoint );
+    setenv( "BVT_SETPOINT", value, 1 );
+    snprintf( value, sizeof value, "%f", temperature );
+    setenv( "BVT_TEMPERATURE", value, 1 );
+
+    if (verboseFlag) {
+        printf("Running %s\n", hook);
+    }
+    fflush( stdout );
+    status = system( hook );
+    if (status == -1 || ! WIFEXITED( status )) {
+        return -1;
+    }
+    return WEXITSTATUS( status );
+}
+
+/*------------------------------------------------------------------*
+ * Runs the sweep given on the command line. Returns 0 if every setpoint
+ * settled, 2 if some timed out, 1 on errors or a failed hook.
+ *------------------------------------------------------------------*/
+
+int run_sweep( struct gengetopt_args_info *ai, struct sp_port * port_choice )
+{
+    double *point = malloc( SWEEP_MAX_POINTS * sizeof *point );
+    struct bvt_stable *stable = NULL;
+    int n, result = 0;
+
+    if (point == NULL) {
+        fprintf(stderr,"FATAL: Out of memory\n");
+        return 1;
+    }
+    n = sweep_parse( ai->sweep_arg, point, SWEEP_MAX_POINTS );
+    if (n < 0) {
+        fprintf(stderr,"FATAL: Bad sweep %s (setpoints %.0f-%.0f K, at most %d)\n",
+                ai->sweep_arg, MIN_SETPOINT, MAX_SETPOINT, SWEEP_MAX_POINTS);
+        free( point );
+        return 1;
+    }
+    if (! ai->wait_stable_given || ai->wait_stable_arg <= 0.0 || ai->window_arg <= 0.0
+            || ai->poll_interval_arg <= 0.0) {
+        fprintf(stderr,"FATAL: A sweep needs a positive --wait-stable, --window and --poll-interval\n");
+        free( point );
+        return 1;
+    }
+    stable = stable_create( ai->wait_stable_arg, ai->window_arg, ai->poll_interval_arg );
+    if (stable == NULL) {
+        fprintf(stderr,"FATAL: Out of memory\n");
+        free( point );
+        return 1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (verboseFlag) {
+            printf("Sweep point %d of %d: setting the setpoint to %.1f K\n", i + 1, n, point[ i ]);
+        }
+
+        /* The stability wait follows the working setpoint, so write the
+           one in use, which after a --step-to may be SP2 */
+
+        eurotherm902s_set_current_setpoint( point[ i ], port_choice );
+        stable_restart( stable );
+        if (! stable_wait( stable, ai->poll_interval_arg, ai->wait_timeout_arg, port_choice )) {
+            fprintf(stderr,"***SWEP: %d %lf TIMEOUT\n", i + 1, point[ i ]);
+            result = 2;
+            continue;
+        }
+        printf("***SWEP: %d %lf %lf %lf %lf\n", i + 1, point[ i ],
+                stable->mean, stable->deviation, stable->slope * 60.0);
+
+        if (ai->sweep_hook_given) {
+            int status = sweep_hook( ai->sweep_hook_arg, i + 1, point[ i ], stable->mean );
+
+            if (status != 0) {
+                fprintf(stderr,"FATAL: Sweep hook failed (status %d) at %.1f K, stopping\n",
+                        status, point[ i ]);
+                result = 1;
+                break;
+            }
+        }
+    }
+
+    stable_destroy( stable );
+    free( point );
+    return result;
+}
@@ -0,0 +1,32 @@
+/* Temperature series.
+ *
+ * A sweep sets each setpoint of a list in turn (into SP1 or SP2,
+ * whichever is in use), waits until the temperature is stable there
+ * (see bvt_stable.h, using --wait-stable, --window and --wait-timeout)
+ * and then runs a hook command, typically one that starts an
+ * acquisition, before going on to the next setpoint. The whole series
+ * runs in one process that keeps the port open, so it takes as long as
+ * the sample needs to settle and no longer.
+ *
+ * The list is comma separated; an entry may also be a range FROM:TO:STEP,
+ * which includes TO if it falls on a step (300:340:10 is 300,310,320,
+ * 330,340, and 340:300:10 goes back down). The hook is run through
+ * /bin/sh with BVT_POINT (counting from 1), BVT_SETPOINT and
+ * BVT_TEMPERATURE (the mean over the stability window) in its
+ * environment. A setpoint that does
+ * not settle within --wait-timeout is reported and skipped; a hook that
+ * fails stops the sweep.
+ */
+#pragma once
+#if ! defined BVT_SWEEP_HEADER
+#define BVT_SWEEP_HEADER
+
+#include "serial_jjm.h"
+#include "cmdline.h"
+
+#define SWEEP_MAX_POINTS  4096
+
+int sweep_parse( const char *list, double *point, int max );
+int run_sweep( struct gengetopt_args_info *ai, struct sp_port * port_choice );
+
+#endif
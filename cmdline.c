@@ -86,6 +86,44 @@ const char *gengetopt_args_info_full_help[] = {
   "      --get-eurotherm-status    Get the status of the Eurotherm controller\n                                  (alarming or not)  (default=off)",
   "      --status-all              Return the status of everything that is a\n                                  status  (default=off)",
   "      --check-sensor-break      Check to see if the Thermocouples are broken\n                                  (default=off)",
+  "\nDaemon mode:",
+  "      --daemon                  Keep running, polling the device and publishing\n                                  its state until interrupted  (default=off)",
+  "      --poll-interval=FLOAT     Sampling interval in seconds, for the daemon,\n                                  --wait-stable, --sweep and --autotune\n                                  (default=`1.0')",
+  "      --shm-name=STRING         Name of the shared-memory segment holding the\n                                  latest state  (default=`/bvt3000')",
+  "      --ring-size=INT           Number of samples kept in the shared-memory\n                                  sample ring (a power of two)\n                                  (default=`4096')",
+  "      --listen=INT              Also serve client requests on this TCP port",
+  "      --listen-address=STRING   Address to listen on  (default=`127.0.0.1')",
+  "      --metrics-port=INT        Serve Prometheus metrics on this TCP port",
+  "      --archive=STRING          Also append every sample to this columnar\n                                  archive file",
+  "      --archive-sync=FLOAT      Seconds between syncs of the archive to disk\n                                  (default=`60.0')",
+  "      --profile=STRING          Run the setpoint profile in this file (lines of\n                                  ramp K/min, target K, dwell s)",
+  "\nWaiting for the temperature:",
+  "      --wait-stable=FLOAT       Return only once the temperature has stayed\n                                  within this many K of the working setpoint\n                                  for --window seconds, polling every\n                                  --poll-interval",
+  "      --window=FLOAT            Seconds the temperature must stay within\n                                  tolerance  (default=`60.0')",
+  "      --wait-timeout=FLOAT      Give up waiting after this many seconds (0\n                                  waits forever)  (default=`0.0')",
+  "      --sweep=STRING            Step through these setpoints (e.g. 300,310,320\n                                  or 300:340:10), waiting at each until stable\n                                  as for --wait-stable",
+  "      --sweep-hook=STRING       Shell command run at each setpoint once stable,\n                                  with BVT_POINT, BVT_SETPOINT and\n                                  BVT_TEMPERATURE set",
+  "\nTemperature steps:",
+  "      --step-to=FLOAT           Step the temperature setpoint to this value by\n                                  loading it into the inactive setpoint (SP1 or\n                                  SP2) and then switching over to it with a\n                                  single write",
+  "      --step-at=STRING          When to switch for --step-to: seconds since the\n                                  epoch (e.g. from date +%s.%N), or +SECONDS\n                                  from now",
+  "\nAutotuning:",
+  "      --autotune                Tune the PID loop at the current setpoint by\n                                  relay feedback in manual mode, and write the\n                                  resulting XP, TI and TD  (default=off)",
+  "      --autotune-step=FLOAT     Heater power (%) the relay adds to and takes\n                                  away from the power needed at the setpoint\n                                  (default=`10.0')",
+  "      --autotune-hysteresis=FLOAT\n                                Temperature (K) either side of the setpoint at\n                                  which the relay switches  (default=`0.2')",
+  "      --autotune-cycles=INT     Oscillation cycles to measure, after a first\n                                  one that is discarded  (default=`4')",
+  "      --autotune-rule=STRING    Tuning rule: classic (Ziegler-Nichols),\n                                  some-overshoot or no-overshoot\n                                  (default=`classic')",
+  "\nGain scheduling:",
+  "      --schedule=STRING         In daemon mode, switch PID settings by\n                                  temperature band as given in this file (lines\n                                  of from K, to K, then XP TI TD [HB LB] or\n                                  pid1/pid2)",
+  "\nModel-predictive control:",
+  "      --mpc=STRING              In daemon mode, drive the heater power from the\n                                  host in manual mode, predicting with this\n                                  model (GAIN,TAU,DEAD[,TAU2] in K/%, s, as\n                                  from bvt-ident)",
+  "      --mpc-response=FLOAT      Time (s) the predictive controller aims to take\n                                  to close 63% of the gap to the setpoint (0\n                                  for a quarter of the model's time constant)\n                                  (default=`0.0')",
+  "      --mpc-power-limit=FLOAT   Heater power (%) the predictive controller\n                                  never exceeds, also written to the\n                                  controller's output limit while it runs\n                                  (default=`100.0')",
+  "      --mpc-flow=FLOAT          Gas flow (l/h) to set while the predictive\n                                  controller runs, e.g. the flow the model was\n                                  fitted at",
+  "\nLN2 cooling:",
+  "      --ln2-control             In daemon mode, adjust the LN2 evaporator power\n                                  so that the main heater works at\n                                  --ln2-heater-target, holding the setpoint on\n                                  as little nitrogen and heater power as will\n                                  do  (default=off)",
+  "      --ln2-heater-target=FLOAT Main heater power (%) the LN2 control aims for,\n                                  enough to control in both directions\n                                  (default=`10.0')",
+  "      --ln2-integral-time=FLOAT Time (s) over which the LN2 control corrects\n                                  the evaporator power, several times slower\n                                  than the heater loop  (default=`300.0')",
+  "      --ln2-power-limit=FLOAT   Evaporator power (%) the LN2 control never\n                                  exceeds  (default=`100.0')",
   "\n Example invocation to read temperature (K), and gas flow rate (l/hours): \n\n BVTserialInterfacer -d /dev/ttyUSB0 -r --get-gas-flow-rate\n",
     0
 };
@@ -121,11 +159,49 @@ init_help_array(void)
   gengetopt_args_info_help[25] = gengetopt_args_info_full_help[50];
   gengetopt_args_info_help[26] = gengetopt_args_info_full_help[51];
   gengetopt_args_info_help[27] = gengetopt_args_info_full_help[52];
-  gengetopt_args_info_help[28] = 0; 
+  gengetopt_args_info_help[28] = gengetopt_args_info_full_help[53];
+  gengetopt_args_info_help[29] = gengetopt_args_info_full_help[54];
+  gengetopt_args_info_help[30] = gengetopt_args_info_full_help[55];
+  gengetopt_args_info_help[31] = gengetopt_args_info_full_help[56];
+  gengetopt_args_info_help[32] = gengetopt_args_info_full_help[57];
+  gengetopt_args_info_help[33] = gengetopt_args_info_full_help[58];
+  gengetopt_args_info_help[34] = gengetopt_args_info_full_help[59];
+  gengetopt_args_info_help[35] = gengetopt_args_info_full_help[60];
+  gengetopt_args_info_help[36] = gengetopt_args_info_full_help[61];
+  gengetopt_args_info_help[37] = gengetopt_args_info_full_help[62];
+  gengetopt_args_info_help[38] = gengetopt_args_info_full_help[63];
+  gengetopt_args_info_help[39] = gengetopt_args_info_full_help[64];
+  gengetopt_args_info_help[40] = gengetopt_args_info_full_help[65];
+  gengetopt_args_info_help[41] = gengetopt_args_info_full_help[66];
+  gengetopt_args_info_help[42] = gengetopt_args_info_full_help[67];
+  gengetopt_args_info_help[43] = gengetopt_args_info_full_help[68];
+  gengetopt_args_info_help[44] = gengetopt_args_info_full_help[69];
+  gengetopt_args_info_help[45] = gengetopt_args_info_full_help[70];
+  gengetopt_args_info_help[46] = gengetopt_args_info_full_help[71];
+  gengetopt_args_info_help[47] = gengetopt_args_info_full_help[72];
+  gengetopt_args_info_help[48] = gengetopt_args_info_full_help[73];
+  gengetopt_args_info_help[49] = gengetopt_args_info_full_help[74];
+  gengetopt_args_info_help[50] = gengetopt_args_info_full_help[75];
+  gengetopt_args_info_help[51] = gengetopt_args_info_full_help[76];
+  gengetopt_args_info_help[52] = gengetopt_args_info_full_help[77];
+  gengetopt_args_info_help[53] = gengetopt_args_info_full_help[78];
+  gengetopt_args_info_help[54] = gengetopt_args_info_full_help[79];
+  gengetopt_args_info_help[55] = gengetopt_args_info_full_help[80];
+  gengetopt_args_info_help[56] = gengetopt_args_info_full_help[81];
+  gengetopt_args_info_help[57] = gengetopt_args_info_full_help[82];
+  gengetopt_args_info_help[58] = gengetopt_args_info_full_help[83];
+  gengetopt_args_info_help[59] = gengetopt_args_info_full_help[84];
+  gengetopt_args_info_help[60] = gengetopt_args_info_full_help[85];
+  gengetopt_args_info_help[61] = gengetopt_args_info_full_help[86];
+  gengetopt_args_info_help[62] = gengetopt_args_info_full_help[87];
+  gengetopt_args_info_help[63] = gengetopt_args_info_full_help[88];
+  gengetopt_args_info_help[64] = gengetopt_args_info_full_help[89];
+  gengetopt_args_info_help[65] = gengetopt_args_info_full_help[90];
+  gengetopt_args_info_help[66] = 0; 
   
 }
 
-const char *gengetopt_args_info_help[29];
+const char *gengetopt_args_info_help[67];
 
 typedef enum {ARG_NO
   , ARG_FLAG
@@ -195,6 +271,37 @@ void clear_given (struct gengetopt_args_info *args_info)
   args_info->get_eurotherm_status_given = 0 ;
   args_info->status_all_given = 0 ;
   args_info->check_sensor_break_given = 0 ;
+  args_info->daemon_given = 0 ;
+  args_info->poll_interval_given = 0 ;
+  args_info->shm_name_given = 0 ;
+  args_info->ring_size_given = 0 ;
+  args_info->listen_given = 0 ;
+  args_info->listen_address_given = 0 ;
+  args_info->metrics_port_given = 0 ;
+  args_info->archive_given = 0 ;
+  args_info->archive_sync_given = 0 ;
+  args_info->profile_given = 0 ;
+  args_info->wait_stable_given = 0 ;
+  args_info->window_given = 0 ;
+  args_info->wait_timeout_given = 0 ;
+  args_info->sweep_given = 0 ;
+  args_info->sweep_hook_given = 0 ;
+  args_info->step_to_given = 0 ;
+  args_info->step_at_given = 0 ;
+  args_info->autotune_given = 0 ;
+  args_info->autotune_step_given = 0 ;
+  args_info->autotune_hysteresis_given = 0 ;
+  args_info->autotune_cycles_given = 0 ;
+  args_info->autotune_rule_given = 0 ;
+  args_info->schedule_given = 0 ;
+  args_info->mpc_given = 0 ;
+  args_info->mpc_response_given = 0 ;
+  args_info->mpc_power_limit_given = 0 ;
+  args_info->mpc_flow_given = 0 ;
+  args_info->ln2_control_given = 0 ;
+  args_info->ln2_heater_target_given = 0 ;
+  args_info->ln2_integral_time_given = 0 ;
+  args_info->ln2_power_limit_given = 0 ;
 }
 
 static
@@ -242,6 +349,60 @@ void clear_args (struct gengetopt_args_info *args_info)
   args_info->get_eurotherm_status_flag = 0;
   args_info->status_all_flag = 0;
   args_info->check_sensor_break_flag = 0;
+  args_info->daemon_flag = 0;
+  args_info->poll_interval_arg = 1.0;
+  args_info->poll_interval_orig = NULL;
+  args_info->shm_name_arg = gengetopt_strdup ("/bvt3000");
+  args_info->shm_name_orig = NULL;
+  args_info->ring_size_arg = 4096;
+  args_info->ring_size_orig = NULL;
+  args_info->listen_orig = NULL;
+  args_info->listen_address_arg = gengetopt_strdup ("127.0.0.1");
+  args_info->listen_address_orig = NULL;
+  args_info->metrics_port_orig = NULL;
+  args_info->archive_arg = NULL;
+  args_info->archive_orig = NULL;
+  args_info->archive_sync_arg = 60.0;
+  args_info->archive_sync_orig = NULL;
+  args_info->profile_arg = NULL;
+  args_info->profile_orig = NULL;
+  args_info->wait_stable_orig = NULL;
+  args_info->window_arg = 60.0;
+  args_info->window_orig = NULL;
+  args_info->wait_timeout_arg = 0.0;
+  args_info->wait_timeout_orig = NULL;
+  args_info->sweep_arg = NULL;
+  args_info->sweep_orig = NULL;
+  args_info->sweep_hook_arg = NULL;
+  args_info->sweep_hook_orig = NULL;
+  args_info->step_to_orig = NULL;
+  args_info->step_at_arg = NULL;
+  args_info->step_at_orig = NULL;
+  args_info->autotune_flag = 0;
+  args_info->autotune_step_arg = 10.0;
+  args_info->autotune_step_orig = NULL;
+  args_info->autotune_hysteresis_arg = 0.2;
+  args_info->autotune_hysteresis_orig = NULL;
+  args_info->autotune_cycles_arg = 4;
+  args_info->autotune_cycles_orig = NULL;
+  args_info->autotune_rule_arg = gengetopt_strdup ("classic");
+  args_info->autotune_rule_orig = NULL;
+  args_info->schedule_arg = NULL;
+  args_info->schedule_orig = NULL;
+  args_info->mpc_arg = NULL;
+  args_info->mpc_orig = NULL;
+  args_info->mpc_response_arg = 0.0;
+  args_info->mpc_response_orig = NULL;
+  args_info->mpc_power_limit_arg = 100.0;
+  args_info->mpc_power_limit_orig = NULL;
+  args_info->mpc_flow_orig = NULL;
+  args_info->ln2_control_flag = 0;
+  args_info->ln2_heater_target_arg = 10.0;
+  args_info->ln2_heater_target_orig = NULL;
+  args_info->ln2_integral_time_arg = 300.0;
+  args_info->ln2_integral_time_orig = NULL;
+  args_info->ln2_power_limit_arg = 100.0;
+  args_info->ln2_power_limit_orig = NULL;
   
 }
 
@@ -293,6 +454,37 @@ void init_args_info(struct gengetopt_args_info *args_info)
   args_info->get_eurotherm_status_help = gengetopt_args_info_full_help[49] ;
   args_info->status_all_help = gengetopt_args_info_full_help[50] ;
   args_info->check_sensor_break_help = gengetopt_args_info_full_help[51] ;
+  args_info->daemon_help = gengetopt_args_info_full_help[53] ;
+  args_info->poll_interval_help = gengetopt_args_info_full_help[54] ;
+  args_info->shm_name_help = gengetopt_args_info_full_help[55] ;
+  args_info->ring_size_help = gengetopt_args_info_full_help[56] ;
+  args_info->listen_help = gengetopt_args_info_full_help[57] ;
+  args_info->listen_address_help = gengetopt_args_info_full_help[58] ;
+  args_info->metrics_port_help = gengetopt_args_info_full_help[59] ;
+  args_info->archive_help = gengetopt_args_info_full_help[60] ;
+  args_info->archive_sync_help = gengetopt_args_info_full_help[61] ;
+  args_info->profile_help = gengetopt_args_info_full_help[62] ;
+  args_info->wait_stable_help = gengetopt_args_info_full_help[64] ;
+  args_info->window_help = gengetopt_args_info_full_help[65] ;
+  args_info->wait_timeout_help = gengetopt_args_info_full_help[66] ;
+  args_info->sweep_help = gengetopt_args_info_full_help[67] ;
+  args_info->sweep_hook_help = gengetopt_args_info_full_help[68] ;
+  args_info->step_to_help = gengetopt_args_info_full_help[70] ;
+  args_info->step_at_help = gengetopt_args_info_full_help[71] ;
+  args_info->autotune_help = gengetopt_args_info_full_help[73] ;
+  args_info->autotune_step_help = gengetopt_args_info_full_help[74] ;
+  args_info->autotune_hysteresis_help = gengetopt_args_info_full_help[75] ;
+  args_info->autotune_cycles_help = gengetopt_args_info_full_help[76] ;
+  args_info->autotune_rule_help = gengetopt_args_info_full_help[77] ;
+  args_info->schedule_help = gengetopt_args_info_full_help[79] ;
+  args_info->mpc_help = gengetopt_args_info_full_help[81] ;
+  args_info->mpc_response_help = gengetopt_args_info_full_help[82] ;
+  args_info->mpc_power_limit_help = gengetopt_args_info_full_help[83] ;
+  args_info->mpc_flow_help = gengetopt_args_info_full_help[84] ;
+  args_info->ln2_control_help = gengetopt_args_info_full_help[86] ;
+  args_info->ln2_heater_target_help = gengetopt_args_info_full_help[87] ;
+  args_info->ln2_integral_time_help = gengetopt_args_info_full_help[88] ;
+  args_info->ln2_power_limit_help = gengetopt_args_info_full_help[89] ;
   
 }
 
@@ -400,6 +592,44 @@ cmdline_parser_release (struct gengetopt_args_info *args_info)
   free_string_field (&(args_info->set_low_cutback_orig));
   free_string_field (&(args_info->set_adaptive_tune_level_orig));
   free_string_field (&(args_info->lock_keypad_orig));
+  free_string_field (&(args_info->poll_interval_orig));
+  free_string_field (&(args_info->shm_name_arg));
+  free_string_field (&(args_info->shm_name_orig));
+  free_string_field (&(args_info->ring_size_orig));
+  free_string_field (&(args_info->listen_orig));
+  free_string_field (&(args_info->listen_address_arg));
+  free_string_field (&(args_info->listen_address_orig));
+  free_string_field (&(args_info->metrics_port_orig));
+  free_string_field (&(args_info->archive_arg));
+  free_string_field (&(args_info->archive_orig));
+  free_string_field (&(args_info->archive_sync_orig));
+  free_string_field (&(args_info->profile_arg));
+  free_string_field (&(args_info->profile_orig));
+  free_string_field (&(args_info->wait_stable_orig));
+  free_string_field (&(args_info->window_orig));
+  free_string_field (&(args_info->wait_timeout_orig));
+  free_string_field (&(args_info->sweep_arg));
+  free_string_field (&(args_info->sweep_orig));
+  free_string_field (&(args_info->sweep_hook_arg));
+  free_string_field (&(args_info->sweep_hook_orig));
+  free_string_field (&(args_info->step_to_orig));
+  free_string_field (&(args_info->step_at_arg));
+  free_string_field (&(args_info->step_at_orig));
+  free_string_field (&(args_info->autotune_step_orig));
+  free_string_field (&(args_info->autotune_hysteresis_orig));
+  free_string_field (&(args_info->autotune_cycles_orig));
+  free_string_field (&(args_info->autotune_rule_arg));
+  free_string_field (&(args_info->autotune_rule_orig));
+  free_string_field (&(args_info->schedule_arg));
+  free_string_field (&(args_info->schedule_orig));
+  free_string_field (&(args_info->mpc_arg));
+  free_string_field (&(args_info->mpc_orig));
+  free_string_field (&(args_info->mpc_response_orig));
+  free_string_field (&(args_info->mpc_power_limit_orig));
+  free_string_field (&(args_info->mpc_flow_orig));
+  free_string_field (&(args_info->ln2_heater_target_orig));
+  free_string_field (&(args_info->ln2_integral_time_orig));
+  free_string_field (&(args_info->ln2_power_limit_orig));
   
   
 
@@ -516,6 +746,68 @@ cmdline_parser_dump(FILE *outfile, struct gengetopt_args_info *args_info)
     write_into_file(outfile, "status-all", 0, 0 );
   if (args_info->check_sensor_break_given)
     write_into_file(outfile, "check-sensor-break", 0, 0 );
+  if (args_info->daemon_given)
+    write_into_file(outfile, "daemon", 0, 0 );
+  if (args_info->poll_interval_given)
+    write_into_file(outfile, "poll-interval", args_info->poll_interval_orig, 0);
+  if (args_info->shm_name_given)
+    write_into_file(outfile, "shm-name", args_info->shm_name_orig, 0);
+  if (args_info->ring_size_given)
+    write_into_file(outfile, "ring-size", args_info->ring_size_orig, 0);
+  if (args_info->listen_given)
+    write_into_file(outfile, "listen", args_info->listen_orig, 0);
+  if (args_info->listen_address_given)
+    write_into_file(outfile, "listen-address", args_info->listen_address_orig, 0);
+  if (args_info->metrics_port_given)
+    write_into_file(outfile, "metrics-port", args_info->metrics_port_orig, 0);
+  if (args_info->archive_given)
+    write_into_file(outfile, "archive", args_info->archive_orig, 0);
+  if (args_info->archive_sync_given)
+    write_into_file(outfile, "archive-sync", args_info->archive_sync_orig, 0);
+  if (args_info->profile_given)
+    write_into_file(outfile, "profile", args_info->profile_orig, 0);
+  if (args_info->wait_stable_given)
+    write_into_file(outfile, "wait-stable", args_info->wait_stable_orig, 0);
+  if (args_info->window_given)
+    write_into_file(outfile, "window", args_info->window_orig, 0);
+  if (args_info->wait_timeout_given)
+    write_into_file(outfile, "wait-timeout", args_info->wait_timeout_orig, 0);
+  if (args_info->sweep_given)
+    write_into_file(outfile, "sweep", args_info->sweep_orig, 0);
+  if (args_info->sweep_hook_given)
+    write_into_file(outfile, "sweep-hook", args_info->sweep_hook_orig, 0);
+  if (args_info->step_to_given)
+    write_into_file(outfile, "step-to", args_info->step_to_orig, 0);
+  if (args_info->step_at_given)
+    write_into_file(outfile, "step-at", args_info->step_at_orig, 0);
+  if (args_info->autotune_given)
+    write_into_file(outfile, "autotune", 0, 0 );
+  if (args_info->autotune_step_given)
+    write_into_file(outfile, "autotune-step", args_info->autotune_step_orig, 0);
+  if (args_info->autotune_hysteresis_given)
+    write_into_file(outfile, "autotune-hysteresis", args_info->autotune_hysteresis_orig, 0);
+  if (args_info->autotune_cycles_given)
+    write_into_file(outfile, "autotune-cycles", args_info->autotune_cycles_orig, 0);
+  if (args_info->autotune_rule_given)
+    write_into_file(outfile, "autotune-rule", args_info->autotune_rule_orig, 0);
+  if (args_info->schedule_given)
+    write_into_file(outfile, "schedule", args_info->schedule_orig, 0);
+  if (args_info->mpc_given)
+    write_into_file(outfile, "mpc", args_info->mpc_orig, 0);
+  if (args_info->mpc_response_given)
+    write_into_file(outfile, "mpc-response", args_info->mpc_response_orig, 0);
+  if (args_info->mpc_power_limit_given)
+    write_into_file(outfile, "mpc-power-limit", args_info->mpc_power_limit_orig, 0);
+  if (args_info->mpc_flow_given)
+    write_into_file(outfile, "mpc-flow", args_info->mpc_flow_orig, 0);
+  if (args_info->ln2_control_given)
+    write_into_file(outfile, "ln2-control", 0, 0 );
+  if (args_info->ln2_heater_target_given)
+    write_into_file(outfile, "ln2-heater-target", args_info->ln2_heater_target_orig, 0);
+  if (args_info->ln2_integral_time_given)
+    write_into_file(outfile, "ln2-integral-time", args_info->ln2_integral_time_orig, 0);
+  if (args_info->ln2_power_limit_given)
+    write_into_file(outfile, "ln2-power-limit", args_info->ln2_power_limit_orig, 0);
   
 
   i = EXIT_SUCCESS;
@@ -845,6 +1137,37 @@ cmdline_parser_internal (
         { "get-eurotherm-status",	0, NULL, 0 },
         { "status-all",	0, NULL, 0 },
         { "check-sensor-break",	0, NULL, 0 },
+        { "daemon",	0, NULL, 0 },
+        { "poll-interval",	1, NULL, 0 },
+        { "shm-name",	1, NULL, 0 },
+        { "ring-size",	1, NULL, 0 },
+        { "listen",	1, NULL, 0 },
+        { "listen-address",	1, NULL, 0 },
+        { "metrics-port",	1, NULL, 0 },
+        { "archive",	1, NULL, 0 },
+        { "archive-sync",	1, NULL, 0 },
+        { "profile",	1, NULL, 0 },
+        { "wait-stable",	1, NULL, 0 },
+        { "window",	1, NULL, 0 },
+        { "wait-timeout",	1, NULL, 0 },
+        { "sweep",	1, NULL, 0 },
+        { "sweep-hook",	1, NULL, 0 },
+        { "step-to",	1, NULL, 0 },
+        { "step-at",	1, NULL, 0 },
+        { "autotune",	0, NULL, 0 },
+        { "autotune-step",	1, NULL, 0 },
+        { "autotune-hysteresis",	1, NULL, 0 },
+        { "autotune-cycles",	1, NULL, 0 },
+        { "autotune-rule",	1, NULL, 0 },
+        { "schedule",	1, NULL, 0 },
+        { "mpc",	1, NULL, 0 },
+        { "mpc-response",	1, NULL, 0 },
+        { "mpc-power-limit",	1, NULL, 0 },
+        { "mpc-flow",	1, NULL, 0 },
+        { "ln2-control",	0, NULL, 0 },
+        { "ln2-heater-target",	1, NULL, 0 },
+        { "ln2-integral-time",	1, NULL, 0 },
+        { "ln2-power-limit",	1, NULL, 0 },
         { 0,  0, 0, 0 }
       };
 
@@ -1359,6 +1682,434 @@ cmdline_parser_internal (
                 additional_error))
               goto failure;
           
+          }
+          /* Keep running, polling the device and publishing its state until interrupted.  */
+          else if (strcmp (long_options[option_index].name, "daemon") == 0)
+          {
+          
+          
+            if (update_arg((void *)&(args_info->daemon_flag), 0, &(args_info->daemon_given),
+                &(local_args_info.daemon_given), optarg, 0, 0, ARG_FLAG,
+                check_ambiguity, override, 1, 0, "daemon", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Daemon sampling interval in seconds.  */
+          else if (strcmp (long_options[option_index].name, "poll-interval") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->poll_interval_arg), 
+                 &(args_info->poll_interval_orig), &(args_info->poll_interval_given),
+                &(local_args_info.poll_interval_given), optarg, 0, "1.0", ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "poll-interval", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Name of the shared-memory segment holding the latest state.  */
+          else if (strcmp (long_options[option_index].name, "shm-name") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->shm_name_arg), 
+                 &(args_info->shm_name_orig), &(args_info->shm_name_given),
+                &(local_args_info.shm_name_given), optarg, 0, "/bvt3000", ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "shm-name", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Number of samples kept in the shared-memory sample ring (a power of two).  */
+          else if (strcmp (long_options[option_index].name, "ring-size") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->ring_size_arg), 
+                 &(args_info->ring_size_orig), &(args_info->ring_size_given),
+                &(local_args_info.ring_size_given), optarg, 0, "4096", ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "ring-size", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Also serve client requests on this TCP port.  */
+          else if (strcmp (long_options[option_index].name, "listen") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->listen_arg), 
+                 &(args_info->listen_orig), &(args_info->listen_given),
+                &(local_args_info.listen_given), optarg, 0, 0, ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "listen", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Address to listen on.  */
+          else if (strcmp (long_options[option_index].name, "listen-address") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->listen_address_arg), 
+                 &(args_info->listen_address_orig), &(args_info->listen_address_given),
+                &(local_args_info.listen_address_given), optarg, 0, "127.0.0.1", ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "listen-address", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Serve Prometheus metrics on this TCP port.  */
+          else if (strcmp (long_options[option_index].name, "metrics-port") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->metrics_port_arg), 
+                 &(args_info->metrics_port_orig), &(args_info->metrics_port_given),
+                &(local_args_info.metrics_port_given), optarg, 0, 0, ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "metrics-port", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Also append every sample to this columnar archive file.  */
+          else if (strcmp (long_options[option_index].name, "archive") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->archive_arg), 
+                 &(args_info->archive_orig), &(args_info->archive_given),
+                &(local_args_info.archive_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "archive", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Seconds between syncs of the archive to disk.  */
+          else if (strcmp (long_options[option_index].name, "archive-sync") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->archive_sync_arg), 
+                 &(args_info->archive_sync_orig), &(args_info->archive_sync_given),
+                &(local_args_info.archive_sync_given), optarg, 0, "60.0", ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "archive-sync", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Run the setpoint profile in this file (lines of ramp K/min, target K, dwell s).  */
+          else if (strcmp (long_options[option_index].name, "profile") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->profile_arg), 
+                 &(args_info->profile_orig), &(args_info->profile_given),
+                &(local_args_info.profile_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "profile", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Return only once the temperature has stayed within this many K of the working setpoint for --window seconds, polling every --poll-interval.  */
+          else if (strcmp (long_options[option_index].name, "wait-stable") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->wait_stable_arg), 
+                 &(args_info->wait_stable_orig), &(args_info->wait_stable_given),
+                &(local_args_info.wait_stable_given), optarg, 0, 0, ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "wait-stable", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Seconds the temperature must stay within tolerance.  */
+          else if (strcmp (long_options[option_index].name, "window") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->window_arg), 
+                 &(args_info->window_orig), &(args_info->window_given),
+                &(local_args_info.window_given), optarg, 0, "60.0", ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "window", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Give up waiting after this many seconds (0 waits forever).  */
+          else if (strcmp (long_options[option_index].name, "wait-timeout") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->wait_timeout_arg), 
+                 &(args_info->wait_timeout_orig), &(args_info->wait_timeout_given),
+                &(local_args_info.wait_timeout_given), optarg, 0, "0.0", ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "wait-timeout", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Step through these setpoints (e.g. 300,310,320 or 300:340:10), waiting at each until stable as for --wait-stable.  */
+          else if (strcmp (long_options[option_index].name, "sweep") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->sweep_arg), 
+                 &(args_info->sweep_orig), &(args_info->sweep_given),
+                &(local_args_info.sweep_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "sweep", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Shell command run at each setpoint once stable, with BVT_POINT, BVT_SETPOINT and BVT_TEMPERATURE set.  */
+          else if (strcmp (long_options[option_index].name, "sweep-hook") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->sweep_hook_arg), 
+                 &(args_info->sweep_hook_orig), &(args_info->sweep_hook_given),
+                &(local_args_info.sweep_hook_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "sweep-hook", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Step the temperature setpoint to this value by loading it into the inactive setpoint (SP1 or SP2) and then switching over to it with a single write.  */
+          else if (strcmp (long_options[option_index].name, "step-to") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->step_to_arg), 
+                 &(args_info->step_to_orig), &(args_info->step_to_given),
+                &(local_args_info.step_to_given), optarg, 0, 0, ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "step-to", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* When to switch for --step-to: seconds since the epoch (e.g. from date +%s.%N), or +SECONDS from now.  */
+          else if (strcmp (long_options[option_index].name, "step-at") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->step_at_arg), 
+                 &(args_info->step_at_orig), &(args_info->step_at_given),
+                &(local_args_info.step_at_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "step-at", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Tune the PID loop at the current setpoint by relay feedback in manual mode, and write the resulting XP, TI and TD.  */
+          else if (strcmp (long_options[option_index].name, "autotune") == 0)
+          {
+          
+          
+            if (update_arg((void *)&(args_info->autotune_flag), 0, &(args_info->autotune_given),
+                &(local_args_info.autotune_given), optarg, 0, 0, ARG_FLAG,
+                check_ambiguity, override, 1, 0, "autotune", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Heater power (%) the relay adds to and takes away from the power needed at the setpoint.  */
+          else if (strcmp (long_options[option_index].name, "autotune-step") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->autotune_step_arg), 
+                 &(args_info->autotune_step_orig), &(args_info->autotune_step_given),
+                &(local_args_info.autotune_step_given), optarg, 0, "10.0", ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "autotune-step", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Temperature (K) either side of the setpoint at which the relay switches.  */
+          else if (strcmp (long_options[option_index].name, "autotune-hysteresis") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->autotune_hysteresis_arg), 
+                 &(args_info->autotune_hysteresis_orig), &(args_info->autotune_hysteresis_given),
+                &(local_args_info.autotune_hysteresis_given), optarg, 0, "0.2", ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "autotune-hysteresis", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Oscillation cycles to measure, after a first one that is discarded.  */
+          else if (strcmp (long_options[option_index].name, "autotune-cycles") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->autotune_cycles_arg), 
+                 &(args_info->autotune_cycles_orig), &(args_info->autotune_cycles_given),
+                &(local_args_info.autotune_cycles_given), optarg, 0, "4", ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "autotune-cycles", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Tuning rule: classic (Ziegler-Nichols), some-overshoot or no-overshoot.  */
+          else if (strcmp (long_options[option_index].name, "autotune-rule") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->autotune_rule_arg), 
+                 &(args_info->autotune_rule_orig), &(args_info->autotune_rule_given),
+                &(local_args_info.autotune_rule_given), optarg, 0, "classic", ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "autotune-rule", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* In daemon mode, switch PID settings by temperature band as given in this file (lines of from K, to K, then XP TI TD [HB LB] or pid1/pid2).  */
+          else if (strcmp (long_options[option_index].name, "schedule") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->schedule_arg), 
+                 &(args_info->schedule_orig), &(args_info->schedule_given),
+                &(local_args_info.schedule_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "schedule", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* In daemon mode, drive the heater power from the host in manual mode, predicting with this model (GAIN,TAU,DEAD[,TAU2] in K/%, s, as from bvt-ident).  */
+          else if (strcmp (long_options[option_index].name, "mpc") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->mpc_arg), 
+                 &(args_info->mpc_orig), &(args_info->mpc_given),
+                &(local_args_info.mpc_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "mpc", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Time (s) the predictive controller aims to take to close 63% of the gap to the setpoint (0 for a quarter of the model's time constant).  */
+          else if (strcmp (long_options[option_index].name, "mpc-response") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->mpc_response_arg), 
+                 &(args_info->mpc_response_orig), &(args_info->mpc_response_given),
+                &(local_args_info.mpc_response_given), optarg, 0, "0.0", ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "mpc-response", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Heater power (%) the predictive controller never exceeds, also written to the controller's output limit while it runs.  */
+          else if (strcmp (long_options[option_index].name, "mpc-power-limit") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->mpc_power_limit_arg), 
+                 &(args_info->mpc_power_limit_orig), &(args_info->mpc_power_limit_given),
+                &(local_args_info.mpc_power_limit_given), optarg, 0, "100.0", ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "mpc-power-limit", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Gas flow (l/h) to set while the predictive controller runs, e.g. the flow the model was fitted at.  */
+          else if (strcmp (long_options[option_index].name, "mpc-flow") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->mpc_flow_arg), 
+                 &(args_info->mpc_flow_orig), &(args_info->mpc_flow_given),
+                &(local_args_info.mpc_flow_given), optarg, 0, 0, ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "mpc-flow", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* In daemon mode, adjust the LN2 evaporator power so that the main heater works at --ln2-heater-target, holding the setpoint on as little nitrogen and heater power as will do.  */
+          else if (strcmp (long_options[option_index].name, "ln2-control") == 0)
+          {
+          
+          
+            if (update_arg((void *)&(args_info->ln2_control_flag), 0, &(args_info->ln2_control_given),
+                &(local_args_info.ln2_control_given), optarg, 0, 0, ARG_FLAG,
+                check_ambiguity, override, 1, 0, "ln2-control", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Main heater power (%) the LN2 control aims for, enough to control in both directions.  */
+          else if (strcmp (long_options[option_index].name, "ln2-heater-target") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->ln2_heater_target_arg), 
+                 &(args_info->ln2_heater_target_orig), &(args_info->ln2_heater_target_given),
+                &(local_args_info.ln2_heater_target_given), optarg, 0, "10.0", ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "ln2-heater-target", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Time (s) over which the LN2 control corrects the evaporator power, several times slower than the heater loop.  */
+          else if (strcmp (long_options[option_index].name, "ln2-integral-time") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->ln2_integral_time_arg), 
+                 &(args_info->ln2_integral_time_orig), &(args_info->ln2_integral_time_given),
+                &(local_args_info.ln2_integral_time_given), optarg, 0, "300.0", ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "ln2-integral-time", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Evaporator power (%) the LN2 control never exceeds.  */
+          else if (strcmp (long_options[option_index].name, "ln2-power-limit") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->ln2_power_limit_arg), 
+                 &(args_info->ln2_power_limit_orig), &(args_info->ln2_power_limit_given),
+                &(local_args_info.ln2_power_limit_given), optarg, 0, "100.0", ARG_FLOAT,
+                check_ambiguity, override, 0, 0,
+                "ln2-power-limit", '-',
+                additional_error))
+              goto failure;
+          
           }
           
           break;
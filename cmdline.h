@@ -138,6 +138,96 @@ struct gengetopt_args_info
   const char *status_all_help; /**< @brief Return the status of everything that is a status help description.  */
   int check_sensor_break_flag;	/**< @brief Check to see if the Thermocouples are broken (default=off).  */
   const char *check_sensor_break_help; /**< @brief Check to see if the Thermocouples are broken help description.  */
+  int daemon_flag;	/**< @brief Keep running, polling the device and publishing its state until interrupted (default=off).  */
+  const char *daemon_help; /**< @brief Keep running, polling the device and publishing its state until interrupted help description.  */
+  float poll_interval_arg;	/**< @brief Sampling interval in seconds, for the daemon, --wait-stable, --sweep and --autotune (default='1.0').  */
+  char * poll_interval_orig;	/**< @brief Sampling interval in seconds, for the daemon, --wait-stable, --sweep and --autotune original value given at command line.  */
+  const char *poll_interval_help; /**< @brief Sampling interval in seconds, for the daemon, --wait-stable, --sweep and --autotune help description.  */
+  char * shm_name_arg;	/**< @brief Name of the shared-memory segment holding the latest state (default='/bvt3000').  */
+  char * shm_name_orig;	/**< @brief Name of the shared-memory segment holding the latest state original value given at command line.  */
+  const char *shm_name_help; /**< @brief Name of the shared-memory segment holding the latest state help description.  */
+  int ring_size_arg;	/**< @brief Number of samples kept in the shared-memory sample ring (a power of two) (default='4096').  */
+  char * ring_size_orig;	/**< @brief Number of samples kept in the shared-memory sample ring (a power of two) original value given at command line.  */
+  const char *ring_size_help; /**< @brief Number of samples kept in the shared-memory sample ring (a power of two) help description.  */
+  int listen_arg;	/**< @brief Also serve client requests on this TCP port.  */
+  char * listen_orig;	/**< @brief Also serve client requests on this TCP port original value given at command line.  */
+  const char *listen_help; /**< @brief Also serve client requests on this TCP port help description.  */
+  char * listen_address_arg;	/**< @brief Address to listen on (default='127.0.0.1').  */
+  char * listen_address_orig;	/**< @brief Address to listen on original value given at command line.  */
+  const char *listen_address_help; /**< @brief Address to listen on help description.  */
+  int metrics_port_arg;	/**< @brief Serve Prometheus metrics on this TCP port.  */
+  char * metrics_port_orig;	/**< @brief Serve Prometheus metrics on this TCP port original value given at command line.  */
+  const char *metrics_port_help; /**< @brief Serve Prometheus metrics on this TCP port help description.  */
+  char * archive_arg;	/**< @brief Also append every sample to this columnar archive file.  */
+  char * archive_orig;	/**< @brief Also append every sample to this columnar archive file original value given at command line.  */
+  const char *archive_help; /**< @brief Also append every sample to this columnar archive file help description.  */
+  float archive_sync_arg;	/**< @brief Seconds between syncs of the archive to disk (default='60.0').  */
+  char * archive_sync_orig;	/**< @brief Seconds between syncs of the archive to disk original value given at command line.  */
+  const char *archive_sync_help; /**< @brief Seconds between syncs of the archive to disk help description.  */
+  char * profile_arg;	/**< @brief Run the setpoint profile in this file (lines of ramp K/min, target K, dwell s).  */
+  char * profile_orig;	/**< @brief Run the setpoint profile in this file (lines of ramp K/min, target K, dwell s) original value given at command line.  */
+  const char *profile_help; /**< @brief Run the setpoint profile in this file (lines of ramp K/min, target K, dwell s) help description.  */
+  float wait_stable_arg;	/**< @brief Return only once the temperature has stayed within this many K of the working setpoint for --window seconds, polling every --poll-interval.  */
+  char * wait_stable_orig;	/**< @brief Return only once the temperature has stayed within this many K of the working setpoint for --window seconds, polling every --poll-interval original value given at command line.  */
+  const char *wait_stable_help; /**< @brief Return only once the temperature has stayed within this many K of the working setpoint for --window seconds, polling every --poll-interval help description.  */
+  float window_arg;	/**< @brief Seconds the temperature must stay within tolerance (default='60.0').  */
+  char * window_orig;	/**< @brief Seconds the temperature must stay within tolerance original value given at command line.  */
+  const char *window_help; /**< @brief Seconds the temperature must stay within tolerance help description.  */
+  float wait_timeout_arg;	/**< @brief Give up waiting after this many seconds (0 waits forever) (default='0.0').  */
+  char * wait_timeout_orig;	/**< @brief Give up waiting after this many seconds (0 waits forever) original value given at command line.  */
+  const char *wait_timeout_help; /**< @brief Give up waiting after this many seconds (0 waits forever) help description.  */
+  char * sweep_arg;	/**< @brief Step through these setpoints (e.g. 300,310,320 or 300:340:10), waiting at each until stable as for --wait-stable.  */
+  char * sweep_orig;	/**< @brief Step through these setpoints (e.g. 300,310,320 or 300:340:10), waiting at each until stable as for --wait-stable original value given at command line.  */
+  const char *sweep_help; /**< @brief Step through these setpoints (e.g. 300,310,320 or 300:340:10), waiting at each until stable as for --wait-stable help description.  */
+  char * sweep_hook_arg;	/**< @brief Shell command run at each setpoint once stable, with BVT_POINT, BVT_SETPOINT and BVT_TEMPERATURE set.  */
+  char * sweep_hook_orig;	/**< @brief Shell command run at each setpoint once stable, with BVT_POINT, BVT_SETPOINT and BVT_TEMPERATURE set original value given at command line.  */
+  const char *sweep_hook_help; /**< @brief Shell command run at each setpoint once stable, with BVT_POINT, BVT_SETPOINT and BVT_TEMPERATURE set help description.  */
+  float step_to_arg;	/**< @brief Step the temperature setpoint to this value by loading it into the inactive setpoint (SP1 or SP2) and then switching over to it with a single write.  */
+  char * step_to_orig;	/**< @brief Step the temperature setpoint to this value by loading it into the inactive setpoint (SP1 or SP2) and then switching over to it with a single write original value given at command line.  */
+  const char *step_to_help; /**< @brief Step the temperature setpoint to this value by loading it into the inactive setpoint (SP1 or SP2) and then switching over to it with a single write help description.  */
+  char * step_at_arg;	/**< @brief When to switch for --step-to: seconds since the epoch (e.g. from date +%s.%N), or +SECONDS from now.  */
+  char * step_at_orig;	/**< @brief When to switch for --step-to: seconds since the epoch (e.g. from date +%s.%N), or +SECONDS from now original value given at command line.  */
+  const char *step_at_help; /**< @brief When to switch for --step-to: seconds since the epoch (e.g. from date +%s.%N), or +SECONDS from now help description.  */
+  int autotune_flag;	/**< @brief Tune the PID loop at the current setpoint by relay feedback in manual mode, and write the resulting XP, TI and TD (default=off).  */
+  const char *autotune_help; /**< @brief Tune the PID loop at the current setpoint by relay feedback in manual mode, and write the resulting XP, TI and TD help description.  */
+  float autotune_step_arg;	/**< @brief Heater power (%) the relay adds to and takes away from the power needed at the setpoint (default='10.0').  */
+  char * autotune_step_orig;	/**< @brief Heater power (%) the relay adds to and takes away from the power needed at the setpoint original value given at command line.  */
+  const char *autotune_step_help; /**< @brief Heater power (%) the relay adds to and takes away from the power needed at the setpoint help description.  */
+  float autotune_hysteresis_arg;	/**< @brief Temperature (K) either side of the setpoint at which the relay switches (default='0.2').  */
+  char * autotune_hysteresis_orig;	/**< @brief Temperature (K) either side of the setpoint at which the relay switches original value given at command line.  */
+  const char *autotune_hysteresis_help; /**< @brief Temperature (K) either side of the setpoint at which the relay switches help description.  */
+  int autotune_cycles_arg;	/**< @brief Oscillation cycles to measure, after a first one that is discarded (default='4').  */
+  char * autotune_cycles_orig;	/**< @brief Oscillation cycles to measure, after a first one that is discarded original value given at command line.  */
+  const char *autotune_cycles_help; /**< @brief Oscillation cycles to measure, after a first one that is discarded help description.  */
+  char * autotune_rule_arg;	/**< @brief Tuning rule: classic (Ziegler-Nichols), some-overshoot or no-overshoot (default='classic').  */
+  char * autotune_rule_orig;	/**< @brief Tuning rule: classic (Ziegler-Nichols), some-overshoot or no-overshoot original value given at command line.  */
+  const char *autotune_rule_help; /**< @brief Tuning rule: classic (Ziegler-Nichols), some-overshoot or no-overshoot help description.  */
+  char * schedule_arg;	/**< @brief In daemon mode, switch PID settings by temperature band as given in this file (lines of from K, to K, then XP TI TD [HB LB] or pid1/pid2).  */
+  char * schedule_orig;	/**< @brief In daemon mode, switch PID settings by temperature band as given in this file (lines of from K, to K, then XP TI TD [HB LB] or pid1/pid2) original value given at command line.  */
+  const char *schedule_help; /**< @brief In daemon mode, switch PID settings by temperature band as given in this file (lines of from K, to K, then XP TI TD [HB LB] or pid1/pid2) help description.  */
+  char * mpc_arg;	/**< @brief In daemon mode, drive the heater power from the host in manual mode, predicting with this model (GAIN,TAU,DEAD[,TAU2] in K/%, s, as from bvt-ident).  */
+  char * mpc_orig;	/**< @brief In daemon mode, drive the heater power from the host in manual mode, predicting with this model (GAIN,TAU,DEAD[,TAU2] in K/%, s, as from bvt-ident) original value given at command line.  */
+  const char *mpc_help; /**< @brief In daemon mode, drive the heater power from the host in manual mode, predicting with this model (GAIN,TAU,DEAD[,TAU2] in K/%, s, as from bvt-ident) help description.  */
+  float mpc_response_arg;	/**< @brief Time (s) the predictive controller aims to take to close 63% of the gap to the setpoint (0 for a quarter of the model's time constant) (default='0.0').  */
+  char * mpc_response_orig;	/**< @brief Time (s) the predictive controller aims to take to close 63% of the gap to the setpoint (0 for a quarter of the model's time constant) original value given at command line.  */
+  const char *mpc_response_help; /**< @brief Time (s) the predictive controller aims to take to close 63% of the gap to the setpoint (0 for a quarter of the model's time constant) help description.  */
+  float mpc_power_limit_arg;	/**< @brief Heater power (%) the predictive controller never exceeds, also written to the controller's output limit while it runs (default='100.0').  */
+  char * mpc_power_limit_orig;	/**< @brief Heater power (%) the predictive controller never exceeds, also written to the controller's output limit while it runs original value given at command line.  */
+  const char *mpc_power_limit_help; /**< @brief Heater power (%) the predictive controller never exceeds, also written to the controller's output limit while it runs help description.  */
+  float mpc_flow_arg;	/**< @brief Gas flow (l/h) to set while the predictive controller runs, e.g. the flow the model was fitted at.  */
+  char * mpc_flow_orig;	/**< @brief Gas flow (l/h) to set while the predictive controller runs, e.g. the flow the model was fitted at original value given at command line.  */
+  const char *mpc_flow_help; /**< @brief Gas flow (l/h) to set while the predictive controller runs, e.g. the flow the model was fitted at help description.  */
+  int ln2_control_flag;	/**< @brief In daemon mode, adjust the LN2 evaporator power so that the main heater works at --ln2-heater-target, holding the setpoint on as little nitrogen and heater power as will do (default=off).  */
+  const char *ln2_control_help; /**< @brief In daemon mode, adjust the LN2 evaporator power so that the main heater works at --ln2-heater-target, holding the setpoint on as little nitrogen and heater power as will do help description.  */
+  float ln2_heater_target_arg;	/**< @brief Main heater power (%) the LN2 control aims for, enough to control in both directions (default='10.0').  */
+  char * ln2_heater_target_orig;	/**< @brief Main heater power (%) the LN2 control aims for, enough to control in both directions original value given at command line.  */
+  const char *ln2_heater_target_help; /**< @brief Main heater power (%) the LN2 control aims for, enough to control in both directions help description.  */
+  float ln2_integral_time_arg;	/**< @brief Time (s) over which the LN2 control corrects the evaporator power, several times slower than the heater loop (default='300.0').  */
+  char * ln2_integral_time_orig;	/**< @brief Time (s) over which the LN2 control corrects the evaporator power, several times slower than the heater loop original value given at command line.  */
+  const char *ln2_integral_time_help; /**< @brief Time (s) over which the LN2 control corrects the evaporator power, several times slower than the heater loop help description.  */
+  float ln2_power_limit_arg;	/**< @brief Evaporator power (%) the LN2 control never exceeds (default='100.0').  */
+  char * ln2_power_limit_orig;	/**< @brief Evaporator power (%) the LN2 control never exceeds original value given at command line.  */
+  const char *ln2_power_limit_help; /**< @brief Evaporator power (%) the LN2 control never exceeds help description.  */
   
   unsigned int help_given ;	/**< @brief Whether help was given.  */
   unsigned int full_help_given ;	/**< @brief Whether full-help was given.  */
@@ -182,6 +272,37 @@ struct gengetopt_args_info
   unsigned int get_eurotherm_status_given ;	/**< @brief Whether get-eurotherm-status was given.  */
   unsigned int status_all_given ;	/**< @brief Whether status-all was given.  */
   unsigned int check_sensor_break_given ;	/**< @brief Whether check-sensor-break was given.  */
+  unsigned int daemon_given ;	/**< @brief Whether daemon was given.  */
+  unsigned int poll_interval_given ;	/**< @brief Whether poll-interval was given.  */
+  unsigned int shm_name_given ;	/**< @brief Whether shm-name was given.  */
+  unsigned int ring_size_given ;	/**< @brief Whether ring-size was given.  */
+  unsigned int listen_given ;	/**< @brief Whether listen was given.  */
+  unsigned int listen_address_given ;	/**< @brief Whether listen-address was given.  */
+  unsigned int metrics_port_given ;	/**< @brief Whether metrics-port was given.  */
+  unsigned int archive_given ;	/**< @brief Whether archive was given.  */
+  unsigned int archive_sync_given ;	/**< @brief Whether archive-sync was given.  */
+  unsigned int profile_given ;	/**< @brief Whether profile was given.  */
+  unsigned int wait_stable_given ;	/**< @brief Whether wait-stable was given.  */
+  unsigned int window_given ;	/**< @brief Whether window was given.  */
+  unsigned int wait_timeout_given ;	/**< @brief Whether wait-timeout was given.  */
+  unsigned int sweep_given ;	/**< @brief Whether sweep was given.  */
+  unsigned int sweep_hook_given ;	/**< @brief Whether sweep-hook was given.  */
+  unsigned int step_to_given ;	/**< @brief Whether step-to was given.  */
+  unsigned int step_at_given ;	/**< @brief Whether step-at was given.  */
+  unsigned int autotune_given ;	/**< @brief Whether autotune was given.  */
+  unsigned int autotune_step_given ;	/**< @brief Whether autotune-step was given.  */
+  unsigned int autotune_hysteresis_given ;	/**< @brief Whether autotune-hysteresis was given.  */
+  unsigned int autotune_cycles_given ;	/**< @brief Whether autotune-cycles was given.  */
+  unsigned int autotune_rule_given ;	/**< @brief Whether autotune-rule was given.  */
+  unsigned int schedule_given ;	/**< @brief Whether schedule was given.  */
+  unsigned int mpc_given ;	/**< @brief Whether mpc was given.  */
+  unsigned int mpc_response_given ;	/**< @brief Whether mpc-response was given.  */
+  unsigned int mpc_power_limit_given ;	/**< @brief Whether mpc-power-limit was given.  */
+  unsigned int mpc_flow_given ;	/**< @brief Whether mpc-flow was given.  */
+  unsigned int ln2_control_given ;	/**< @brief Whether ln2-control was given.  */
+  unsigned int ln2_heater_target_given ;	/**< @brief Whether ln2-heater-target was given.  */
+  unsigned int ln2_integral_time_given ;	/**< @brief Whether ln2-integral-time was given.  */
+  unsigned int ln2_power_limit_given ;	/**< @brief Whether ln2-power-limit was given.  */
 
 } ;
 
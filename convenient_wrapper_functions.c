@@ -1,3 +1,4 @@
+#include <errno.h>
 #include "convenient_wrapper_functions.h" 
 extern bool verboseFlag; 
 
@@ -22,9 +23,31 @@ double translate_flow_rate(unsigned int gfr){
     return(flow_rates[gfr]); 
 }
 
+/* Index of the table entry nearest to a flow rate, -1 if out of range */ 
+
+int flow_rate_index( double flow_rate ) { 
+    int i; 
+
+    if ( ! ( flow_rate >= 0.0 && flow_rate <= flow_rates[ 15 ] ) ) { 
+        return -1; 
+    }
+    for ( i = 1; i < 16; i++ )
+        if (    flow_rate >= flow_rates[ i - 1 ]
+             && flow_rate <= flow_rates[ i ] )
+        {
+            if ( flow_rate < 0.5 * ( flow_rates[ i - 1 ] + flow_rates[ i ] ) )
+                return i - 1;
+            else
+                return i;
+        }
+    return 0; 
+}
+
+/* Returns 0 once the device has taken the flow rate, -1 for one out of
+   range, -2 if the device did not acknowledge it */
+
 int set_flow_rate( double flow_rate, struct sp_port* port_choice ) {
     int fr_index=0;  
-    int i = 0; 
 
     if(verboseFlag) {
         printf("Requested to change flow rate to %lf\n", flow_rate); 
@@ -39,23 +62,16 @@ int set_flow_rate( double flow_rate, struct sp_port* port_choice ) {
         printf("FATAL: flow rate must be below 2000 l/hr\n"); 
         return(-1); 
     }
-    for ( i = 1; i < 16; i++ )
-        if (    flow_rate >= flow_rates[ i - 1 ]
-             && flow_rate <= flow_rates[ i ] )
-        {
-            if ( flow_rate < 0.5 * ( flow_rates[ i - 1 ] + flow_rates[ i ] ) )
-                fr_index = i - 1;
-            else
-                fr_index = i;
-            break;
-        }
+    fr_index = flow_rate_index( flow_rate ); 
 
     if (    flow_rate != 0.0
          && fabs( ( flow_rate - flow_rates[ fr_index ] ) / flow_rate ) > 0.01 )
         printf("WARNING: Flow rate had to be adjusted from %.1f l/h to "
                "%.1f l/h.\n", flow_rate, flow_rates[ fr_index ] );
 
-    bvt3000_set_flow_rate( fr_index , port_choice);
+    if (! bvt3000_set_flow_rate( fr_index , port_choice)) { 
+        return(-2); 
+    }
     return 0; 
 }
 
@@ -84,3 +100,91 @@ void setHeaterPowerLimit(float limit, struct sp_port* port_choice){
 
     }
 }
+
+/*------------------------------------------------------------------*
+ * Steps the setpoint to `target' at the wall-clock time `at' (now if
+ * NULL) with as little delay and jitter as possible: the target is
+ * loaded into the inactive setpoint beforehand and checked, and at the
+ * time itself there is only the one status word write that switches
+ * over to it. The status word is read shortly before that, so that the
+ * write does not undo changes made in the meantime. Prints how late
+ * the write started and finished (ms), then checks the result.
+ *------------------------------------------------------------------*/
+
+#define STEP_LEAD  0.5    /* s before the step to read the status word */ 
+
+static double seconds_until( const struct timespec *at ) { 
+    struct timespec now; 
+
+    clock_gettime( CLOCK_REALTIME, &now ); 
+    return ( at->tv_sec - now.tv_sec ) + ( at->tv_nsec - now.tv_nsec ) * 1e-9; 
+}
+
+static void sleep_until( const struct timespec *at ) { 
+    while ( clock_nanosleep( CLOCK_REALTIME, TIMER_ABSTIME, at, NULL ) == EINTR ) { 
+    }
+}
+
+int step_setpoint( double target, const struct timespec *at, struct sp_port* port_choice ) 
+{ 
+    struct timespec when, lead; 
+    unsigned int sw; 
+    int next; 
+    double loaded, started, finished; 
+
+    if (target < MIN_SETPOINT || target > MAX_SETPOINT) { 
+        fprintf(stderr,"FATAL: Setpoint %f not in [%.0f, %.0f] K\n", target, MIN_SETPOINT, MAX_SETPOINT); 
+        return -1; 
+    }
+    next = eurotherm902s_get_active_setpoint( port_choice ) == SP1 ? SP2 : SP1; 
+    if (verboseFlag) { 
+        printf("Loading %f into SP%d\n", target, next + 1); 
+    }
+    eurotherm902s_set_setpoint( next, target, port_choice ); 
+    /* SL / S2 are read without a BCC and come back without their last
+       digit (see bvt3000_query_without_bcc), so this only catches gross
+       mismatches; the working setpoint is checked after the switch */
+    loaded = eurotherm902s_get_setpoint( next, port_choice ); 
+    if (fabs( loaded - target ) >= 1.0) { 
+        fprintf(stderr,"FATAL: SP%d reads back as %f rather than %f, not switching\n", 
+                next + 1, loaded, target); 
+        return -1; 
+    }
+
+    if (at == NULL) { 
+        clock_gettime( CLOCK_REALTIME, &when ); 
+    } else { 
+        when = *at; 
+    }
+    if (seconds_until( &when ) > STEP_LEAD) { 
+        lead = when; 
+        lead.tv_nsec -= (long) ( STEP_LEAD * 1e9 ); 
+        if (lead.tv_nsec < 0) { 
+            lead.tv_nsec += 1000000000L; 
+            lead.tv_sec--; 
+        }
+        sleep_until( &lead ); 
+    } else if (at != NULL && seconds_until( &when ) < 0.0) { 
+        fprintf(stderr,"WARNING: Step time already passed, switching now\n"); 
+    }
+    sw = eurotherm902s_get_sw( port_choice ); 
+    if (next == SP1) { 
+        sw &= ~ ACTIVE_SETPOINT_FLAG; 
+    } else { 
+        sw |= ACTIVE_SETPOINT_FLAG; 
+    }
+
+    sleep_until( &when ); 
+    started = -seconds_until( &when ); 
+    eurotherm902s_set_sw( sw, port_choice ); 
+    finished = -seconds_until( &when ); 
+
+    printf("***STEP: %d %lf %lf\n", next + 1, started * 1e3, finished * 1e3); 
+
+    loaded = eurotherm902s_get_working_setpoint( port_choice ); 
+    if (fabs( loaded - target ) > 0.05) { 
+        fprintf(stderr,"WARNING: Working setpoint is %f after the step, not %f\n", loaded, target); 
+        return -1; 
+    }
+    return 0; 
+}
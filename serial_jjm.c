@@ -47,15 +47,142 @@ void bvt3000_comm_fail_debug( char const * caller_name ) {
  */
 
 
+/*------------------------------------------------------------------*
+ * Coalescing of identical reads: each good reply is remembered for
+ * a short window, and an identical query within that window is
+ * answered from it instead of going out on the wire again. Anything
+ * sent to the device invalidates all remembered replies.
+ *------------------------------------------------------------------*/
+
+static struct { 
+    char cmd[ 3 ]; 
+    char reply[ 100 ]; 
+    struct timespec when; 
+} coalesce_cache[ COALESCE_SLOTS ];
+
+static unsigned int coalesce_window = COALESCE_WINDOW; 
+
+void bvt3000_set_coalesce_window( unsigned int ms ) { 
+    coalesce_window = ms; 
+    bvt3000_coalesce_invalidate( ); 
+}
+
+void bvt3000_coalesce_invalidate( void ) { 
+    for (int i = 0; i < COALESCE_SLOTS; i++) { 
+        coalesce_cache[ i ].cmd[ 0 ] = '\0'; 
+    }
+}
+
+static long elapsed_ms( const struct timespec *since ) { 
+    struct timespec now; 
+    clock_gettime( CLOCK_MONOTONIC, &now ); 
+    return ( now.tv_sec - since->tv_sec ) * 1000L 
+           + ( now.tv_nsec - since->tv_nsec ) / 1000000L; 
+}
+
+static const char * bvt3000_coalesced_reply( const char * cmd ) { 
+    if (coalesce_window == 0) { 
+        return NULL; 
+    }
+    for (int i = 0; i < COALESCE_SLOTS; i++) { 
+        if ( ! strcmp( coalesce_cache[ i ].cmd, cmd ) ) { 
+            if ( elapsed_ms( &coalesce_cache[ i ].when ) < (long) coalesce_window ) { 
+                return coalesce_cache[ i ].reply; 
+            }
+            return NULL; 
+        }
+    }
+    return NULL; 
+}
+
+static void bvt3000_coalesce_store( const char * cmd, const char * reply ) { 
+    int slot = 0; 
+
+    if (coalesce_window == 0) { 
+        return; 
+    }
+    /* Reuse the slot for this command, or else the oldest one */ 
+    for (int i = 0; i < COALESCE_SLOTS; i++) { 
+        if ( ! strcmp( coalesce_cache[ i ].cmd, cmd ) ) { 
+            slot = i; 
+            break; 
+        }
+        if ( coalesce_cache[ i ].cmd[ 0 ] == '\0' 
+             || elapsed_ms( &coalesce_cache[ i ].when ) > elapsed_ms( &coalesce_cache[ slot ].when ) ) { 
+            slot = i; 
+        }
+    }
+    strcpy( coalesce_cache[ slot ].cmd, cmd ); 
+    snprintf( coalesce_cache[ slot ].reply, sizeof coalesce_cache[ slot ].reply, "%s", reply ); 
+    clock_gettime( CLOCK_MONOTONIC, &coalesce_cache[ slot ].when ); 
+}
+
+/*------------------------------------------------------------------*
+ * Link statistics: transaction, error and round-trip time counters,
+ * for monitoring how healthy the serial line is
+ *------------------------------------------------------------------*/
+
+const double bvt3000_rtt_bounds[ RTT_BUCKETS ] = 
+    { 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0, 2.0 }; 
+
+static struct bvt3000_link_stats link_stats; 
+static bool last_query_good = true; 
+
+const struct bvt3000_link_stats * bvt3000_get_link_stats( void ) 
+{ 
+    return &link_stats; 
+}
+
+/* Whether the last read got a usable reply (the value returned for one
+   that did not is meaningless, usually an empty string) */ 
+
+bool bvt3000_last_query_ok( void ) 
+{ 
+    return last_query_good; 
+}
+
+static void link_rtt( const struct timespec * start ) 
+{ 
+    struct timespec now; 
+    double rtt; 
+    int i; 
+
+    clock_gettime( CLOCK_MONOTONIC, &now ); 
+    rtt = ( now.tv_sec - start->tv_sec ) + ( now.tv_nsec - start->tv_nsec ) * 1e-9; 
+
+    for (i = 0; i < RTT_BUCKETS && rtt > bvt3000_rtt_bounds[ i ]; i++) { 
+    }
+    link_stats.rtt_bucket[ i ]++; 
+    link_stats.rtt_sum += rtt; 
+    link_stats.rtt_count++; 
+}
 
 char * bvt3000_query( const char * cmd, struct sp_port* port_choice )
 { 
 	static char buf[ 100 ];
 	unsigned char bc;
 	ssize_t len;
+    bool good = true; 
+    const char *cached; 
+    struct timespec start; 
 
 	assert( cmd[ 2 ] == '\0' );
 
+    /* Posted writes go out before any read, so it sees their effect */
+
+    bvt3000_flush_posted_writes( port_choice ); 
+
+    if ( ( cached = bvt3000_coalesced_reply( cmd ) ) != NULL ) { 
+        if (verboseFlag) { 
+            printf("Query %s coalesced with a recent identical read\n", cmd); 
+        }
+        strcpy( buf + 3, cached ); 
+        link_stats.coalesced++; 
+        last_query_good = true; 
+        return buf + 3; 
+    }
+    link_stats.queries++; 
+
 	/* Assemble string to be send */
 
 	len = sprintf( buf, "%c%02d%02d%s%c", EOT, GROUP_ID, DEVICE_ID, cmd, ENQ );
@@ -72,18 +199,26 @@ char * bvt3000_query( const char * cmd, struct sp_port* port_choice )
 	   with STX, followed by the 2-char command, then data and finally an
 	   ETX and the BCC (block check character) gets send. */
 
+    clock_gettime( CLOCK_MONOTONIC, &start ); 
     enum sp_return error = sp_blocking_write(port_choice, &buf, len, SERIAL_WAIT); 
 
     if (error <0 || sp_drain(port_choice) ) { 
         fprintf(stderr, "Error writing to serial port: error is %d\n",error); 
         bvt3000_comm_fail( );
+        good = false; 
     }
 
     len = sp_blocking_read(port_choice, &buf, sizeof buf -1, SERIAL_WAIT) ;
+    if (len == 0) { 
+        link_stats.timeouts++; 
+    } else if (len > 0) { 
+        link_rtt( &start ); 
+    }
 
     if (len  < 0 || sp_drain(port_choice) ) { 
         fprintf(stderr, "Error reading from serial port\n"); 
         bvt3000_comm_fail( );
+        good = false; 
     }
     #ifdef DEBUG
     if(verboseFlag){
@@ -95,6 +230,19 @@ char * bvt3000_query( const char * cmd, struct sp_port* port_choice )
     }
     #endif 
 
+    /* A timeout, or too short to hold STX, command, ETX and BCC: nothing to take apart */
+
+    if (len < 5) { 
+        if (len > 0) { 
+            fprintf(stderr, "Comunication may be degraded: %d byte reply\n", (int) len); 
+            link_stats.framing_errors++; 
+        }
+        link_stats.failed_reads++; 
+        last_query_good = false; 
+        buf[ 3 ] = '\0'; 
+        return buf + 3; 
+    }
+
     if(len == sizeof buf - 1                        // reply too long //
 		 || buf[ 0 ] != STX                              // missing STX //
          || buf[ len - 2 ] != ETX                        // missing ETX //
@@ -105,18 +253,28 @@ char * bvt3000_query( const char * cmd, struct sp_port* port_choice )
             fprintf(stderr, "%02x",buf[i]);
         } 
         fprintf(stderr, "' \n"); 
-
+        link_stats.framing_errors++; 
+        good = false; 
     } 
 
     bc = buf[ len - 1 ];
     buf[ len - 1 ] = '\0';
 
-    if ( ! bvt3000_check_bcc( ( unsigned char * ) ( buf + 1 ), bc ) )
+    if ( ! bvt3000_check_bcc( ( unsigned char * ) ( buf + 1 ), bc ) ) {
         bvt3000_comm_fail( );
+        link_stats.bcc_errors++; 
+        good = false; 
+    }
     
 	/* Return just the data as a '\0'-terminated string */
 
     buf[ len - 2 ] = '\0';
+    if (good) { 
+        bvt3000_coalesce_store( cmd, buf + 3 ); 
+    } else { 
+        link_stats.failed_reads++; 
+    }
+    last_query_good = good; 
 	return buf + 3;
 }
 
@@ -126,9 +284,27 @@ char * bvt3000_query_without_bcc( const char * cmd, struct sp_port* port_choice
 	static char buf[ 100 ];
 	unsigned char bc;
 	ssize_t len;
+    bool good = true; 
+    const char *cached; 
+    struct timespec start; 
 
 	assert( cmd[ 2 ] == '\0' );
 
+    /* Posted writes go out before any read, so it sees their effect */
+
+    bvt3000_flush_posted_writes( port_choice ); 
+
+    if ( ( cached = bvt3000_coalesced_reply( cmd ) ) != NULL ) { 
+        if (verboseFlag) { 
+            printf("Query %s coalesced with a recent identical read\n", cmd); 
+        }
+        strcpy( buf + 3, cached ); 
+        link_stats.coalesced++; 
+        last_query_good = true; 
+        return buf + 3; 
+    }
+    link_stats.queries++; 
+
 	/* Assemble string to be send */
 
 	len = sprintf( buf, "%c%02d%02d%s%c", EOT, GROUP_ID, DEVICE_ID, cmd, ENQ );
@@ -145,18 +321,26 @@ char * bvt3000_query_without_bcc( const char * cmd, struct sp_port* port_choice
 	   with STX, followed by the 2-char command, then data and finally an
 	   ETX and the BCC (block check character) gets send. */
 
+    clock_gettime( CLOCK_MONOTONIC, &start ); 
     enum sp_return error = sp_blocking_write(port_choice, &buf, len, SERIAL_WAIT); 
 
     if (error <0 || sp_drain(port_choice) ) { 
         fprintf(stderr, "Error writing to serial port: error is %d\n",error); 
         bvt3000_comm_fail( );
+        good = false; 
     }
 
     len = sp_blocking_read(port_choice, &buf, sizeof buf -1, SERIAL_WAIT) ;
+    if (len == 0) { 
+        link_stats.timeouts++; 
+    } else if (len > 0) { 
+        link_rtt( &start ); 
+    }
 
     if (len  < 0 || sp_drain(port_choice) ) { 
         fprintf(stderr, "Error reading from serial port\n"); 
         bvt3000_comm_fail( );
+        good = false; 
     }
     #ifdef DEBUG
     if(verboseFlag){
@@ -168,6 +352,19 @@ char * bvt3000_query_without_bcc( const char * cmd, struct sp_port* port_choice
     }
     #endif 
 
+    /* A timeout, or too short to hold STX, command and ETX: nothing to take apart */
+
+    if (len < 4) { 
+        if (len > 0) { 
+            fprintf(stderr, "Comunication may be degraded: %d byte reply\n", (int) len); 
+            link_stats.framing_errors++; 
+        }
+        link_stats.failed_reads++; 
+        last_query_good = false; 
+        buf[ 3 ] = '\0'; 
+        return buf + 3; 
+    }
+
     if(len == sizeof buf - 1                        // reply too long //
 		 || buf[ 0 ] != STX                              // missing STX //
          || buf[ len - 1 ] != ETX                        // missing ETX //
@@ -178,7 +375,8 @@ char * bvt3000_query_without_bcc( const char * cmd, struct sp_port* port_choice
             fprintf(stderr, "%02x",buf[i]);
         } 
         fprintf(stderr, "' \n"); 
-
+        link_stats.framing_errors++; 
+        good = false; 
     } 
 
     bc = buf[ len - 1 ];
@@ -187,6 +385,12 @@ char * bvt3000_query_without_bcc( const char * cmd, struct sp_port* port_choice
 	/* Return just the data as a '\0'-terminated string */
 
     buf[ len - 2 ] = '\0';
+    if (good) { 
+        bvt3000_coalesce_store( cmd, buf + 3 ); 
+    } else { 
+        link_stats.failed_reads++; 
+    }
+    last_query_good = good; 
 	return buf + 3;
 }
 
@@ -252,13 +456,18 @@ struct sp_port* open_and_init_port(char* desired_port, struct sp_port *port_choi
     return(port_choice); 
 }
 
-void bvt3000_send_command( const char * cmd , struct sp_port *port_choice )
+bool bvt3000_send_command( const char * cmd , struct sp_port *port_choice )
 {
 	char buf[ 100 ];
 	ssize_t len;
+    struct timespec start; 
 
     assert(sizeof cmd < 70); 
 
+    /* Anything we change may alter what the device would reply */
+
+    bvt3000_coalesce_invalidate( ); 
+
 	/* Assemble the string to be sent */
 
 	sprintf( buf, "%c%02d%02d%c%s%c",
@@ -267,6 +476,8 @@ void bvt3000_send_command( const char * cmd , struct sp_port *port_choice )
 
 	/* Send string and check for ACK */
 
+    link_stats.commands++; 
+    clock_gettime( CLOCK_MONOTONIC, &start ); 
     enum sp_return error = sp_blocking_write(port_choice, buf, len, SERIAL_WAIT); 
     sp_drain(port_choice); 
 
@@ -283,10 +494,14 @@ void bvt3000_send_command( const char * cmd , struct sp_port *port_choice )
     if (error > SP_OK) { // Check for ACK 
         if(bvt3000_check_ack(port_choice) != OK ) {
             bvt3000_comm_fail(); 
+            return FAIL; 
         }
+        link_rtt( &start ); 
     } else { 
         fprintf(stderr,"WARNING: Error sending command %s\n", cmd); 
+        return FAIL; 
     }
+    return OK; 
 }
 
 size_t  bvt3000_add_bcc( unsigned char * data )
@@ -331,11 +546,17 @@ bool bvt3000_check_ack( struct sp_port* port_choice)
     if (error < SP_OK) {
         return FAIL;
     }
+    if (error == 0) { 
+        link_stats.timeouts++; 
+        return FAIL; 
+    }
     if ( r == ACK )
         return OK;
 
-    if ( r == NAK )
+    if ( r == NAK ) { 
+        link_stats.naks++; 
         bvt3000_query( "EE" , port_choice);    
+    }
 
     return FAIL;
 
@@ -450,10 +671,11 @@ bvt3000_get_flow_rate( struct sp_port* port_choice )
 }
 
 /*----------------------------------------*
- * Sends command to set the gas flow rate
+ * Sends command to set the gas flow rate,
+ * returns whether the device ACKed it
  *----------------------------------------*/
 
-void
+bool
 bvt3000_set_flow_rate( unsigned int flow_rate, struct sp_port* port_choice )
 {
     char buf[ 20 ];
@@ -465,7 +687,7 @@ bvt3000_set_flow_rate( unsigned int flow_rate, struct sp_port* port_choice )
                                  flow_rate & 0x4 ? '1' : '0',
                                  flow_rate & 0x2 ? '1' : '0',
                                  flow_rate & 0x1 ? '1' : '0' );
-    bvt3000_send_command( buf , port_choice);
+    return bvt3000_send_command( buf , port_choice);
 }
 
 
@@ -600,6 +822,112 @@ int eurotherm902s_get_active_setpoint( struct sp_port* port_choice )
     return eurotherm902s_get_sw(port_choice ) & 0x2000 ? SP2 : SP1;
 }
 
+/*-------------------------------------------------------*
+ * Sets / returns the value of the setpoint in use, SP1
+ * or SP2 (either may be, e.g. after a --step-to)
+ *-------------------------------------------------------*/
+
+void eurotherm902s_set_current_setpoint( double temp, struct sp_port* port_choice )
+{
+    eurotherm902s_set_setpoint( eurotherm902s_get_active_setpoint( port_choice ), temp, port_choice );
+}
+
+double eurotherm902s_get_current_setpoint( struct sp_port* port_choice )
+{
+    return eurotherm902s_get_setpoint( eurotherm902s_get_active_setpoint( port_choice ), port_choice );
+}
+
+/*------------------------------------------------------------------*
+ * Posted (latest-wins) writes, for values a control loop or ramp may
+ * produce faster than the device can acknowledge them. Only the newest
+ * value per register is kept and sent at the next flush (which also
+ * happens before every query); a value identical to the one last
+ * acknowledged is not sent at all. What was acknowledged is forgotten
+ * whenever the register may have changed some other way: a status word
+ * or output limit write, or a read finding a different value.
+ *------------------------------------------------------------------*/
+
+enum { POSTED_SP1, POSTED_SP2, POSTED_OP, POSTED_REGISTERS };
+
+static struct { 
+    char pending[ 20 ];             /* command to send, "" if none */
+    char acked[ 20 ];               /* last command the device ACKed */
+} posted[ POSTED_REGISTERS ];
+
+static void posted_write_done( int reg, const char * cmd, bool ok ) { 
+    /* A direct write supersedes anything still posted for the register */
+    posted[ reg ].pending[ 0 ] = '\0'; 
+    if (ok) { 
+        strcpy( posted[ reg ].acked, cmd ); 
+    } else { 
+        posted[ reg ].acked[ 0 ] = '\0'; 
+    }
+}
+
+static void posted_forget( int reg ) { 
+    posted[ reg ].acked[ 0 ] = '\0'; 
+}
+
+/* A value read back from the register (as the command that would write it) */
+
+static void posted_read( int reg, const char * cmd ) { 
+    if ( strcmp( posted[ reg ].acked, cmd ) ) { 
+        posted_forget( reg ); 
+    }
+}
+
+static void posted_write( int reg, const char * cmd ) { 
+    if ( ! strcmp( posted[ reg ].acked, cmd ) ) { 
+        posted[ reg ].pending[ 0 ] = '\0'; 
+    } else { 
+        strcpy( posted[ reg ].pending, cmd ); 
+    }
+}
+
+void eurotherm902s_post_setpoint( int sp, double temp ) 
+{ 
+    char buf[ 20 ]; 
+
+    assert( sp == SP1 || sp == SP2 );
+    sprintf( buf, "S%c%6.1f", sp == SP1 ? 'L' : '2', temp );
+    posted_write( sp == SP1 ? POSTED_SP1 : POSTED_SP2, buf ); 
+}
+
+void eurotherm902s_post_heater_power( double power ) 
+{ 
+    char buf[ 20 ]; 
+
+    assert( power >= 0.0 && power <= 100.0 );
+    sprintf( buf, "OP%6.1f", power );
+    posted_write( POSTED_OP, buf ); 
+}
+
+/* Returns the number of writes that actually went out, or -1 if the
+   device refused any of them */
+
+int bvt3000_flush_posted_writes( struct sp_port* port_choice ) 
+{ 
+    char cmd[ 20 ]; 
+    int sent = 0; 
+    bool refused = false; 
+
+    for (int reg = 0; reg < POSTED_REGISTERS; reg++) { 
+        if ( posted[ reg ].pending[ 0 ] == '\0' ) { 
+            continue; 
+        }
+        strcpy( cmd, posted[ reg ].pending ); 
+        posted[ reg ].pending[ 0 ] = '\0'; 
+        if ( bvt3000_send_command( cmd, port_choice ) ) { 
+            posted_write_done( reg, cmd, true ); 
+        } else { 
+            posted_write_done( reg, cmd, false ); 
+            refused = true; 
+        }
+        sent++; 
+    }
+    return refused ? -1 : sent; 
+}
+
 /*----------------------------------------------*
  * Sets the setpoint value of either SP1 or SP2
  *----------------------------------------------*/
@@ -614,7 +942,8 @@ void eurotherm902s_set_setpoint( int    sp,
 
     assert( sp == SP1 || sp == SP2 );
     sprintf( buf, "S%c%6.1f", sp == SP1 ? 'L' : '2', temp );
-    bvt3000_send_command( buf, port_choice );
+    posted_write_done( sp == SP1 ? POSTED_SP1 : POSTED_SP2, buf, 
+                       bvt3000_send_command( buf, port_choice ) ); 
 }
 
 
@@ -624,8 +953,14 @@ void eurotherm902s_set_setpoint( int    sp,
 
 double eurotherm902s_get_setpoint( int sp, struct sp_port* port_choice )
 {
+    char buf[ 20 ]; 
+    double temp; 
+
     assert( sp == SP1 || sp == SP2 );
-    return atof( bvt3000_query_without_bcc( sp == SP1 ? "SL" : "S2" , port_choice) );
+    temp = atof( bvt3000_query_without_bcc( sp == SP1 ? "SL" : "S2" , port_choice) );
+    sprintf( buf, "S%c%6.1f", sp == SP1 ? 'L' : '2', temp ); 
+    posted_read( sp == SP1 ? POSTED_SP1 : POSTED_SP2, buf ); 
+    return temp; 
 }
 
 
@@ -652,6 +987,11 @@ void eurotherm902s_set_sw( unsigned int sw, struct sp_port* port_choice )
 
     sprintf( buf, "SW>%04x", sw & 0xE005 );
     bvt3000_send_command( buf , port_choice);
+
+    /* A mode or setpoint switch may leave other values in the registers */
+    for (int reg = 0; reg < POSTED_REGISTERS; reg++) { 
+        posted_forget( reg ); 
+    }
 }
 
 /*-------------------------*
@@ -859,6 +1199,7 @@ void eurotherm902s_set_heater_power_limit( double power, struct sp_port* port_ch
     assert( power >= 0.0 && power <= 100.0 );
     sprintf( buf, "HO%6.1f", power );
     bvt3000_send_command( buf ,port_choice);
+    posted_forget( POSTED_OP ); 
 }
 
 /*---------------------------------------*
@@ -883,7 +1224,7 @@ void eurotherm902s_set_heater_power( double power, struct sp_port* port_choice )
     assert( eurotherm902s_get_mode(port_choice) == AUTOMATIC_MODE );
 
     sprintf( buf, "OP%6.1f", power );
-    bvt3000_send_command( buf , port_choice);
+    posted_write_done( POSTED_OP, buf, bvt3000_send_command( buf , port_choice) ); 
 }
 
 /*-------------------------------*
@@ -892,7 +1233,12 @@ void eurotherm902s_set_heater_power( double power, struct sp_port* port_choice )
 
 double eurotherm902s_get_heater_power( struct sp_port* port_choice )
 {
-    return atof( bvt3000_query( "OP" ,port_choice) );
+    char buf[ 20 ]; 
+    double power = atof( bvt3000_query( "OP" ,port_choice) );
+
+    sprintf( buf, "OP%6.1f", power ); 
+    posted_read( POSTED_OP, buf ); 
+    return power; 
 }
 
 /*---------------------------------------------------------------*
@@ -1091,7 +1437,7 @@ bvt3000_get_ln2_heater_state( struct sp_port* port_choice)
 
 void bvt3000_set_ln2_heater_power( double p, struct sp_port* port_choice )
 {
-    char buf[ 8 ];
+    char buf[ 10 ];
 
     assert( p >= 0.0 && p <= 100.0 );
 
@@ -1115,12 +1461,18 @@ bvt3000_get_ln2_heater_power( struct sp_port* port_choice )
 
 int bvt3000_check_ln2_heater( struct sp_port* port_choice)
 {
-    unsigned int state = bvt3000_get_interface_status( port_choice );
+    return bvt3000_ln2_tank_status( bvt3000_get_interface_status( port_choice ) );
+}
 
+/*------------------------------------------------------*
+ * The same, from an interface status word already read
+ *------------------------------------------------------*/
 
-    if ( state & BVT3000_LN2_EMPTY )
+int bvt3000_ln2_tank_status( unsigned int is )
+{
+    if ( is & BVT3000_LN2_EMPTY )
         return LN2_TANK_EMPTY;
-    else if ( state & BVT3000_LN2_REFILL )
+    else if ( is & BVT3000_LN2_REFILL )
         return LN2_NEEDS_REFILL;
 
     return LN2_OK;
@@ -117,6 +117,7 @@
 #define MAX_PROPORTIONAL_BAND   999.9    /* according to experiments */
 #define MAX_INTEGRAL_TIME      9999.0    /* according to experiments */
 #define MAX_DERIVATIVE_TIME     999.9    /* according to experiments */
+#define MAX_CUTBACK             999.9    /* according to experiments */
 #define MAX_AT_TRIGGER_LEVEL    231.7    /* according to experiments */
 
 
@@ -143,6 +144,32 @@
 #define SERIAL_WAIT  125
 #define ACK_WAIT     300
 
+/* Identical reads issued within this time (in ms) share a single
+   transaction on the wire (0 disables coalescing) */
+
+#define COALESCE_WINDOW  250
+#define COALESCE_SLOTS    16
+
+/* Link statistics kept by the low-level functions. Round-trip times go
+   into a histogram with the upper bounds (in s) in bvt3000_rtt_bounds,
+   plus one bucket for anything slower. */
+
+#define RTT_BUCKETS  8
+
+struct bvt3000_link_stats {
+    unsigned long queries;          /* reads sent on the wire */
+    unsigned long coalesced;        /* reads answered from a recent reply */
+    unsigned long commands;         /* writes sent */
+    unsigned long timeouts;         /* no reply / ACK in time */
+    unsigned long naks;
+    unsigned long bcc_errors;
+    unsigned long framing_errors;   /* malformed or unexpected replies */
+    unsigned long failed_reads;     /* reads that got no usable value, for any of the above */
+    unsigned long rtt_bucket[ RTT_BUCKETS + 1 ];
+    double rtt_sum;
+    unsigned long rtt_count;
+};
+
 #define FAIL    false
 #define OK      true
 #define FALSE   false
@@ -154,7 +181,7 @@
 
 
 extern bool verboseFlag; 
-struct sp_port *port;
+extern struct sp_port *port;
 
 //For debugging: 
 void bvt3000_comm_fail_debug( char const * caller_name ); 
@@ -166,13 +193,18 @@ void list_ports();
 // Low-level communication functions  
 int handled_usleep( unsigned long us_dur, bool quit_on_signal);
 struct sp_port* open_and_init_port(char* desired_port, struct sp_port *port_choice) ;
-void bvt3000_send_command( const char * cmd , struct sp_port* port_choice) ;
+bool bvt3000_send_command( const char * cmd , struct sp_port* port_choice) ;
 size_t bvt3000_add_bcc( unsigned char * data ) ;
 char* bvt3000_query(const char * cmd, struct sp_port* port_choice); 
 char * bvt3000_query_without_bcc( const char * cmd, struct sp_port* port_choice );
 bool bvt3000_check_ack(struct sp_port* port_choice); 
 void bvt3000_comm_fail(); 
 bool bvt3000_check_bcc(unsigned char* data, unsigned char bcc); 
+void bvt3000_set_coalesce_window( unsigned int ms );
+void bvt3000_coalesce_invalidate( void );
+extern const double bvt3000_rtt_bounds[ RTT_BUCKETS ];
+const struct bvt3000_link_stats * bvt3000_get_link_stats( void );
+bool bvt3000_last_query_ok( void );
 unsigned int bvt3000_get_interface_status( struct sp_port* port_choice);
 unsigned int eurotherm902s_get_sw( struct sp_port* port_choice );
 void eurotherm902s_set_os( unsigned int os, struct sp_port* port_choice );
@@ -183,7 +215,7 @@ void eurotherm902s_set_sw( unsigned int sw, struct sp_port* port_choice );
 
 //Flow 
 unsigned int bvt3000_get_flow_rate( struct sp_port* port_choice );
-void bvt3000_set_flow_rate( unsigned int flow_rate, struct sp_port* port_choice );
+bool bvt3000_set_flow_rate( unsigned int flow_rate, struct sp_port* port_choice );
 unsigned char bvt300_get_port( int port , struct sp_port* port_choice );
 
 //Heater functions
@@ -191,6 +223,8 @@ void eurotherm902s_set_heater_power_limit( double power, struct sp_port* port_ch
 double eurotherm902s_get_heater_power_limit( struct sp_port* port_choice );
 void eurotherm902s_set_heater_power( double power, struct sp_port* port_choice );
 double eurotherm902s_get_heater_power( struct sp_port* port_choice );
+void eurotherm902s_post_heater_power( double power );
+int bvt3000_flush_posted_writes( struct sp_port* port_choice );
 int bvt3000_check_heater( struct sp_port* port_choice);
 bool bvt3000_get_heater_state( struct sp_port* port_choice);
 void bvt3000_set_heater_state( bool state, struct sp_port* port_choice);
@@ -210,6 +244,9 @@ void eurotherm902s_set_setpoint( int    sp,
                             struct sp_port* port_choice );
 
 double eurotherm902s_get_setpoint( int sp, struct sp_port* port_choice );
+void eurotherm902s_set_current_setpoint( double temp, struct sp_port* port_choice );
+double eurotherm902s_get_current_setpoint( struct sp_port* port_choice );
+void eurotherm902s_post_setpoint( int sp, double temp );
 double eurotherm902s_get_working_setpoint( struct sp_port* port_choice );
 bool eurotherm902s_get_alarm_state( struct sp_port* port_choice );
 void eurotherm902s_set_self_tune_state( bool on_off , struct sp_port* port_choice );
@@ -245,6 +282,7 @@ bool bvt3000_get_ln2_heater_state( struct sp_port* port_choice);
 void bvt3000_set_ln2_heater_power( double p, struct sp_port* port_choice );
 double bvt3000_get_ln2_heater_power( struct sp_port* port_choice ); 
 int bvt3000_check_ln2_heater( struct sp_port* port_choice);
+int bvt3000_ln2_tank_status( unsigned int is );
 
 //Helper function
 void printArray(char* buf) ;